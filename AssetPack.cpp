@@ -0,0 +1,174 @@
+#include "AssetPack.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+    AssetPack AssetPack::mounted;
+
+    namespace {
+        const unsigned int ASSET_PACK_MAGIC = 0x50535047; // "GPSP"
+
+        struct AssetPackHeader {
+            unsigned int magic;
+            unsigned int version;
+            unsigned long long entryCount;
+            unsigned long long tocOffset;
+        };
+
+        int compareName(const char* name, size_t length, const std::string& other)
+        {
+            int order = memcmp(name, other.data(), std::min(length, other.size()));
+            if (order != 0)
+                return order;
+            return length < other.size() ? -1 : (length > other.size() ? 1 : 0);
+        }
+
+        void pad(std::ofstream& file, unsigned long long& offset)
+        {
+            static const char zeros[AssetPack::ALIGNMENT] = {};
+            size_t padding = (size_t)((AssetPack::ALIGNMENT - offset % AssetPack::ALIGNMENT) % AssetPack::ALIGNMENT);
+            file.write(zeros, padding);
+            offset += padding;
+        }
+    }
+
+    AssetPack::AssetPack()
+    {
+        toc = NULL;
+        entryCount = 0;
+    }
+
+    bool AssetPack::Open(const std::string& fileName)
+    {
+        Close();
+        if (!file.Open(fileName))
+            return false;
+
+        AssetPackHeader header;
+        const char* data = file.getData();
+        size_t size = file.getSize();
+        if (size < sizeof(header)) {
+            Close();
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != ASSET_PACK_MAGIC || header.version != VERSION || header.tocOffset % ALIGNMENT != 0
+            || header.tocOffset > size || header.entryCount > (size - header.tocOffset) / sizeof(TocEntry)) {
+            Close();
+            return false;
+        }
+
+        //entries and names must lie inside the file, Find() trusts them afterwards
+        const TocEntry* entries = (const TocEntry*)(data + header.tocOffset);
+        for (unsigned long long i = 0; i < header.entryCount; i++)
+            if (entries[i].offset > size || entries[i].size > size - entries[i].offset
+                || entries[i].nameOffset > size || entries[i].nameLength > size - entries[i].nameOffset) {
+                Close();
+                return false;
+            }
+
+        toc = entries;
+        entryCount = header.entryCount;
+        return true;
+    }
+
+    void AssetPack::Close()
+    {
+        file.Close();
+        toc = NULL;
+        entryCount = 0;
+    }
+
+    bool AssetPack::Find(const std::string& name, View& view) const
+    {
+        //binary search over the sorted table of contents
+        const char* data = file.getData();
+        unsigned long long first = 0, last = entryCount;
+        while (first < last) {
+            unsigned long long middle = first + (last - first) / 2;
+            const TocEntry& entry = toc[middle];
+            int order = compareName(data + entry.nameOffset, (size_t)entry.nameLength, name);
+            if (order == 0) {
+                view.data = data + entry.offset;
+                view.size = (size_t)entry.size;
+                return true;
+            }
+            if (order < 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return false;
+    }
+
+    size_t AssetPack::getEntryCount() const
+    {
+        return (size_t)entryCount;
+    }
+
+    bool AssetPack::Build(const std::string& fileName, std::vector<Entry>& entries)
+    {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+        //write to a temporary file first, so a crash never leaves a truncated pack behind
+        std::string temporaryFile = fileName + ".tmp";
+        std::ofstream file(temporaryFile.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        AssetPackHeader header = { ASSET_PACK_MAGIC, VERSION, entries.size(), 0 };
+        file.write((const char*)&header, sizeof(header));
+        unsigned long long offset = sizeof(header);
+
+        std::vector<TocEntry> tocEntries(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            pad(file, offset);
+            tocEntries[i].offset = offset;
+            tocEntries[i].size = entries[i].data.size();
+            file.write(entries[i].data.data(), entries[i].data.size());
+            offset += entries[i].data.size();
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            tocEntries[i].nameOffset = offset;
+            tocEntries[i].nameLength = entries[i].name.size();
+            file.write(entries[i].name.data(), entries[i].name.size());
+            offset += entries[i].name.size();
+        }
+        pad(file, offset);
+        header.tocOffset = offset;
+        file.write((const char*)tocEntries.data(), tocEntries.size() * sizeof(TocEntry));
+
+        file.seekp(0);
+        file.write((const char*)&header, sizeof(header));
+        file.close();
+        if (!file)
+            return false;
+
+        std::remove(fileName.c_str());
+        return std::rename(temporaryFile.c_str(), fileName.c_str()) == 0;
+    }
+
+    bool AssetPack::Mount(const std::string& fileName)
+    {
+        return mounted.Open(fileName);
+    }
+
+    bool AssetPack::FindMounted(const std::string& name, View& view)
+    {
+        return mounted.Find(name, view);
+    }
+
+    unsigned char* AssetPack::LoadImageData(const char* fileName, int* width, int* height, int* channels, int desiredChannels)
+    {
+        View view;
+        if (FindMounted(fileName, view))
+            return stbi_load_from_memory((const stbi_uc*)view.data, (int)view.size, width, height, channels, desiredChannels);
+        return stbi_load(fileName, width, height, channels, desiredChannels);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef AssetPack_hpp
+#define AssetPack_hpp
+
+#include "MappedFile.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Every file the scene loads, in one archive that is mapped at startup instead of opening
+    //dozens of small files. Entries are named by the relative path the loaders ask for, start
+    //on an ALIGNMENT boundary and are served in place from the mapping. The table of contents
+    //at the end is sorted by name. Loaders look in the mounted pack first and fall back to disk.
+    class AssetPack
+    {
+    public:
+        static const unsigned int VERSION = 1;
+        static const size_t ALIGNMENT = 16;
+
+        //the bytes of an entry inside the mapping, valid while the pack is open
+        struct View {
+            const char* data;
+            size_t size;
+        };
+
+        //an entry to write, see Build()
+        struct Entry {
+            std::string name;
+            std::string data;
+        };
+
+        AssetPack();
+
+        bool Open(const std::string& fileName);
+        void Close();
+        //false if the pack has no entry with that name
+        bool Find(const std::string& name, View& view) const;
+        size_t getEntryCount() const;
+
+        //writes the entries in name order, false if the file could not be written
+        static bool Build(const std::string& fileName, std::vector<Entry>& entries);
+
+        //opens the pack the loaders look in
+        static bool Mount(const std::string& fileName);
+        //false if nothing is mounted or the mounted pack has no such entry
+        static bool FindMounted(const std::string& name, View& view);
+        //stbi_load() from the mounted pack, or from the file when the pack does not have it
+        static unsigned char* LoadImageData(const char* fileName, int* width, int* height, int* channels, int desiredChannels);
+
+    private:
+        struct TocEntry {
+            unsigned long long nameOffset;
+            unsigned long long nameLength;
+            unsigned long long offset;
+            unsigned long long size;
+        };
+
+        MappedFile file;
+        const TocEntry* toc;
+        unsigned long long entryCount;
+
+        static AssetPack mounted;
+    };
+}
+
+#endif /* AssetPack_hpp */
@@ -20,6 +20,21 @@ namespace gps {
         return glm::lookAt(cameraPosition, cameraTarget, cameraUpDirection);
     }
 
+    //return the view matrix seen from the given position, keeping the current orientation
+    glm::mat4 Camera::getViewMatrix(glm::vec3 position) {
+        return glm::lookAt(position, position + cameraFrontDirection, cameraUpDirection);
+    }
+
+    //return the current camera position
+    glm::vec3 Camera::getCameraPosition() {
+        return cameraPosition;
+    }
+
+    //return the direction the camera looks in
+    glm::vec3 Camera::getFrontDirection() {
+        return cameraFrontDirection;
+    }
+
     //update the camera internal parameters following a camera move event
     void Camera::move(MOVE_DIRECTION direction, float speed) {
         //TODO
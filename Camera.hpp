@@ -17,6 +17,12 @@ namespace gps {
         Camera(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
+        //return the view matrix seen from the given position, keeping the current orientation
+        glm::mat4 getViewMatrix(glm::vec3 position);
+        //return the current camera position
+        glm::vec3 getCameraPosition();
+        //return the direction the camera looks in
+        glm::vec3 getFrontDirection();
         //update the camera internal parameters following a camera move event
         void move(MOVE_DIRECTION direction, float speed);
         //update the camera internal parameters following a camera rotate event
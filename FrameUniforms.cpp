@@ -0,0 +1,37 @@
+#include "FrameUniforms.hpp"
+#include "RenderStats.hpp"
+
+namespace gps {
+
+    void FrameUniforms::Init()
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, buffer);
+    }
+
+    void FrameUniforms::Update(const Data& data)
+    {
+        //orphan the previous storage so the upload does not wait for the frame still using it
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        RenderStats::AddUniformUploads(1);
+    }
+
+    void FrameUniforms::Attach(GLuint program)
+    {
+        GLuint block = glGetUniformBlockIndex(program, "FrameUniforms");
+        if (block != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, block, BINDING);
+    }
+
+    void FrameUniforms::Delete()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef FrameUniforms_hpp
+#define FrameUniforms_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+namespace gps {
+
+    //Uniforms shared by every program and set once per frame, kept in a uniform buffer so a
+    //program switch does not have to upload them again. The layout is std140 and must match
+    //shaders/frameUniforms.glsl, which the shaders #include.
+    class FrameUniforms
+    {
+    public:
+        //uniform buffer binding point of the block
+        static const GLuint BINDING = 0;
+
+        struct Data {
+            glm::mat4 view;
+            glm::mat4 projection;
+            //maps clip space back to world space, the sky builds its view rays with it
+            glm::mat4 inverseViewProjection;
+            //w unused, vec3 members would be padded to 16 bytes anyway
+            glm::vec4 cameraPosition;
+            glm::vec4 lightDirEye;
+            glm::vec4 lightDirWorld;
+            glm::vec4 lightColor;
+            //diffuse ambient light in world space, see SphericalHarmonics::getIrradiance()
+            glm::vec4 ambientSH[9];
+        };
+
+        void Init();
+        void Update(const Data& data);
+        //GLSL 4.10 has no binding layout qualifier, the block is bound to BINDING for every program
+        //that declares it; needed again after a program is rebuilt
+        void Attach(GLuint program);
+        void Delete();
+
+    private:
+        GLuint buffer;
+    };
+}
+
+#endif /* FrameUniforms_hpp */
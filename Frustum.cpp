@@ -0,0 +1,55 @@
+#include "Frustum.hpp"
+
+namespace gps {
+
+    Frustum::Frustum()
+    {
+        //everything is inside until the first Update()
+        for (int i = 0; i < 6; i++)
+            planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    void Frustum::Update(const glm::mat4& viewProjection)
+    {
+        //rows of the matrix, a clip space point is inside when -w <= x, y, z <= w
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        planes[0] = rows[3] + rows[0];
+        planes[1] = rows[3] - rows[0];
+        planes[2] = rows[3] + rows[1];
+        planes[3] = rows[3] - rows[1];
+        planes[4] = rows[3] + rows[2];
+        planes[5] = rows[3] - rows[2];
+    }
+
+    bool Frustum::IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        glm::vec3 center = 0.5f * (boxMin + boxMax);
+        glm::vec3 extent = 0.5f * (boxMax - boxMin);
+        for (int i = 0; i < 6; i++) {
+            glm::vec3 normal = glm::vec3(planes[i]);
+            //the box is outside when even its corner furthest along the normal is behind the plane
+            if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    const glm::vec4* Frustum::getPlanes() const
+    {
+        return planes;
+    }
+
+    bool Frustum::IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& world) const
+    {
+        glm::vec3 center = glm::vec3(world * glm::vec4(0.5f * (boxMin + boxMax), 1.0f));
+        glm::vec3 extent = 0.5f * (boxMax - boxMin);
+        //extent of the transformed box along each world axis
+        glm::vec3 worldExtent = glm::abs(glm::vec3(world[0])) * extent.x
+            + glm::abs(glm::vec3(world[1])) * extent.y
+            + glm::abs(glm::vec3(world[2])) * extent.z;
+        return IntersectsBox(center - worldExtent, center + worldExtent);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "glm/glm.hpp"
+
+namespace gps {
+
+    //The six clip planes of a view-projection matrix, in world space. Objects are tested by
+    //their bounding boxes, conservatively: a box that is reported visible may still be just
+    //outside a corner of the frustum.
+    class Frustum
+    {
+    public:
+        Frustum();
+
+        void Update(const glm::mat4& viewProjection);
+        //world space box
+        bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+        //object space box placed by the world matrix, tested as its world space bounding box
+        bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& world) const;
+        //the six planes in the order left, right, bottom, top, near, far; for the GPU test
+        const glm::vec4* getPlanes() const;
+
+    private:
+        //xyz the inward normal, w the distance; not normalized, only the sign is used
+        glm::vec4 planes[6];
+    };
+}
+
+#endif /* Frustum_hpp */
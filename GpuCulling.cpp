@@ -0,0 +1,279 @@
+#include "GpuCulling.hpp"
+#include "RenderStats.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+namespace gps {
+
+    namespace {
+        //at least one element, so every buffer can be bound before the scene has any instance
+        void uploadBuffer(GLenum target, GLuint buffer, size_t size, const void* data, GLenum usage)
+        {
+            glBindBuffer(target, buffer);
+            if (size == 0)
+                glBufferData(target, sizeof(GLuint), NULL, usage);
+            else
+                glBufferData(target, size, data, usage);
+        }
+    }
+
+    bool GpuCulling::IsSupported()
+    {
+        //the vertex shaders stay at GLSL 4.10 and read the matrices through the extension
+        return GLEW_VERSION_4_3 && GLEW_ARB_shader_storage_buffer_object;
+    }
+
+    void GpuCulling::Init()
+    {
+        glGenBuffers(1, &instanceBuffer);
+        glGenBuffers(1, &instanceBatchBuffer);
+        glGenBuffers(1, &batchBuffer);
+        glGenBuffers(1, &visibleBuffer);
+        glGenBuffers(1, &visibleCountBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &commandBatchBuffer);
+
+        firstDynamicInstance = 0;
+        commandCount = 0;
+        frustumPlanesLoc = instanceCountLoc = commandCountLoc = -1;
+
+        cullShader.loadComputeShaderAsync("shaders/cull.comp");
+        commandShader.loadComputeShaderAsync("shaders/cull.comp", { "WRITE_COMMANDS" });
+    }
+
+    bool GpuCulling::FinishLoad()
+    {
+        bool loaded = cullShader.finishLoad();
+        loaded = commandShader.finishLoad() && loaded;
+        InitUniformLocations();
+        return loaded;
+    }
+
+    void GpuCulling::InitUniformLocations()
+    {
+        frustumPlanesLoc = glGetUniformLocation(cullShader.shaderProgram, "frustumPlanes");
+        instanceCountLoc = glGetUniformLocation(cullShader.shaderProgram, "itemCount");
+        commandCountLoc = glGetUniformLocation(commandShader.shaderProgram, "itemCount");
+    }
+
+    void GpuCulling::BeginBatches()
+    {
+        batches.clear();
+    }
+
+    int GpuCulling::AddBatch(gps::Model3D* model, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        Batch batch;
+        batch.model = model;
+        batch.boundsMin = boundsMin;
+        batch.boundsMax = boundsMax;
+        batch.firstCommand = 0;
+        batches.push_back(batch);
+        return (int)batches.size() - 1;
+    }
+
+    void GpuCulling::AddInstance(int batch, int transform)
+    {
+        batches[batch].transforms.push_back(transform);
+    }
+
+    void GpuCulling::EndBatches(gps::TransformSystem& transforms)
+    {
+        //static instances first, so the dynamic ones are uploaded every frame as one range
+        instanceTransforms.clear();
+        std::vector<GLuint> instanceBatches;
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1)
+                firstDynamicInstance = (int)instanceTransforms.size();
+            for (size_t b = 0; b < batches.size(); b++)
+                for (size_t i = 0; i < batches[b].transforms.size(); i++)
+                    if (transforms.isStatic(batches[b].transforms[i]) == (pass == 0)) {
+                        instanceTransforms.push_back(batches[b].transforms[i]);
+                        instanceBatches.push_back((GLuint)b);
+                    }
+        }
+
+        instanceData.resize(instanceTransforms.size());
+        for (size_t i = 0; i < instanceTransforms.size(); i++)
+            instanceData[i] = ComputeInstance(transforms, instanceTransforms[i]);
+
+        //each batch owns a range of the visible list as long as its instance count, and one
+        //command per mesh drawing from the start of that range
+        std::vector<BatchData> batchData(batches.size());
+        std::vector<DrawCommand> commands;
+        std::vector<GLuint> commandBatches;
+        GLuint firstVisible = 0;
+        for (size_t b = 0; b < batches.size(); b++) {
+            Batch& batch = batches[b];
+            batchData[b].boundsMin = glm::vec4(batch.boundsMin, 1.0f);
+            batchData[b].boundsMax = glm::vec4(batch.boundsMax, 1.0f);
+            batchData[b].firstVisible = firstVisible;
+
+            batch.firstCommand = (int)commands.size();
+            for (size_t m = 0; m < batch.model->getMeshCount(); m++) {
+                gps::Mesh& mesh = batch.model->getMesh(m);
+                DrawCommand command = { (GLuint)mesh.indexCount, 0, mesh.firstIndex, 0, firstVisible };
+                commands.push_back(command);
+                commandBatches.push_back((GLuint)b);
+                AttachMesh(mesh);
+            }
+            firstVisible += (GLuint)batch.transforms.size();
+        }
+        commandCount = (int)commands.size();
+
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer, instanceData.size() * sizeof(InstanceData), instanceData.data(), GL_DYNAMIC_DRAW);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, instanceBatchBuffer, instanceBatches.size() * sizeof(GLuint), instanceBatches.data(), GL_STATIC_DRAW);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, batchBuffer, batchData.size() * sizeof(BatchData), batchData.data(), GL_STATIC_DRAW);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer, firstVisible * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, visibleCountBuffer, batches.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer, commands.size() * sizeof(DrawCommand), commands.data(), GL_DYNAMIC_COPY);
+        uploadBuffer(GL_SHADER_STORAGE_BUFFER, commandBatchBuffer, commandBatches.size() * sizeof(GLuint), commandBatches.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    GpuCulling::InstanceData GpuCulling::ComputeInstance(gps::TransformSystem& transforms, int transform)
+    {
+        InstanceData data;
+        data.world = transforms.getWorld(transform);
+        data.normal = glm::mat4(transforms.getWorldNormalMatrix(transform));
+        return data;
+    }
+
+    void GpuCulling::AttachMesh(gps::Mesh& mesh)
+    {
+        //the submeshes of a shape share their vertex arrays, setting it again is harmless
+        gps::Buffers buffers = mesh.getBuffers();
+        GLuint vertexArrays[2] = { buffers.VAO, buffers.depthVAO };
+        for (int i = 0; i < 2; i++) {
+            glBindVertexArray(vertexArrays[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+            glVertexAttribIPointer(INSTANCE_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+            //advanced once per instance, starting at the baseInstance of the command
+            glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 1);
+        }
+        glBindVertexArray(0);
+    }
+
+    void GpuCulling::UpdateTransforms(gps::TransformSystem& transforms)
+    {
+        int instanceCount = (int)instanceTransforms.size();
+        if (firstDynamicInstance >= instanceCount)
+            return;
+
+        for (int i = firstDynamicInstance; i < instanceCount; i++)
+            instanceData[i] = ComputeInstance(transforms, instanceTransforms[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstDynamicInstance * sizeof(InstanceData),
+            (instanceCount - firstDynamicInstance) * sizeof(InstanceData), &instanceData[firstDynamicInstance]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void GpuCulling::Cull(const gps::Frustum& frustum)
+    {
+        GLuint bindings[7][2] = {
+            { INSTANCE_BINDING, instanceBuffer }, { INSTANCE_BATCH_BINDING, instanceBatchBuffer },
+            { BATCH_BINDING, batchBuffer }, { VISIBLE_BINDING, visibleBuffer },
+            { VISIBLE_COUNT_BINDING, visibleCountBuffer }, { COMMAND_BINDING, commandBuffer },
+            { COMMAND_BATCH_BINDING, commandBatchBuffer }
+        };
+        //the instance matrices stay bound for the vertex shaders
+        for (int i = 0; i < 7; i++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindings[i][0], bindings[i][1]);
+
+        int instanceCount = (int)instanceTransforms.size();
+        if (instanceCount == 0 || cullShader.shaderProgram == 0 || commandShader.shaderProgram == 0)
+            return;
+
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleCountBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        cullShader.useShaderProgram();
+        glUniform4fv(frustumPlanesLoc, 6, glm::value_ptr(frustum.getPlanes()[0]));
+        glUniform1ui(instanceCountLoc, (GLuint)instanceCount);
+        glDispatchCompute((instanceCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+        //every instance is counted before the commands take the counts
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        commandShader.useShaderProgram();
+        glUniform1ui(commandCountLoc, (GLuint)commandCount);
+        glDispatchCompute((commandCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+        //the draws read the commands, and the visible lists as a vertex attribute
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        RenderStats::AddUniformUploads(3);
+    }
+
+    void GpuCulling::Attach(GLuint program)
+    {
+        GLuint block = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Instances");
+        if (block != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(program, block, INSTANCE_BINDING);
+    }
+
+    void GpuCulling::Draw(int batch, size_t mesh, gps::Shader shader, const gps::MaterialUniforms& uniforms)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        GLintptr command = (GLintptr)((batches[batch].firstCommand + mesh) * sizeof(DrawCommand));
+        batches[batch].model->getMesh(mesh).DrawIndirect(shader, uniforms, command);
+    }
+
+    void GpuCulling::DrawDepth(int batch, size_t mesh, gps::Shader shader)
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        GLintptr command = (GLintptr)((batches[batch].firstCommand + mesh) * sizeof(DrawCommand));
+        batches[batch].model->getMesh(mesh).DrawDepthIndirect(shader, command);
+    }
+
+    int GpuCulling::getBatchCount()
+    {
+        return (int)batches.size();
+    }
+
+    gps::Model3D* GpuCulling::getModel(int batch)
+    {
+        return batches[batch].model;
+    }
+
+    int GpuCulling::getInstanceCount()
+    {
+        return (int)instanceTransforms.size();
+    }
+
+    bool GpuCulling::ReloadChanged(const std::string& fileName)
+    {
+        bool reloaded = false;
+        if (cullShader.dependsOn(fileName))
+            reloaded = cullShader.reload() || reloaded;
+        if (commandShader.dependsOn(fileName))
+            reloaded = commandShader.reload() || reloaded;
+        if (reloaded)
+            InitUniformLocations();
+        return reloaded;
+    }
+
+    std::vector<std::string> GpuCulling::getDependencies()
+    {
+        std::vector<std::string> files = cullShader.getDependencies();
+        std::vector<std::string> commandFiles = commandShader.getDependencies();
+        for (size_t i = 0; i < commandFiles.size(); i++)
+            if (std::find(files.begin(), files.end(), commandFiles[i]) == files.end())
+                files.push_back(commandFiles[i]);
+        return files;
+    }
+
+    void GpuCulling::Delete()
+    {
+        GLuint buffers[7] = { instanceBuffer, instanceBatchBuffer, batchBuffer, visibleBuffer,
+            visibleCountBuffer, commandBuffer, commandBatchBuffer };
+        glDeleteBuffers(7, buffers);
+        glDeleteProgram(cullShader.shaderProgram);
+        glDeleteProgram(commandShader.shaderProgram);
+        batches.clear();
+        instanceTransforms.clear();
+    }
+}
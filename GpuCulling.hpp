@@ -0,0 +1,138 @@
+#ifndef GpuCulling_hpp
+#define GpuCulling_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+#include "Model3D.hpp"
+#include "Frustum.hpp"
+#include "TransformSystem.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Frustum culling and draw submission on the GPU (OpenGL 4.3, or the compute shader, shader
+    //storage buffer and multi draw indirect extensions). The instances are grouped into batches,
+    //one per model and shadow setting, and their matrices and the bounding boxes of the batches
+    //live in shader storage buffers. Every frame shaders/cull.comp tests each instance and
+    //appends the visible ones to the list of its batch, then writes the instance counts into one
+    //DrawElementsIndirectCommand per mesh. Each mesh is drawn with a single indirect draw, however
+    //many instances of it there are; the vertex shaders (GPU_INSTANCES) fetch the matrices with
+    //the instance index of vertex attribute INSTANCE_ATTRIBUTE.
+    class GpuCulling
+    {
+    public:
+        //vertex attribute of the mesh vertex arrays holding the index of the visible instance
+        static const GLuint INSTANCE_ATTRIBUTE = 4;
+        //shader storage binding points, GLSL 4.10 has no binding layout qualifier
+        static const GLuint INSTANCE_BINDING = 1;
+        static const GLuint INSTANCE_BATCH_BINDING = 2;
+        static const GLuint BATCH_BINDING = 3;
+        static const GLuint VISIBLE_BINDING = 4;
+        static const GLuint VISIBLE_COUNT_BINDING = 5;
+        static const GLuint COMMAND_BINDING = 6;
+        static const GLuint COMMAND_BATCH_BINDING = 7;
+        //invocations per work group, local_size_x of shaders/cull.comp
+        static const GLuint GROUP_SIZE = 64;
+
+        //false on the OpenGL 4.1 path, the objects are then culled on the CPU
+        static bool IsSupported();
+
+        //creates the buffers and issues the compiles of the culling programs
+        void Init();
+        //waits for the culling programs, false if they did not build
+        bool FinishLoad();
+
+        //the batches are rebuilt whenever models are uploaded or evicted or the objects change
+        void BeginBatches();
+        //returns the batch index; the model must stay uploaded until the next rebuild
+        int AddBatch(gps::Model3D* model, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+        void AddInstance(int batch, int transform);
+        //uploads the batches, the commands and the matrices of every instance
+        void EndBatches(gps::TransformSystem& transforms);
+        //uploads the matrices of the dynamic instances, after the transforms are updated
+        void UpdateTransforms(gps::TransformSystem& transforms);
+        //culls every instance against the frustum and writes the draw commands
+        void Cull(const gps::Frustum& frustum);
+
+        //binds the instance matrices of a program using GPU_INSTANCES; needed again after the
+        //program is rebuilt
+        void Attach(GLuint program);
+        //every visible instance of a mesh of the batch, in one draw
+        void Draw(int batch, size_t mesh, gps::Shader shader, const gps::MaterialUniforms& uniforms);
+        void DrawDepth(int batch, size_t mesh, gps::Shader shader);
+
+        int getBatchCount();
+        gps::Model3D* getModel(int batch);
+        int getInstanceCount();
+
+        //rebuilds the culling programs built from the file, true if any of them was replaced
+        bool ReloadChanged(const std::string& fileName);
+        std::vector<std::string> getDependencies();
+        void Delete();
+
+    private:
+        //the layouts below are std430 and must match shaders/cull.comp and shaders/instances.glsl
+        struct InstanceData {
+            glm::mat4 world;
+            //world space normal matrix in the first three columns
+            glm::mat4 normal;
+        };
+
+        struct BatchData {
+            glm::vec4 boundsMin;
+            glm::vec4 boundsMax;
+            //start of the list of visible instances of the batch
+            GLuint firstVisible;
+            GLuint padding[3];
+        };
+
+        //DrawElementsIndirectCommand
+        struct DrawCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        struct Batch {
+            gps::Model3D* model;
+            glm::vec3 boundsMin, boundsMax;
+            int firstCommand;
+            std::vector<int> transforms;
+        };
+
+        std::vector<Batch> batches;
+        //transform of every instance, the static ones first
+        std::vector<int> instanceTransforms;
+        int firstDynamicInstance;
+        int commandCount;
+        std::vector<InstanceData> instanceData;
+
+        GLuint instanceBuffer;
+        GLuint instanceBatchBuffer;
+        GLuint batchBuffer;
+        //also the vertex buffer of INSTANCE_ATTRIBUTE, so it keeps its name when it grows
+        GLuint visibleBuffer;
+        GLuint visibleCountBuffer;
+        GLuint commandBuffer;
+        GLuint commandBatchBuffer;
+
+        //one pass per instance, then one per command (WRITE_COMMANDS)
+        gps::Shader cullShader;
+        gps::Shader commandShader;
+        GLint frustumPlanesLoc;
+        GLint instanceCountLoc;
+        GLint commandCountLoc;
+
+        void InitUniformLocations();
+        InstanceData ComputeInstance(gps::TransformSystem& transforms, int transform);
+        void AttachMesh(gps::Mesh& mesh);
+    };
+}
+
+#endif /* GpuCulling_hpp */
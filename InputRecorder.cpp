@@ -0,0 +1,111 @@
+#include "InputRecorder.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    void InputRecorder::StartRecording()
+    {
+        events.clear();
+        replayPosition = 0;
+        recording = true;
+    }
+
+    void InputRecorder::StopRecording()
+    {
+        recording = false;
+    }
+
+    bool InputRecorder::isRecording()
+    {
+        return recording;
+    }
+
+    void InputRecorder::RecordKey(int tick, int key, int action)
+    {
+        if (!recording)
+            return;
+        InputEvent event = { tick, InputEvent::KEY, key, action, 0.0, 0.0 };
+        events.push_back(event);
+    }
+
+    void InputRecorder::RecordMouse(int tick, double x, double y)
+    {
+        if (!recording)
+            return;
+        InputEvent event = { tick, InputEvent::MOUSE, 0, 0, x, y };
+        events.push_back(event);
+    }
+
+    bool InputRecorder::Save(const std::string& fileName)
+    {
+        std::ofstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "Could not write the input track " << fileName << std::endl;
+            return false;
+        }
+
+        //one event per line: "<tick> key <key> <action>" or "<tick> mouse <x> <y>"
+        file << "gps-input-track 1\n";
+        char line[128];
+        for (size_t i = 0; i < events.size(); i++) {
+            const InputEvent& event = events[i];
+            if (event.type == InputEvent::KEY)
+                snprintf(line, sizeof(line), "%d key %d %d\n", event.tick, event.key, event.action);
+            else
+                snprintf(line, sizeof(line), "%d mouse %.17g %.17g\n", event.tick, event.x, event.y);
+            file << line;
+        }
+
+        std::cout << "Saved " << events.size() << " input events to " << fileName << std::endl;
+        return true;
+    }
+
+    bool InputRecorder::Load(const std::string& fileName)
+    {
+        std::ifstream file(fileName.c_str());
+        std::string header;
+        if (!file || !std::getline(file, header) || header != "gps-input-track 1") {
+            std::cerr << "Could not read the input track " << fileName << std::endl;
+            return false;
+        }
+
+        events.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream stream(line);
+            InputEvent event = { 0, InputEvent::KEY, 0, 0, 0.0, 0.0 };
+            std::string type;
+            if (!(stream >> event.tick >> type))
+                continue;
+
+            if (type == "key" && stream >> event.key >> event.action) {
+                event.type = InputEvent::KEY;
+            } else if (type == "mouse" && stream >> event.x >> event.y) {
+                event.type = InputEvent::MOUSE;
+            } else {
+                std::cerr << "Skipping malformed input event: " << line << std::endl;
+                continue;
+            }
+            events.push_back(event);
+        }
+
+        replayPosition = 0;
+        return true;
+    }
+
+    const InputEvent* InputRecorder::NextEvent(int tick)
+    {
+        if (replayPosition >= events.size() || events[replayPosition].tick > tick)
+            return NULL;
+        return &events[replayPosition++];
+    }
+
+    size_t InputRecorder::getEventCount()
+    {
+        return events.size();
+    }
+}
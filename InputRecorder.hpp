@@ -0,0 +1,51 @@
+#ifndef InputRecorder_hpp
+#define InputRecorder_hpp
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct InputEvent
+    {
+        enum Type { KEY, MOUSE };
+
+        //simulation steps completed before the event arrived
+        int tick;
+        Type type;
+        int key;
+        int action;
+        double x;
+        double y;
+    };
+
+    //Records the keyboard and mouse callbacks against the fixed simulation step they arrived
+    //in, so replaying them before the same steps reproduces the camera path exactly,
+    //independently of the frame rate of the recording or of the replay.
+    class InputRecorder
+    {
+    public:
+        void StartRecording();
+        void StopRecording();
+        bool isRecording();
+
+        void RecordKey(int tick, int key, int action);
+        void RecordMouse(int tick, double x, double y);
+
+        bool Save(const std::string& fileName);
+        bool Load(const std::string& fileName);
+
+        //returns the next event that belongs to the given tick or an earlier one, NULL when
+        //the replay has caught up with the tick
+        const InputEvent* NextEvent(int tick);
+
+        size_t getEventCount();
+
+    private:
+        std::vector<InputEvent> events;
+        size_t replayPosition = 0;
+        bool recording = false;
+    };
+}
+
+#endif /* InputRecorder_hpp */
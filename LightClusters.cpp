@@ -0,0 +1,247 @@
+#include "LightClusters.hpp"
+#include "RenderStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void LightClusters::Init()
+    {
+        InitBuffer(&lightData, GL_RGBA32F);
+        InitBuffer(&clusterData, GL_RG32UI);
+        InitBuffer(&lightIndices, GL_R32UI);
+
+        clusterCounts.resize(CLUSTER_COUNT);
+        clusterRanges.resize(2 * CLUSTER_COUNT);
+        visibleLights = 0;
+    }
+
+    void LightClusters::InitBuffer(Buffer* buffer, GLenum format)
+    {
+        glGenBuffers(1, &buffer->buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer->buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+
+        glGenTextures(1, &buffer->texture);
+        glBindTexture(GL_TEXTURE_BUFFER, buffer->texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer->buffer);
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::UploadBuffer(Buffer buffer, const void* data, size_t size)
+    {
+        //orphan the previous storage so the upload does not wait for the frame still using it
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer.buffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::BuildClusterBounds(glm::mat4 projectionMatrix)
+    {
+        //recover the clip planes from the perspective matrix
+        zNear = projectionMatrix[3][2] / (projectionMatrix[2][2] - 1.0f);
+        zFar = projectionMatrix[3][2] / (projectionMatrix[2][2] + 1.0f);
+        clusterProjection = projectionMatrix;
+
+        clusterMin.resize(CLUSTER_COUNT);
+        clusterMax.resize(CLUSTER_COUNT);
+
+        for (int k = 0; k < CLUSTERS_Z; k++) {
+            //exponential slices keep the clusters roughly cubic along the view direction
+            float sliceNear = zNear * std::pow(zFar / zNear, (float)k / CLUSTERS_Z);
+            float sliceFar = zNear * std::pow(zFar / zNear, (float)(k + 1) / CLUSTERS_Z);
+
+            for (int j = 0; j < CLUSTERS_Y; j++) {
+                float ndcY0 = -1.0f + 2.0f * j / CLUSTERS_Y;
+                float ndcY1 = -1.0f + 2.0f * (j + 1) / CLUSTERS_Y;
+
+                for (int i = 0; i < CLUSTERS_X; i++) {
+                    float ndcX0 = -1.0f + 2.0f * i / CLUSTERS_X;
+                    float ndcX1 = -1.0f + 2.0f * (i + 1) / CLUSTERS_X;
+
+                    glm::vec3 boundsMin(1e30f);
+                    glm::vec3 boundsMax(-1e30f);
+                    float depths[2] = { sliceNear, sliceFar };
+                    float ndcXs[2] = { ndcX0, ndcX1 };
+                    float ndcYs[2] = { ndcY0, ndcY1 };
+                    for (int d = 0; d < 2; d++)
+                        for (int x = 0; x < 2; x++)
+                            for (int y = 0; y < 2; y++) {
+                                glm::vec3 corner(ndcXs[x] * depths[d] / projectionMatrix[0][0],
+                                    ndcYs[y] * depths[d] / projectionMatrix[1][1],
+                                    -depths[d]);
+                                boundsMin = glm::min(boundsMin, corner);
+                                boundsMax = glm::max(boundsMax, corner);
+                            }
+
+                    int cluster = i + CLUSTERS_X * (j + CLUSTERS_Y * k);
+                    clusterMin[cluster] = boundsMin;
+                    clusterMax[cluster] = boundsMax;
+                }
+            }
+        }
+    }
+
+    int LightClusters::DepthSlice(float depth)
+    {
+        int slice = (int)std::floor(std::log(depth / zNear) * CLUSTERS_Z / std::log(zFar / zNear));
+        return glm::clamp(slice, 0, CLUSTERS_Z - 1);
+    }
+
+    void LightClusters::Update(const std::vector<PointLight>& lights, glm::mat4 viewMatrix, glm::mat4 projectionMatrix, int viewportWidth, int viewportHeight)
+    {
+        if (clusterMin.empty() || projectionMatrix != clusterProjection)
+            BuildClusterBounds(projectionMatrix);
+
+        this->viewportWidth = viewportWidth;
+        this->viewportHeight = viewportHeight;
+
+        lightTexels.clear();
+        pairClusters.clear();
+        pairLights.clear();
+        std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+        visibleLights = 0;
+
+        float p00 = projectionMatrix[0][0];
+        float p11 = projectionMatrix[1][1];
+
+        for (size_t l = 0; l < lights.size(); l++) {
+            const PointLight& light = lights[l];
+            glm::vec3 center = glm::vec3(viewMatrix * glm::vec4(light.position, 1.0f));
+            float radius = light.radius;
+
+            //reject lights entirely in front of the near plane or past the far plane
+            float depthMin = -center.z - radius;
+            float depthMax = -center.z + radius;
+            if (depthMax < zNear || depthMin > zFar)
+                continue;
+
+            int k0 = DepthSlice(std::max(depthMin, zNear));
+            int k1 = DepthSlice(std::min(depthMax, zFar));
+
+            //conservative screen rectangle from the corners of the sphere's view space box
+            float zClosest = std::max(depthMin, zNear);
+            float zFarthest = depthMax;
+            float ndcMinX = 1e30f, ndcMaxX = -1e30f, ndcMinY = 1e30f, ndcMaxY = -1e30f;
+            float depths[2] = { zClosest, zFarthest };
+            for (int d = 0; d < 2; d++) {
+                float xs[2] = { center.x - radius, center.x + radius };
+                float ys[2] = { center.y - radius, center.y + radius };
+                for (int e = 0; e < 2; e++) {
+                    ndcMinX = std::min(ndcMinX, p00 * xs[e] / depths[d]);
+                    ndcMaxX = std::max(ndcMaxX, p00 * xs[e] / depths[d]);
+                    ndcMinY = std::min(ndcMinY, p11 * ys[e] / depths[d]);
+                    ndcMaxY = std::max(ndcMaxY, p11 * ys[e] / depths[d]);
+                }
+            }
+            if (ndcMaxX < -1.0f || ndcMinX > 1.0f || ndcMaxY < -1.0f || ndcMinY > 1.0f)
+                continue;
+
+            int i0 = glm::clamp((int)std::floor((ndcMinX * 0.5f + 0.5f) * CLUSTERS_X), 0, CLUSTERS_X - 1);
+            int i1 = glm::clamp((int)std::floor((ndcMaxX * 0.5f + 0.5f) * CLUSTERS_X), 0, CLUSTERS_X - 1);
+            int j0 = glm::clamp((int)std::floor((ndcMinY * 0.5f + 0.5f) * CLUSTERS_Y), 0, CLUSTERS_Y - 1);
+            int j1 = glm::clamp((int)std::floor((ndcMaxY * 0.5f + 0.5f) * CLUSTERS_Y), 0, CLUSTERS_Y - 1);
+
+            GLuint lightIndex = (GLuint)visibleLights;
+            bool touched = false;
+            for (int k = k0; k <= k1; k++)
+                for (int j = j0; j <= j1; j++)
+                    for (int i = i0; i <= i1; i++) {
+                        int cluster = i + CLUSTERS_X * (j + CLUSTERS_Y * k);
+                        //sphere - box test against the closest point of the cluster
+                        glm::vec3 closest = glm::max(clusterMin[cluster], glm::min(center, clusterMax[cluster]));
+                        glm::vec3 delta = closest - center;
+                        if (glm::dot(delta, delta) > radius * radius)
+                            continue;
+
+                        pairClusters.push_back(cluster);
+                        pairLights.push_back(lightIndex);
+                        clusterCounts[cluster]++;
+                        touched = true;
+                    }
+
+            if (!touched)
+                continue;
+
+            glm::vec3 direction = glm::vec3(viewMatrix * glm::vec4(light.direction, 0.0f));
+            lightTexels.push_back(glm::vec4(center, radius));
+            lightTexels.push_back(glm::vec4(light.color, light.spotOuterCos));
+            lightTexels.push_back(glm::vec4(direction, light.spotInnerCos));
+            visibleLights++;
+        }
+
+        //prefix sum of the per-cluster counts gives each cluster its range in the index list
+        GLuint offset = 0;
+        for (int c = 0; c < CLUSTER_COUNT; c++) {
+            clusterRanges[2 * c] = offset;
+            clusterRanges[2 * c + 1] = 0;
+            offset += clusterCounts[c];
+        }
+
+        indices.resize(pairLights.size());
+        for (size_t p = 0; p < pairLights.size(); p++) {
+            GLuint cluster = pairClusters[p];
+            indices[clusterRanges[2 * cluster] + clusterRanges[2 * cluster + 1]] = pairLights[p];
+            clusterRanges[2 * cluster + 1]++;
+        }
+
+        UploadBuffer(lightData, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+        UploadBuffer(clusterData, clusterRanges.data(), clusterRanges.size() * sizeof(GLuint));
+        UploadBuffer(lightIndices, indices.data(), indices.size() * sizeof(GLuint));
+    }
+
+    LightClusters::Uniforms LightClusters::GetUniforms(GLuint program)
+    {
+        Uniforms uniforms;
+        uniforms.lightData = glGetUniformLocation(program, "lightData");
+        uniforms.clusterData = glGetUniformLocation(program, "clusterData");
+        uniforms.lightIndices = glGetUniformLocation(program, "lightIndices");
+        uniforms.clusterCount = glGetUniformLocation(program, "clusterCount");
+        uniforms.clusterTileSize = glGetUniformLocation(program, "clusterTileSize");
+        uniforms.clusterDepthParams = glGetUniformLocation(program, "clusterDepthParams");
+        return uniforms;
+    }
+
+    void LightClusters::Bind(gps::Shader shader, const Uniforms& uniforms)
+    {
+        shader.useShaderProgram();
+
+        Buffer buffers[3] = { lightData, clusterData, lightIndices };
+        GLint locations[3] = { uniforms.lightData, uniforms.clusterData, uniforms.lightIndices };
+        for (int i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE0 + FIRST_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_BUFFER, buffers[i].texture);
+            glUniform1i(locations[i], FIRST_TEXTURE_UNIT + i);
+        }
+
+        //slice = log(depth) * scale + bias
+        float depthScale = CLUSTERS_Z / std::log(zFar / zNear);
+        float depthBias = -CLUSTERS_Z * std::log(zNear) / std::log(zFar / zNear);
+
+        glUniform3ui(uniforms.clusterCount, CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+        glUniform2f(uniforms.clusterTileSize, (float)viewportWidth / CLUSTERS_X, (float)viewportHeight / CLUSTERS_Y);
+        glUniform2f(uniforms.clusterDepthParams, depthScale, depthBias);
+
+        RenderStats::AddTextureBinds(3);
+        RenderStats::AddUniformUploads(6);
+    }
+
+    int LightClusters::getVisibleLightCount()
+    {
+        return visibleLights;
+    }
+
+    void LightClusters::Delete()
+    {
+        Buffer buffers[3] = { lightData, clusterData, lightIndices };
+        for (int i = 0; i < 3; i++) {
+            glDeleteTextures(1, &buffers[i].texture);
+            glDeleteBuffers(1, &buffers[i].buffer);
+        }
+    }
+}
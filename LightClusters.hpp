@@ -0,0 +1,89 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    struct PointLight
+    {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+        //cosine of the outer cone angle, -1 for point lights
+        float spotOuterCos;
+        glm::vec3 direction;
+        //cosine of the inner cone angle, where the spot reaches full intensity
+        float spotInnerCos;
+    };
+
+    //Bins the local lights into a 3D grid of view frustum clusters (tiles on screen, exponential
+    //slices in depth) so that each fragment only iterates the lights touching its own cluster.
+    //OpenGL 4.1 has no shader storage buffers, so the lights, the per-cluster ranges and the
+    //light index list are uploaded into texture buffers.
+    class LightClusters
+    {
+    public:
+        static const int CLUSTERS_X = 16;
+        static const int CLUSTERS_Y = 9;
+        static const int CLUSTERS_Z = 24;
+        static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+        //texture units used by the cluster buffers, the mesh textures and the shadow map come first
+        static const int FIRST_TEXTURE_UNIT = 4;
+
+        //uniform locations of a program using the clusters, looked up once per program
+        struct Uniforms {
+            GLint lightData, clusterData, lightIndices;
+            GLint clusterCount, clusterTileSize, clusterDepthParams;
+        };
+
+        void Init();
+        //lights are given in world space, the binning happens in view space
+        void Update(const std::vector<PointLight>& lights, glm::mat4 viewMatrix, glm::mat4 projectionMatrix, int viewportWidth, int viewportHeight);
+        static Uniforms GetUniforms(GLuint program);
+        void Bind(gps::Shader shader, const Uniforms& uniforms);
+        void Delete();
+
+        int getVisibleLightCount();
+
+    private:
+        struct Buffer {
+            GLuint buffer;
+            GLuint texture;
+        };
+
+        Buffer lightData;
+        Buffer clusterData;
+        Buffer lightIndices;
+
+        //view space bounds of every cluster, rebuilt only when the projection changes
+        std::vector<glm::vec3> clusterMin;
+        std::vector<glm::vec3> clusterMax;
+        glm::mat4 clusterProjection;
+
+        std::vector<glm::vec4> lightTexels;
+        std::vector<GLuint> clusterRanges;
+        std::vector<GLuint> clusterCounts;
+        std::vector<GLuint> indices;
+        std::vector<GLuint> pairClusters;
+        std::vector<GLuint> pairLights;
+
+        float zNear;
+        float zFar;
+        int viewportWidth;
+        int viewportHeight;
+        int visibleLights;
+
+        void InitBuffer(Buffer* buffer, GLenum format);
+        void UploadBuffer(Buffer buffer, const void* data, size_t size);
+        void BuildClusterBounds(glm::mat4 projectionMatrix);
+        int DepthSlice(float depth);
+    };
+}
+
+#endif /* LightClusters_hpp */
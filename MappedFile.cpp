@@ -0,0 +1,114 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gps {
+
+    MappedFile::MappedFile()
+    {
+        data = NULL;
+        size = 0;
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = NULL;
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& fileName)
+    {
+        Close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            Close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+        //an empty file cannot be mapped, it is simply open with no data
+        if (size == 0)
+            return true;
+
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle != NULL)
+            data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (data == NULL) {
+            Close();
+            return false;
+        }
+#else
+        int descriptor = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) {
+            close(descriptor);
+            return false;
+        }
+        size = (size_t)info.st_size;
+        if (size == 0) {
+            close(descriptor);
+            return true;
+        }
+
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        //the mapping keeps its own reference to the file
+        close(descriptor);
+        if (mapping == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        //parsers walk the file front to back
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = (const char*)mapping;
+#endif
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+#ifdef _WIN32
+        if (data != NULL)
+            UnmapViewOfFile(data);
+        if (mappingHandle != NULL)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data != NULL)
+            munmap((void*)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const char* MappedFile::getData() const
+    {
+        return data;
+    }
+
+    size_t MappedFile::getSize() const
+    {
+        return size;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    //A file mapped read-only into memory. Parsers read it in place, without copying it into
+    //stream buffers or strings; the pages are brought in by the OS as they are touched.
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        bool Open(const std::string& fileName);
+        void Close();
+
+        const char* getData() const;
+        size_t getSize() const;
+
+    private:
+        const char* data;
+        size_t size;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#endif
+
+        //the mapping is owned, copies would unmap it twice
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    };
+}
+
+#endif /* MappedFile_hpp */
@@ -1,59 +1,195 @@
 #include "Mesh.hpp"
+#include "RenderStats.hpp"
 namespace gps {
 
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+		: Mesh(vertices, indices, textures, Material{ glm::vec3(0.2f), glm::vec3(0.8f), glm::vec3(0.0f) })
+	{
+	}
+
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material)
+		: Mesh(vertices, indices, textures, material, std::vector<glm::vec4>())
+	{
+	}
+
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material, std::vector<glm::vec4> tangents)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->material = material;
+		this->tangents = tangents;
+		this->firstIndex = 0;
+		this->indexCount = (GLsizei)indices.size();
 
 		this->setupMesh();
 	}
 
+	Mesh::Mesh(Buffers buffers, GLuint firstIndex, GLsizei indexCount, std::vector<Texture> textures, Material material)
+	{
+		this->buffers = buffers;
+		this->firstIndex = firstIndex;
+		this->indexCount = indexCount;
+		this->textures = textures;
+		this->material = material;
+	}
+
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
-	/* Mesh drawing function - also applies associated textures */
+	MaterialUniforms Mesh::GetMaterialUniforms(GLuint program)
+	{
+		MaterialUniforms uniforms;
+		uniforms.diffuseTexture = glGetUniformLocation(program, "diffuseTexture");
+		uniforms.specularTexture = glGetUniformLocation(program, "specularTexture");
+		uniforms.materialDiffuse = glGetUniformLocation(program, "materialDiffuse");
+		uniforms.materialSpecular = glGetUniformLocation(program, "materialSpecular");
+		return uniforms;
+	}
+
 	void Mesh::Draw(gps::Shader shader)
+	{
+		Draw(shader, GetMaterialUniforms(shader.shaderProgram));
+	}
+
+	/* Mesh drawing function - also applies associated textures */
+	void Mesh::Draw(gps::Shader shader, const MaterialUniforms& uniforms)
+	{
+		shader.useShaderProgram();
+		unsigned int materialUniforms = bindMaterial(uniforms);
+
+		glBindVertexArray(this->buffers.VAO);
+		glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, (GLvoid*)(this->firstIndex * sizeof(GLuint)));
+		glBindVertexArray(0);
+
+		RenderStats::AddDraw(GL_TRIANGLES, this->indexCount);
+
+		unbindMaterial();
+
+		RenderStats::AddVertexArrayBinds(2);
+		RenderStats::AddUniformUploads(materialUniforms);
+	}
+
+	void Mesh::DrawIndirect(gps::Shader shader, const MaterialUniforms& uniforms, GLintptr command)
 	{
 		shader.useShaderProgram();
+		unsigned int materialUniforms = bindMaterial(uniforms);
 
-		//set textures
+		glBindVertexArray(this->buffers.VAO);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)command);
+		glBindVertexArray(0);
+
+		//the instance count is only known on the GPU, counted as one instance
+		RenderStats::AddDraw(GL_TRIANGLES, this->indexCount);
+
+		unbindMaterial();
+
+		RenderStats::AddVertexArrayBinds(2);
+		RenderStats::AddUniformUploads(materialUniforms);
+	}
+
+	unsigned int Mesh::bindMaterial(const MaterialUniforms& uniforms)
+	{
+		//set textures, the shaders have no sampler for the other types
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			if (this->textures[i].type == "diffuseTexture")
+				glUniform1i(uniforms.diffuseTexture, i);
+			else if (this->textures[i].type == "specularTexture")
+				glUniform1i(uniforms.specularTexture, i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		//material colors, for the shader variants without the matching texture
+		unsigned int materialUniforms = 0;
+		if (!hasTexture("diffuseTexture")) {
+			glUniform3fv(uniforms.materialDiffuse, 1, &this->material.diffuse[0]);
+			materialUniforms++;
+		}
+		if (!hasTexture("specularTexture")) {
+			glUniform3fv(uniforms.materialSpecular, 1, &this->material.specular[0]);
+			materialUniforms++;
+		}
 
+		RenderStats::AddTextureBinds((unsigned int)this->textures.size());
+		return (unsigned int)this->textures.size() + materialUniforms;
+	}
+
+	void Mesh::unbindMaterial()
+	{
         for(GLuint i = 0; i < this->textures.size(); i++)
         {
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
 
+		RenderStats::AddTextureBinds((unsigned int)this->textures.size());
     }
 
+	/* Depth-only drawing function - uses the tightly packed position stream */
+	void Mesh::DrawDepth(gps::Shader shader)
+	{
+		shader.useShaderProgram();
+
+		glBindVertexArray(this->buffers.depthVAO);
+		glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, (GLvoid*)(this->firstIndex * sizeof(GLuint)));
+		glBindVertexArray(0);
+
+		RenderStats::AddVertexArrayBinds(2);
+		RenderStats::AddDraw(GL_TRIANGLES, this->indexCount);
+	}
+
+	void Mesh::DrawDepthIndirect(gps::Shader shader, GLintptr command)
+	{
+		shader.useShaderProgram();
+
+		glBindVertexArray(this->buffers.depthVAO);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)command);
+		glBindVertexArray(0);
+
+		RenderStats::AddVertexArrayBinds(2);
+		RenderStats::AddDraw(GL_TRIANGLES, this->indexCount);
+	}
+
+	bool Mesh::hasTexture(const std::string& type)
+	{
+		for (size_t i = 0; i < this->textures.size(); i++)
+			if (this->textures[i].type == type)
+				return true;
+		return false;
+	}
+
+	bool Mesh::isAlphaTested()
+	{
+		for (size_t i = 0; i < this->textures.size(); i++)
+			if (this->textures[i].type == "diffuseTexture" && this->textures[i].hasAlpha)
+				return true;
+		return false;
+	}
+
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh(){
+		this->buffers = CreateBuffers(this->vertices, this->indices, this->tangents);
+	}
+
+	Buffers Mesh::CreateBuffers(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		const std::vector<glm::vec4>& tangents){
+		Buffers buffers;
 		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		glGenVertexArrays(1, &buffers.VAO);
+		glGenBuffers(1, &buffers.VBO);
+		glGenBuffers(1, &buffers.EBO);
 
-		glBindVertexArray(this->buffers.VAO);
+		glBindVertexArray(buffers.VAO);
 		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
 
 		// Set the vertex attribute pointers
 		// Vertex Positions
@@ -65,7 +201,45 @@ namespace gps {
 		// Vertex Texture Coords
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		// Vertex Tangents, in their own buffer so meshes without them keep the smaller vertex
+		buffers.tangentVBO = 0;
+		if (!tangents.empty()) {
+			glGenBuffers(1, &buffers.tangentVBO);
+			glBindBuffer(GL_ARRAY_BUFFER, buffers.tangentVBO);
+			glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec4), tangents.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (GLvoid*)0);
+		}
 
 		glBindVertexArray(0);
+
+		// Position-only stream for the depth passes, sharing the element buffer
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			positions[i] = vertices[i].Position;
+
+		glGenVertexArrays(1, &buffers.depthVAO);
+		glGenBuffers(1, &buffers.positionVBO);
+
+		glBindVertexArray(buffers.depthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+
+		glBindVertexArray(0);
+		return buffers;
+	}
+
+	void Mesh::DeleteBuffers(Buffers& buffers){
+		glDeleteBuffers(1, &buffers.VBO);
+		glDeleteBuffers(1, &buffers.EBO);
+		glDeleteVertexArrays(1, &buffers.VAO);
+		glDeleteBuffers(1, &buffers.positionVBO);
+		glDeleteVertexArrays(1, &buffers.depthVAO);
+		glDeleteBuffers(1, &buffers.tangentVBO);
+		buffers = Buffers();
 	}
 }
@@ -25,6 +25,8 @@ struct Texture
     //ambientTexture, diffuseTexture, specularTexture
     std::string type;
     std::string path;
+    //some texel is not fully opaque, the mesh needs alpha testing
+    bool hasAlpha;
 };
 
 struct Material
@@ -34,10 +36,24 @@ struct Material
         glm::vec3 specular;
     };
 
+// Uniform locations of the material of a program, -1 for the ones it does not use; looked up
+// once per program by Mesh::GetMaterialUniforms() instead of on every draw
+struct MaterialUniforms {
+    GLint diffuseTexture;
+    GLint specularTexture;
+    GLint materialDiffuse;
+    GLint materialSpecular;
+};
+
 struct Buffers {
     GLuint VAO;
     GLuint VBO;
     GLuint EBO;
+    // position-only stream used by the depth-only passes
+    GLuint depthVAO;
+    GLuint positionVBO;
+    // attribute 3 of VAO, 0 for meshes without tangents
+    GLuint tangentVBO;
 };
 
 class Mesh
@@ -46,12 +62,45 @@ public:
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
+    //colors used in place of the missing textures
+    Material material;
+    //xyz tangent and w bitangent sign per vertex, empty when the mesh has no texture coordinates
+    std::vector<glm::vec4> tangents;
+    //range of the element buffer drawn, all of it unless the buffers are shared with other submeshes
+    GLuint firstIndex;
+    GLsizei indexCount;
 
 	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material);
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, Material material, std::vector<glm::vec4> tangents);
+	// Submesh drawing a range of buffers made by CreateBuffers(), it does not own them
+	Mesh(Buffers buffers, GLuint firstIndex, GLsizei indexCount, std::vector<Texture> textures, Material material);
+
+	// One vertex and element buffer for all the submeshes of a shape, released with DeleteBuffers()
+	static Buffers CreateBuffers(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		const std::vector<glm::vec4>& tangents);
+	static void DeleteBuffers(Buffers& buffers);
 
 	Buffers getBuffers();
 
+	static MaterialUniforms GetMaterialUniforms(GLuint program);
+
+	// Looks the material uniforms up for this draw, the overload taking them is for the passes
+	// drawing many meshes with the same program
 	void Draw(gps::Shader shader);
+	void Draw(gps::Shader shader, const MaterialUniforms& uniforms);
+
+	// Draws only the positions, without binding any texture
+	void DrawDepth(gps::Shader shader);
+
+	// Same as Draw() and DrawDepth(), with the instance count and first instance read from the
+	// DrawElementsIndirectCommand at the offset of the bound GL_DRAW_INDIRECT_BUFFER
+	void DrawIndirect(gps::Shader shader, const MaterialUniforms& uniforms, GLintptr command);
+	void DrawDepthIndirect(gps::Shader shader, GLintptr command);
+
+	// Material queries used to pick the shader variant of the mesh
+	bool hasTexture(const std::string& type);
+	bool isAlphaTested();
 
 private:
     /*  Render data  */
@@ -60,6 +109,10 @@ private:
 	// Initializes all the buffer objects/arrays
 	void setupMesh();
 
+	// Textures and material colors of Draw(), returns the number of uniforms set
+	unsigned int bindMaterial(const MaterialUniforms& uniforms);
+	void unbindMaterial();
+
 };
 
 }
@@ -0,0 +1,210 @@
+#include "MeshProcessing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_MESH_SSE
+#endif
+
+namespace gps {
+
+    namespace {
+        //four triangles processed together, one per lane, as in TransformSystem
+#ifdef GPS_MESH_SSE
+        typedef __m128 Lane;
+        inline Lane load(const float* p) { return _mm_loadu_ps(p); }
+        inline void store(float* p, Lane v) { _mm_storeu_ps(p, v); }
+        inline Lane sub(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+        inline Lane mul(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+#else
+        struct Lane { float v[4]; };
+        inline Lane load(const float* p) { Lane r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+        inline void store(float* p, Lane a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+        inline Lane sub(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+        inline Lane mul(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+#endif
+
+        const GLuint NO_VERTEX = 0xffffffffu;
+
+        bool positionLess(const glm::vec3& a, const glm::vec3& b)
+        {
+            if (a.x != b.x)
+                return a.x < b.x;
+            if (a.y != b.y)
+                return a.y < b.y;
+            return a.z < b.z;
+        }
+
+        //any unit vector perpendicular to n, +x if n is zero
+        glm::vec3 perpendicular(const glm::vec3& n)
+        {
+            glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::vec3 t = glm::cross(n, axis);
+            float length = glm::length(t);
+            return length > 0.0f ? t / length : glm::vec3(1.0f, 0.0f, 0.0f);
+        }
+    }
+
+    void MeshProcessing::ComputeFaceNormals(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        std::vector<glm::vec3>& faceNormals)
+    {
+        size_t triangleCount = indices.size() / 3;
+        faceNormals.resize(triangleCount);
+
+        size_t t = 0;
+        for (; t + 4 <= triangleCount; t += 4) {
+            //corner, axis, lane
+            float corners[3][3][4];
+            for (int lane = 0; lane < 4; lane++)
+                for (int c = 0; c < 3; c++) {
+                    const glm::vec3& p = vertices[indices[3 * (t + lane) + c]].Position;
+                    corners[c][0][lane] = p.x;
+                    corners[c][1][lane] = p.y;
+                    corners[c][2][lane] = p.z;
+                }
+
+            Lane e1[3], e2[3];
+            for (int axis = 0; axis < 3; axis++) {
+                Lane origin = load(corners[0][axis]);
+                e1[axis] = sub(load(corners[1][axis]), origin);
+                e2[axis] = sub(load(corners[2][axis]), origin);
+            }
+
+            float normal[3][4];
+            store(normal[0], sub(mul(e1[1], e2[2]), mul(e1[2], e2[1])));
+            store(normal[1], sub(mul(e1[2], e2[0]), mul(e1[0], e2[2])));
+            store(normal[2], sub(mul(e1[0], e2[1]), mul(e1[1], e2[0])));
+            for (int lane = 0; lane < 4; lane++)
+                faceNormals[t + lane] = glm::vec3(normal[0][lane], normal[1][lane], normal[2][lane]);
+        }
+
+        for (; t < triangleCount; t++) {
+            const glm::vec3& p0 = vertices[indices[3 * t]].Position;
+            faceNormals[t] = glm::cross(vertices[indices[3 * t + 1]].Position - p0, vertices[indices[3 * t + 2]].Position - p0);
+        }
+    }
+
+    void MeshProcessing::GenerateNormals(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float creaseAngle)
+    {
+        size_t vertexCount = vertices.size();
+        size_t triangleCount = indices.size() / 3;
+
+        std::vector<glm::vec3> faceNormals;
+        ComputeFaceNormals(vertices, indices, faceNormals);
+        std::vector<glm::vec3> faceDirections(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            float length = glm::length(faceNormals[t]);
+            faceDirections[t] = length > 0.0f ? faceNormals[t] / length : glm::vec3(0.0f);
+        }
+
+        //vertices that differ only in their texture coordinates share a position and are smoothed together
+        std::vector<GLuint> order(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            order[i] = (GLuint)i;
+        std::sort(order.begin(), order.end(), [&vertices](GLuint a, GLuint b) {
+            return positionLess(vertices[a].Position, vertices[b].Position);
+        });
+        std::vector<GLuint> positionIds(vertexCount);
+        GLuint positionCount = 0;
+        for (size_t i = 0; i < vertexCount; i++) {
+            if (i > 0 && vertices[order[i]].Position != vertices[order[i - 1]].Position)
+                positionCount++;
+            positionIds[order[i]] = positionCount;
+        }
+        if (vertexCount > 0)
+            positionCount++;
+
+        //triangles around every position, faces[firstFace[p] .. firstFace[p + 1]]
+        std::vector<GLuint> firstFace(positionCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++)
+            firstFace[positionIds[indices[i]] + 1]++;
+        for (GLuint p = 0; p < positionCount; p++)
+            firstFace[p + 1] += firstFace[p];
+        std::vector<GLuint> faces(indices.size());
+        std::vector<GLuint> fill(firstFace.begin(), firstFace.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            faces[fill[positionIds[indices[i]]]++] = (GLuint)(i / 3);
+
+        //every corner sums the faces around its position that are within the crease angle of its own
+        //face; corners of one vertex that end up with different normals get copies of the vertex
+        float cosCrease = std::cos(glm::radians(creaseAngle));
+        std::vector<bool> assigned(vertexCount, false);
+        std::vector<GLuint> nextCopy(vertexCount, NO_VERTEX);
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint vertex = indices[i];
+            GLuint triangle = (GLuint)(i / 3);
+            GLuint position = positionIds[vertex];
+
+            glm::vec3 normal(0.0f);
+            for (GLuint f = firstFace[position]; f < firstFace[position + 1]; f++) {
+                GLuint other = faces[f];
+                if (other == triangle || glm::dot(faceDirections[triangle], faceDirections[other]) >= cosCrease)
+                    normal += faceNormals[other];
+            }
+            float length = glm::length(normal);
+            normal = length > 0.0f ? normal / length : faceDirections[triangle];
+
+            if (!assigned[vertex]) {
+                vertices[vertex].Normal = normal;
+                assigned[vertex] = true;
+                continue;
+            }
+
+            //the sums are taken in the same order, corners of one smoothing group match exactly
+            GLuint copy = vertex;
+            while (copy != NO_VERTEX && vertices[copy].Normal != normal)
+                copy = nextCopy[copy];
+            if (copy == NO_VERTEX) {
+                Vertex split = vertices[vertex];
+                split.Normal = normal;
+                copy = (GLuint)vertices.size();
+                vertices.push_back(split);
+                nextCopy.push_back(nextCopy[vertex]);
+                nextCopy[vertex] = copy;
+            }
+            indices[i] = copy;
+        }
+    }
+
+    std::vector<glm::vec4> MeshProcessing::GenerateTangents(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+    {
+        //per triangle tangent and bitangent solved from the texture coordinate gradients, summed per vertex
+        std::vector<glm::vec3> tangents(vertices.size(), glm::vec3(0.0f));
+        std::vector<glm::vec3> bitangents(vertices.size(), glm::vec3(0.0f));
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            const Vertex& v0 = vertices[indices[i]];
+            const Vertex& v1 = vertices[indices[i + 1]];
+            const Vertex& v2 = vertices[indices[i + 2]];
+            glm::vec3 e1 = v1.Position - v0.Position;
+            glm::vec3 e2 = v2.Position - v0.Position;
+            glm::vec2 d1 = v1.TexCoords - v0.TexCoords;
+            glm::vec2 d2 = v2.TexCoords - v0.TexCoords;
+            float determinant = d1.x * d2.y - d2.x * d1.y;
+            //no texture mapping across this triangle
+            if (std::fabs(determinant) < 1e-12f)
+                continue;
+
+            float r = 1.0f / determinant;
+            glm::vec3 tangent = (e1 * d2.y - e2 * d1.y) * r;
+            glm::vec3 bitangent = (e2 * d1.x - e1 * d2.x) * r;
+            for (int c = 0; c < 3; c++) {
+                tangents[indices[i + c]] += tangent;
+                bitangents[indices[i + c]] += bitangent;
+            }
+        }
+
+        std::vector<glm::vec4> result(vertices.size());
+        for (size_t v = 0; v < vertices.size(); v++) {
+            const glm::vec3& n = vertices[v].Normal;
+            //Gram-Schmidt against the normal
+            glm::vec3 t = tangents[v] - n * glm::dot(n, tangents[v]);
+            float length = glm::length(t);
+            t = length > 1e-12f ? t / length : perpendicular(n);
+            float handedness = glm::dot(glm::cross(n, t), bitangents[v]) < 0.0f ? -1.0f : 1.0f;
+            result[v] = glm::vec4(t, handedness);
+        }
+        return result;
+    }
+}
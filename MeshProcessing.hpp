@@ -0,0 +1,33 @@
+#ifndef MeshProcessing_hpp
+#define MeshProcessing_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //Vertex attributes derived from the geometry, for models exported without them.
+    class MeshProcessing
+    {
+    public:
+        //angle between two faces above which they do not smooth each other
+        static constexpr float DEFAULT_CREASE_ANGLE = 60.0f;
+
+        //replaces the normals with area weighted averages of the faces around each position;
+        //faces meeting at more than creaseAngle degrees keep a hard edge, the vertices on it are split
+        static void GenerateNormals(std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+            float creaseAngle = DEFAULT_CREASE_ANGLE);
+
+        //per vertex tangents for normal mapping: xyz points along +u in the plane of the normal,
+        //w is the sign of the bitangent, cross(normal, tangent) * w points along +v
+        static std::vector<glm::vec4> GenerateTangents(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+
+    private:
+        //unnormalized face normals, their length is twice the area of the triangle
+        static void ComputeFaceNormals(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+            std::vector<glm::vec3>& faceNormals);
+    };
+}
+
+#endif /* MeshProcessing_hpp */
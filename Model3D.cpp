@@ -1,7 +1,17 @@
 #include "Model3D.hpp"
+#include "AssetPack.hpp"
+#include "MeshProcessing.hpp"
+#include "ModelCache.hpp"
+
+#include <algorithm>
+#include <cstring>
 
 namespace gps {
 
+	Model3D::Model3D() {
+		gpuSize = 0;
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
@@ -20,124 +30,275 @@ namespace gps {
 			meshes[i].Draw(shaderProgram);
 	}
 
-	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	// Draw the position-only stream of each mesh
+	void Model3D::DrawDepth(gps::Shader shaderProgram)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawDepth(shaderProgram);
+	}
 
-        std::cout << "Loading : " << fileName << std::endl;
-		tinyobj::attrib_t attrib;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		int materialId;
+	size_t Model3D::getMeshCount()
+	{
+		return meshes.size();
+	}
 
-		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+	gps::Mesh& Model3D::getMesh(size_t index)
+	{
+		return meshes[index];
+	}
 
-		if (!err.empty()) { // `err` may contain warning message.
-			std::cerr << err << std::endl;
+	bool Model3D::LoadShapes(const std::string& fileName, const std::string& basePath,
+		std::vector<gps::ObjShape>& shapes, std::vector<gps::ObjMaterial>& materials){
+
+		gps::AssetPack::View view;
+		if (gps::AssetPack::FindMounted(fileName, view)) {
+			if (gps::ModelCache::Read(view.data, view.size, shapes, materials)) {
+				std::cout << "from the asset pack" << std::endl;
+				return true;
+			}
+			std::cerr << "The asset pack entry of " << fileName << " is not valid" << std::endl;
+		}
+
+		if (gps::ModelCache::Load(fileName, shapes, materials)) {
+			std::cout << "from the model cache" << std::endl;
+			return true;
+		}
+
+		gps::ObjParser parser;
+		bool ret = parser.Parse(fileName, basePath);
+
+		if (!parser.messages.empty()) { // warnings about the lines that were skipped
+			std::cerr << parser.messages;
 		}
 
 		if (!ret) {
-			exit(1);
+			return false;
 		}
 
-		std::cout << "# of shapes    : " << shapes.size() << std::endl;
-		std::cout << "# of materials : " << materials.size() << std::endl;
-
-		// Loop over shapes
-		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
-
-			// Loop over faces(polygon)
-			size_t index_offset = 0;
-			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				int fv = shapes[s].mesh.num_face_vertices[f];
-
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
-
-				// Loop over vertices in the face.
-				for (size_t v = 0; v < fv; v++) {
-					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-					float vx = attrib.vertices[3 * idx.vertex_index + 0];
-					float vy = attrib.vertices[3 * idx.vertex_index + 1];
-					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
-					float tx = 0.0f;
-					float ty = 0.0f;
-					if (idx.texcoord_index != -1) {
-						tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-						ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-					}
-
-					glm::vec3 vertexPosition(vx, vy, vz);
-					glm::vec3 vertexNormal(nx, ny, nz);
-					glm::vec2 vertexTexCoords(tx, ty);
-
-					gps::Vertex currentVertex;
-					currentVertex.Position = vertexPosition;
-					currentVertex.Normal = vertexNormal;
-					currentVertex.TexCoords = vertexTexCoords;
-
-					vertices.push_back(currentVertex);
-
-					indices.push_back(index_offset + v);
-				}
+		// normals for the shapes exported without (all of) them, tangents for the textured ones
+		for (size_t s = 0; s < parser.shapes.size(); s++) {
+			gps::ObjShape& shape = parser.shapes[s];
+			if (!shape.hasNormals) {
+				gps::MeshProcessing::GenerateNormals(shape.vertices, shape.indices);
+				shape.hasNormals = true;
+			}
+			if (shape.hasTexcoords)
+				shape.tangents = gps::MeshProcessing::GenerateTangents(shape.vertices, shape.indices);
+			// stored grouped, so loading from the cache or a pack does not reorder them again
+			SortByMaterial(shape);
+		}
 
-				index_offset += fv;
+		shapes.swap(parser.shapes);
+		materials.swap(parser.materials);
+		gps::ModelCache::Save(fileName, parser.materialLibraries, shapes, materials);
+		return true;
+	}
+
+	bool Model3D::LoadHostData(const std::string& fileName, const std::string& basePath, HostData& data){
+
+		if (!LoadShapes(fileName, basePath, data.shapes, data.materials))
+			return false;
+		data.basePath = basePath;
+
+		data.boundsMin = glm::vec3(0.0f);
+		data.boundsMax = glm::vec3(0.0f);
+		bool first = true;
+		for (size_t s = 0; s < data.shapes.size(); s++)
+			for (size_t v = 0; v < data.shapes[s].vertices.size(); v++) {
+				const glm::vec3& position = data.shapes[s].vertices[v].Position;
+				data.boundsMin = first ? position : glm::min(data.boundsMin, position);
+				data.boundsMax = first ? position : glm::max(data.boundsMax, position);
+				first = false;
 			}
 
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			int a = shapes[s].mesh.material_ids.size();
-			if (a > 0 && materials.size()>0) {
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
-
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
-					if (!ambientTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
-
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
-					if (!diffuseTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
-
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
-					if (!specularTexturePath.empty())
-					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
+		// decoding is most of the cost of a texture, only the upload is left for the GL thread
+		data.textures.clear();
+		for (size_t m = 0; m < data.materials.size(); m++) {
+			const std::string* names[3] = { &data.materials[m].ambientTexture, &data.materials[m].diffuseTexture, &data.materials[m].specularTexture };
+			for (int t = 0; t < 3; t++) {
+				if (names[t]->empty())
+					continue;
+				std::string path = basePath + *names[t];
+				bool decoded = false;
+				for (size_t i = 0; i < data.textures.size() && !decoded; i++)
+					decoded = data.textures[i].path == path;
+				if (decoded)
+					continue;
+				// kept even when decoding fails, so the upload does not try the file again
+				TextureImage image;
+				if (!DecodeTexture(path, image)) {
+					image.path = path;
+					image.width = image.height = 0;
+					image.hasAlpha = false;
 				}
+				data.textures.push_back(std::move(image));
+			}
+		}
+		return true;
+	}
+
+	size_t Model3D::HostData::getSize() const
+	{
+		size_t size = 0;
+		for (size_t s = 0; s < shapes.size(); s++)
+			size += shapes[s].vertices.size() * sizeof(gps::Vertex) + shapes[s].indices.size() * sizeof(GLuint)
+				+ shapes[s].triangleMaterials.size() * sizeof(int) + shapes[s].tangents.size() * sizeof(glm::vec4);
+		for (size_t i = 0; i < textures.size(); i++)
+			size += textures[i].pixels.size();
+		return size;
+	}
+
+	bool Model3D::LoadBounds(const std::string& fileName, glm::vec3& boundsMin, glm::vec3& boundsMax){
+
+		gps::AssetPack::View view;
+		if (gps::AssetPack::FindMounted(fileName, view))
+			return gps::ModelCache::ReadBounds(view.data, view.size, boundsMin, boundsMax);
+		return gps::ModelCache::LoadBounds(fileName, boundsMin, boundsMax);
+	}
+
+	// Does the parsing of the .obj file and fills in the data structure
+	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+
+        std::cout << "Loading : " << fileName << std::endl;
+		HostData data;
+		if (!LoadHostData(fileName, basePath, data)) {
+			exit(1);
+		}
+
+		std::cout << "# of shapes    : " << data.shapes.size() << std::endl;
+		std::cout << "# of materials : " << data.materials.size() << std::endl;
+
+		Upload(data);
+	}
+
+	void Model3D::Upload(HostData& data){
+
+		Unload();
+
+		// Loop over shapes, the parser already built their vertex and index buffers
+		for (size_t s = 0; s < data.shapes.size(); s++) {
+			gps::ObjShape& shape = data.shapes[s];
+
+			// one submesh per material, drawing its range of the buffers shared by the shape
+			std::vector<MaterialRange> ranges = SortByMaterial(shape);
+			gps::Buffers buffers = gps::Mesh::CreateBuffers(shape.vertices, shape.indices, shape.tangents);
+			shapeBuffers.push_back(buffers);
+			// the interleaved vertices, the indices, the depth pass positions and the tangents
+			gpuSize += shape.vertices.size() * (sizeof(gps::Vertex) + sizeof(glm::vec3))
+				+ shape.indices.size() * sizeof(GLuint) + shape.tangents.size() * sizeof(glm::vec4);
+
+			for (size_t r = 0; r < ranges.size(); r++) {
+				std::vector<gps::Texture> textures;
+				gps::Material currentMaterial = LoadMaterial(ranges[r].material, data.materials, data.basePath, data.textures, textures);
+				meshes.push_back(gps::Mesh(buffers, ranges[r].firstIndex, ranges[r].indexCount, textures, currentMaterial));
 			}
+		}
+	}
+
+	void Model3D::Unload(){
+
+        for (size_t i = 0; i < loadedTextures.size(); i++) {
+            glDeleteTextures(1, &loadedTextures.at(i).id);
+        }
+
+        // the meshes only draw ranges of these
+        for (size_t i = 0; i < shapeBuffers.size(); i++) {
+            gps::Mesh::DeleteBuffers(shapeBuffers[i]);
+        }
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+		meshes.clear();
+		shapeBuffers.clear();
+		loadedTextures.clear();
+		gpuSize = 0;
+	}
+
+	size_t Model3D::getGpuSize()
+	{
+		return gpuSize;
+	}
+
+	std::vector<Model3D::MaterialRange> Model3D::SortByMaterial(gps::ObjShape& shape)
+	{
+		// counting sort of the triangles by material, -1 (no usemtl) first; stable, so the
+		// triangles keep their order within a material
+		int materialCount = 0;
+		for (size_t t = 0; t < shape.triangleMaterials.size(); t++)
+			materialCount = std::max(materialCount, shape.triangleMaterials[t] + 1);
+		std::vector<GLuint> firstTriangle(materialCount + 2, 0);
+		for (size_t t = 0; t < shape.triangleMaterials.size(); t++)
+			firstTriangle[shape.triangleMaterials[t] + 2]++;
+		for (int m = 0; m <= materialCount; m++)
+			firstTriangle[m + 1] += firstTriangle[m];
+
+		std::vector<MaterialRange> ranges;
+		for (int m = 0; m <= materialCount; m++) {
+			GLuint count = firstTriangle[m + 1] - firstTriangle[m];
+			if (count > 0) {
+				MaterialRange range = { m - 1, 3 * firstTriangle[m], (GLsizei)(3 * count) };
+				ranges.push_back(range);
+			}
+		}
+		// a single material or triangles that are already grouped need no reordering
+		if (ranges.size() <= 1 || std::is_sorted(shape.triangleMaterials.begin(), shape.triangleMaterials.end()))
+			return ranges;
+
+		std::vector<GLuint> sorted(shape.indices.size());
+		std::vector<int> sortedMaterials(shape.triangleMaterials.size());
+		for (size_t t = 0; t < shape.triangleMaterials.size(); t++) {
+			GLuint target = firstTriangle[shape.triangleMaterials[t] + 1]++;
+			sortedMaterials[target] = shape.triangleMaterials[t];
+			for (int c = 0; c < 3; c++)
+				sorted[3 * target + c] = shape.indices[3 * t + c];
 		}
+		shape.indices.swap(sorted);
+		shape.triangleMaterials.swap(sortedMaterials);
+		return ranges;
+	}
+
+	gps::Material Model3D::LoadMaterial(int materialId, const std::vector<gps::ObjMaterial>& materials,
+		const std::string& basePath, const std::vector<TextureImage>& images, std::vector<gps::Texture>& textures)
+	{
+		// Only try to read materials if the .mtl file is present
+		gps::Material currentMaterial;
+		currentMaterial.ambient = glm::vec3(0.2f);
+		currentMaterial.diffuse = glm::vec3(0.8f);
+		currentMaterial.specular = glm::vec3(0.0f);
+		if (materialId != -1) {
+			const gps::ObjMaterial& material = materials[materialId];
+			currentMaterial.ambient = material.ambient;
+			currentMaterial.diffuse = material.diffuse;
+			currentMaterial.specular = material.specular;
+
+			//ambient texture
+			if (!material.ambientTexture.empty())
+			{
+				gps::Texture currentTexture;
+				currentTexture = LoadTexture(basePath + material.ambientTexture, "ambientTexture", images);
+				textures.push_back(currentTexture);
+			}
+
+			//diffuse texture
+			if (!material.diffuseTexture.empty())
+			{
+				gps::Texture currentTexture;
+				currentTexture = LoadTexture(basePath + material.diffuseTexture, "diffuseTexture", images);
+				textures.push_back(currentTexture);
+			}
+
+			//specular texture
+			if (!material.specularTexture.empty())
+			{
+				gps::Texture currentTexture;
+				currentTexture = LoadTexture(basePath + material.specularTexture, "specularTexture", images);
+				textures.push_back(currentTexture);
+			}
+		}
+
+		return currentMaterial;
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type, const std::vector<TextureImage>& images) {
 
 			for (int i = 0; i < loadedTextures.size(); i++) {
 				if (loadedTextures[i].path == path)
@@ -148,7 +309,18 @@ namespace gps {
 			}
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			bool decoded = false;
+			for (size_t i = 0; i < images.size() && !decoded; i++) {
+				if (images[i].path == path)
+				{
+					// no pixels when the file could not be decoded, it is not read again
+					currentTexture.id = images[i].pixels.empty() ? 0 : UploadTexture(images[i]);
+					currentTexture.hasAlpha = images[i].hasAlpha;
+					decoded = true;
+				}
+			}
+			if (!decoded)
+				currentTexture.id = ReadTextureFromFile(path.c_str(), &currentTexture.hasAlpha);
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -158,14 +330,34 @@ namespace gps {
 		}
 
 	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	GLuint Model3D::ReadTextureFromFile(const char* file_name, bool* hasAlpha) {
+		*hasAlpha = false;
+		TextureImage image;
+		if (!DecodeTexture(file_name, image))
+			return false;
+		*hasAlpha = image.hasAlpha;
+		return UploadTexture(image);
+	}
+
+	bool Model3D::DecodeTexture(const std::string& path, TextureImage& image) {
+		const char* file_name = path.c_str();
 		int x, y, n;
 		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		unsigned char* image_data = gps::AssetPack::LoadImageData(file_name, &x, &y, &n, force_channels);
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
 			return false;
 		}
+
+		// images with an alpha channel that is actually used are alpha tested (foliage, fences)
+		image.hasAlpha = false;
+		if (n == 4) {
+			for (int i = 3; i < x * y * 4; i += 4)
+				if (image_data[i] < 255) {
+					image.hasAlpha = true;
+					break;
+				}
+		}
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
 			fprintf(
@@ -173,37 +365,33 @@ namespace gps {
 			);
 		}
 
+		// copied bottom row first, the order glTexImage2D expects
 		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
+		image.path = path;
+		image.width = x;
+		image.height = y;
+		image.pixels.resize((size_t)width_in_bytes * y);
+		for (int row = 0; row < y; row++)
+			memcpy(&image.pixels[(size_t)row * width_in_bytes], image_data + (size_t)(y - row - 1) * width_in_bytes, width_in_bytes);
+		stbi_image_free(image_data);
+
+		return true;
+	}
 
+	GLuint Model3D::UploadTexture(const TextureImage& image) {
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_2D, textureID);
 		glTexImage2D(
 			GL_TEXTURE_2D,
 			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
+			image.hasAlpha ? GL_SRGB8_ALPHA8 : GL_SRGB, //GL_SRGB,//GL_RGBA,
+			image.width,
+			image.height,
 			0,
 			GL_RGBA,
 			GL_UNSIGNED_BYTE,
-			image_data
+			image.pixels.data()
 		);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -213,21 +401,13 @@ namespace gps {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glBindTexture(GL_TEXTURE_2D, 0);
 
+		// the mip chain adds a third to the base level
+		gpuSize += image.pixels.size() * 4 / 3;
+
 		return textureID;
 	}
 
 	Model3D::~Model3D() {
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
-
-        for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
+		Unload();
 	}
 }
@@ -2,8 +2,8 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "ObjParser.hpp"
 
-#include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
@@ -16,6 +16,27 @@ namespace gps {
     {
 
     public:
+		// Decoded texture, rows already flipped for OpenGL
+		struct TextureImage {
+			std::string path;
+			int width, height;
+			bool hasAlpha;
+			std::vector<unsigned char> pixels;
+		};
+
+		// Everything a model is built from except the GL objects, so it can be loaded on any thread
+		struct HostData {
+			std::string basePath;
+			std::vector<gps::ObjShape> shapes;
+			std::vector<gps::ObjMaterial> materials;
+			std::vector<TextureImage> textures;
+			glm::vec3 boundsMin, boundsMax;
+
+			// Bytes of vertex, index and pixel data held
+			size_t getSize() const;
+		};
+
+        Model3D();
         ~Model3D();
 
 		void LoadModel(std::string fileName);
@@ -24,20 +45,73 @@ namespace gps {
 
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws only the positions of each mesh, for the depth-only passes
+		void DrawDepth(gps::Shader shaderProgram);
+
+		// Component meshes, for drawing them one by one with different shaders
+		size_t getMeshCount();
+		gps::Mesh& getMesh(size_t index);
+
+		// The load pipeline without the upload: the mounted asset pack, then the model cache,
+		// then parsing and processing the .obj file; false if the file could not be read
+		static bool LoadShapes(const std::string& fileName, const std::string& basePath,
+			std::vector<gps::ObjShape>& shapes, std::vector<gps::ObjMaterial>& materials);
+
+		// LoadShapes() plus the bounding box and the decoded textures of the materials
+		static bool LoadHostData(const std::string& fileName, const std::string& basePath, HostData& data);
+
+		// The bounding box of a model without loading it, from the asset pack or the model cache;
+		// false if neither has the model yet
+		static bool LoadBounds(const std::string& fileName, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+		// Creates the buffers and textures of the model; the data is kept and can be uploaded again
+		void Upload(HostData& data);
+
+		// Deletes the buffers and textures, until the next Upload()
+		void Unload();
+
+		// Bytes of buffer and texture memory, mipmaps included
+		size_t getGpuSize();
+
     private:
-		// Component meshes - group of objects
+		// Triangles of a shape using one material, index range in the sorted element buffer
+		struct MaterialRange {
+			int material;
+			GLuint firstIndex;
+			GLsizei indexCount;
+		};
+
+		// Component meshes - group of objects, one per material of each shape
         std::vector<gps::Mesh> meshes;
+		// Vertex and element buffers of each shape, shared by its meshes
+        std::vector<gps::Buffers> shapeBuffers;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Video memory used by the buffers and textures above
+		size_t gpuSize;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
 
-		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		// Groups the triangles of the shape by material, returns the range of each material
+		static std::vector<MaterialRange> SortByMaterial(gps::ObjShape& shape);
+
+		// Colors and textures of an OBJ material, the defaults for -1
+		gps::Material LoadMaterial(int materialId, const std::vector<gps::ObjMaterial>& materials,
+			const std::string& basePath, const std::vector<TextureImage>& images, std::vector<gps::Texture>& textures);
+
+		// Retrieves a texture associated with the object - by its name and type; decoded images
+		// are used when they contain the path, other files are read
+		gps::Texture LoadTexture(std::string path, std::string type, const std::vector<TextureImage>& images);
 
 		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		GLuint ReadTextureFromFile(const char* file_name, bool* hasAlpha);
+
+		// Reads the pixel data from an image file, false if it could not be decoded
+		static bool DecodeTexture(const std::string& path, TextureImage& image);
+
+		// Loads decoded pixel data into the video memory
+		GLuint UploadTexture(const TextureImage& image);
     };
 }
 
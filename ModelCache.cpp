@@ -0,0 +1,321 @@
+#include "ModelCache.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace gps {
+
+    std::string ModelCache::cacheDirectory = "model_cache";
+
+    namespace {
+        const unsigned int MODEL_CACHE_MAGIC = 0x4d535047; // "GPSM"
+
+        struct ModelCacheHeader {
+            unsigned int magic;
+            unsigned int version;
+            unsigned long long sourceSize;
+            long long sourceTime;
+            unsigned long long libraryCount;
+            unsigned long long shapeCount;
+            unsigned long long materialCount;
+            glm::vec3 boundsMin;
+            glm::vec3 boundsMax;
+        };
+
+        //reads the entry in place, every read checks it stays inside the file
+        struct Reader {
+            const char* p;
+            const char* end;
+
+            bool read(void* value, size_t size)
+            {
+                if ((size_t)(end - p) < size)
+                    return false;
+                memcpy(value, p, size);
+                p += size;
+                return true;
+            }
+
+            template <typename T>
+            bool readVector(std::vector<T>& values)
+            {
+                unsigned long long count;
+                if (!read(&count, sizeof(count)) || count > (unsigned long long)(end - p) / sizeof(T))
+                    return false;
+                values.resize((size_t)count);
+                return read(values.data(), (size_t)count * sizeof(T));
+            }
+
+            bool readString(std::string& value)
+            {
+                std::vector<char> characters;
+                if (!readVector(characters))
+                    return false;
+                value.assign(characters.begin(), characters.end());
+                return true;
+            }
+        };
+
+        //the header of a valid entry, false if the data is not one
+        bool readHeader(const char* data, size_t size, ModelCacheHeader& header)
+        {
+            if (size < sizeof(header))
+                return false;
+            memcpy(&header, data, sizeof(header));
+            return header.magic == MODEL_CACHE_MAGIC && header.version == ModelCache::VERSION;
+        }
+
+        //the material libraries after the header, which the reader is left after
+        bool readLibraries(Reader& reader, const ModelCacheHeader& header, std::vector<ModelCache::SourceFile>& libraries)
+        {
+            reader.p += sizeof(header);
+            libraries.resize((size_t)std::min(header.libraryCount, (unsigned long long)(reader.end - reader.p)));
+            for (size_t i = 0; i < libraries.size(); i++)
+                if (!reader.readString(libraries[i].fileName) || !reader.read(&libraries[i].size, sizeof(libraries[i].size))
+                    || !reader.read(&libraries[i].time, sizeof(libraries[i].time)))
+                    return false;
+            return libraries.size() == header.libraryCount;
+        }
+
+        //the meshes are built by indexing with these, a damaged entry must not get that far
+        bool isValidShape(const ObjShape& shape, size_t materialCount)
+        {
+            if (shape.indices.size() % 3 != 0 || shape.triangleMaterials.size() != shape.indices.size() / 3
+                || (!shape.tangents.empty() && shape.tangents.size() != shape.vertices.size()))
+                return false;
+            for (size_t i = 0; i < shape.indices.size(); i++)
+                if (shape.indices[i] >= shape.vertices.size())
+                    return false;
+            for (size_t i = 0; i < shape.triangleMaterials.size(); i++)
+                if (shape.triangleMaterials[i] < -1 || shape.triangleMaterials[i] >= (long long)materialCount)
+                    return false;
+            return true;
+        }
+
+        template <typename T>
+        void writeVector(std::ostream& file, const std::vector<T>& values)
+        {
+            unsigned long long count = values.size();
+            file.write((const char*)&count, sizeof(count));
+            file.write((const char*)values.data(), values.size() * sizeof(T));
+        }
+
+        void writeString(std::ostream& file, const std::string& value)
+        {
+            writeVector(file, std::vector<char>(value.begin(), value.end()));
+        }
+    }
+
+    std::string ModelCache::CacheFile(const std::string& fileName)
+    {
+        //64-bit FNV-1a
+        unsigned long long hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < fileName.size(); i++) {
+            hash ^= (unsigned char)fileName[i];
+            hash *= 1099511628211ULL;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.mesh", hash);
+        return cacheDirectory + "/" + name;
+    }
+
+    bool ModelCache::SourceStamp(const std::string& fileName, unsigned long long& size, long long& time)
+    {
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0)
+            return false;
+        size = (unsigned long long)info.st_size;
+        time = (long long)info.st_mtime;
+        return true;
+    }
+
+    bool ModelCache::IsCurrent(const std::string& fileName, const char* data, size_t size)
+    {
+        unsigned long long sourceSize;
+        long long sourceTime;
+        ModelCacheHeader header;
+        if (!SourceStamp(fileName, sourceSize, sourceTime) || !readHeader(data, size, header)
+            || header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+            return false;
+
+        //an edited library changes the materials without touching the OBJ file
+        Reader reader = { data, data + size };
+        std::vector<SourceFile> libraries;
+        if (!readLibraries(reader, header, libraries))
+            return false;
+        for (size_t i = 0; i < libraries.size(); i++) {
+            unsigned long long librarySize = MISSING_FILE;
+            long long libraryTime = 0;
+            SourceStamp(libraries[i].fileName, librarySize, libraryTime);
+            if (librarySize != libraries[i].size || libraryTime != libraries[i].time)
+                return false;
+        }
+        return true;
+    }
+
+    bool ModelCache::Load(const std::string& fileName, std::vector<ObjShape>& shapes, std::vector<ObjMaterial>& materials)
+    {
+        MappedFile file;
+        if (!file.Open(CacheFile(fileName)) || !IsCurrent(fileName, file.getData(), file.getSize()))
+            return false;
+
+        return Read(file.getData(), file.getSize(), shapes, materials);
+    }
+
+    bool ModelCache::LoadBounds(const std::string& fileName, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        MappedFile file;
+        if (!file.Open(CacheFile(fileName)) || !IsCurrent(fileName, file.getData(), file.getSize()))
+            return false;
+
+        return ReadBounds(file.getData(), file.getSize(), boundsMin, boundsMax);
+    }
+
+    bool ModelCache::ReadBounds(const char* data, size_t size, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        ModelCacheHeader header;
+        if (!readHeader(data, size, header))
+            return false;
+        //NaN fails both comparisons
+        for (int i = 0; i < 3; i++)
+            if (!(header.boundsMin[i] <= header.boundsMax[i]) || !std::isfinite(header.boundsMin[i]) || !std::isfinite(header.boundsMax[i]))
+                return false;
+        boundsMin = header.boundsMin;
+        boundsMax = header.boundsMax;
+        return true;
+    }
+
+    bool ModelCache::Read(const char* data, size_t size, std::vector<ObjShape>& shapes, std::vector<ObjMaterial>& materials)
+    {
+        Reader reader = { data, data + size };
+        ModelCacheHeader header;
+        std::vector<SourceFile> libraries;
+        if (!readHeader(data, size, header) || !readLibraries(reader, header, libraries))
+            return false;
+
+        std::vector<ObjMaterial> cachedMaterials((size_t)std::min(header.materialCount, (unsigned long long)size));
+        for (size_t i = 0; i < cachedMaterials.size(); i++) {
+            ObjMaterial& material = cachedMaterials[i];
+            if (!reader.readString(material.name) || !reader.read(&material.ambient, sizeof(glm::vec3))
+                || !reader.read(&material.diffuse, sizeof(glm::vec3)) || !reader.read(&material.specular, sizeof(glm::vec3))
+                || !reader.readString(material.ambientTexture) || !reader.readString(material.diffuseTexture)
+                || !reader.readString(material.specularTexture))
+                return false;
+        }
+
+        std::vector<ObjShape> cachedShapes((size_t)std::min(header.shapeCount, (unsigned long long)size));
+        for (size_t i = 0; i < cachedShapes.size(); i++) {
+            ObjShape& shape = cachedShapes[i];
+            unsigned char flags[2];
+            if (!reader.readString(shape.name) || !reader.read(flags, sizeof(flags)) || !reader.readVector(shape.vertices)
+                || !reader.readVector(shape.indices) || !reader.readVector(shape.triangleMaterials) || !reader.readVector(shape.tangents))
+                return false;
+            shape.hasNormals = flags[0] != 0;
+            shape.hasTexcoords = flags[1] != 0;
+            if (!isValidShape(shape, cachedMaterials.size()))
+                return false;
+        }
+
+        shapes.swap(cachedShapes);
+        materials.swap(cachedMaterials);
+        return true;
+    }
+
+    void ModelCache::Save(const std::string& fileName, const std::vector<std::string>& materialLibraries,
+        const std::vector<ObjShape>& shapes, const std::vector<ObjMaterial>& materials)
+    {
+        SourceFile source;
+        source.fileName = fileName;
+        if (!SourceStamp(fileName, source.size, source.time))
+            return;
+
+        //a library that could not be read is recorded too, the entry is stale once it appears
+        std::vector<SourceFile> libraries(materialLibraries.size());
+        for (size_t i = 0; i < libraries.size(); i++) {
+            libraries[i].fileName = materialLibraries[i];
+            if (!SourceStamp(libraries[i].fileName, libraries[i].size, libraries[i].time)) {
+                libraries[i].size = MISSING_FILE;
+                libraries[i].time = 0;
+            }
+        }
+
+#ifdef _WIN32
+        _mkdir(cacheDirectory.c_str());
+#else
+        mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+        //write to a temporary file first, so a crash never leaves a truncated entry behind
+        std::string cacheFile = CacheFile(fileName);
+        std::string temporaryFile = cacheFile + ".tmp";
+        std::ofstream file(temporaryFile.c_str(), std::ios::binary);
+        if (!file)
+            return;
+        Write(file, shapes, materials, source, libraries);
+        file.close();
+
+        std::remove(cacheFile.c_str());
+        std::rename(temporaryFile.c_str(), cacheFile.c_str());
+    }
+
+    void ModelCache::Write(std::ostream& file, const std::vector<ObjShape>& shapes, const std::vector<ObjMaterial>& materials,
+        const SourceFile& source, const std::vector<SourceFile>& libraries)
+    {
+        ModelCacheHeader header;
+        header.magic = MODEL_CACHE_MAGIC;
+        header.version = VERSION;
+        header.sourceSize = source.size;
+        header.sourceTime = source.time;
+        header.libraryCount = libraries.size();
+        header.shapeCount = shapes.size();
+        header.materialCount = materials.size();
+        //empty models get an empty box at the origin
+        header.boundsMin = glm::vec3(0.0f);
+        header.boundsMax = glm::vec3(0.0f);
+        bool first = true;
+        for (size_t i = 0; i < shapes.size(); i++)
+            for (size_t v = 0; v < shapes[i].vertices.size(); v++) {
+                const glm::vec3& position = shapes[i].vertices[v].Position;
+                header.boundsMin = first ? position : glm::min(header.boundsMin, position);
+                header.boundsMax = first ? position : glm::max(header.boundsMax, position);
+                first = false;
+            }
+
+        file.write((const char*)&header, sizeof(header));
+        for (size_t i = 0; i < libraries.size(); i++) {
+            writeString(file, libraries[i].fileName);
+            file.write((const char*)&libraries[i].size, sizeof(libraries[i].size));
+            file.write((const char*)&libraries[i].time, sizeof(libraries[i].time));
+        }
+        for (size_t i = 0; i < materials.size(); i++) {
+            const ObjMaterial& material = materials[i];
+            writeString(file, material.name);
+            file.write((const char*)&material.ambient, sizeof(glm::vec3));
+            file.write((const char*)&material.diffuse, sizeof(glm::vec3));
+            file.write((const char*)&material.specular, sizeof(glm::vec3));
+            writeString(file, material.ambientTexture);
+            writeString(file, material.diffuseTexture);
+            writeString(file, material.specularTexture);
+        }
+        for (size_t i = 0; i < shapes.size(); i++) {
+            const ObjShape& shape = shapes[i];
+            unsigned char flags[2] = { (unsigned char)shape.hasNormals, (unsigned char)shape.hasTexcoords };
+            writeString(file, shape.name);
+            file.write((const char*)flags, sizeof(flags));
+            writeVector(file, shape.vertices);
+            writeVector(file, shape.indices);
+            writeVector(file, shape.triangleMaterials);
+            writeVector(file, shape.tangents);
+        }
+    }
+}
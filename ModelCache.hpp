@@ -0,0 +1,60 @@
+#ifndef ModelCache_hpp
+#define ModelCache_hpp
+
+#include "ObjParser.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Binary copy of what the load pipeline made of an OBJ file: the shapes with their generated
+    //normals and tangents, and the materials. Warm starts read it straight from a mapped file
+    //instead of parsing and processing the OBJ again. An entry is ignored once the OBJ file or
+    //one of its material libraries changes size or modification time, or the pipeline changes
+    //VERSION.
+    class ModelCache
+    {
+    public:
+        //a file an entry was made from, as it was when the entry was written
+        struct SourceFile {
+            std::string fileName;
+            //MISSING_FILE when the file could not be read
+            unsigned long long size;
+            long long time;
+        };
+        static const unsigned long long MISSING_FILE = ~0ULL;
+
+        //bumped whenever the load pipeline produces different data
+        static const unsigned int VERSION = 4;
+
+        //one file per OBJ file
+        static std::string cacheDirectory;
+
+        //false if there is no valid entry for the file
+        static bool Load(const std::string& fileName, std::vector<ObjShape>& shapes, std::vector<ObjMaterial>& materials);
+        //materialLibraries as listed by ObjParser, the entry is stale once any of them changes
+        static void Save(const std::string& fileName, const std::vector<std::string>& materialLibraries,
+            const std::vector<ObjShape>& shapes, const std::vector<ObjMaterial>& materials);
+        //only the bounding box of all shapes, from the header; lets a model be culled before it is loaded
+        static bool LoadBounds(const std::string& fileName, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+        //an entry held in memory, as stored in an AssetPack; the source file is not checked
+        static bool Read(const char* data, size_t size, std::vector<ObjShape>& shapes, std::vector<ObjMaterial>& materials);
+        static bool ReadBounds(const char* data, size_t size, glm::vec3& boundsMin, glm::vec3& boundsMax);
+        //source is the OBJ file and libraries its material libraries; a size and time of 0 and no
+        //libraries when there is no source to check, as in an AssetPack
+        static void Write(std::ostream& file, const std::vector<ObjShape>& shapes, const std::vector<ObjMaterial>& materials,
+            const SourceFile& source, const std::vector<SourceFile>& libraries);
+
+    private:
+        static std::string CacheFile(const std::string& fileName);
+        //size and modification time of the file, false if it cannot be read
+        static bool SourceStamp(const std::string& fileName, unsigned long long& size, long long& time);
+        //true if the entry was made from the OBJ file and material libraries as they are now
+        static bool IsCurrent(const std::string& fileName, const char* data, size_t size);
+    };
+}
+
+#endif /* ModelCache_hpp */
@@ -0,0 +1,314 @@
+#include "ModelManager.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
+namespace gps {
+
+    namespace {
+        std::string basePathOf(const std::string& fileName)
+        {
+            return fileName.substr(0, fileName.find_last_of('/')) + "/";
+        }
+
+        size_t fileSizeOf(const std::string& fileName)
+        {
+            std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+            return file ? (size_t)file.tellg() : 0;
+        }
+    }
+
+    ModelManager::ModelManager()
+    {
+        frame = 1;
+        //no limits until setBudgets()
+        gpuBudget = SIZE_MAX;
+        hostBudget = SIZE_MAX;
+        gpuSize = 0;
+        hostSize = 0;
+        hostPending = 0;
+        residencyVersion = 0;
+        synchronous = false;
+        stopping = false;
+    }
+
+    ModelManager::~ModelManager()
+    {
+        StopLoader();
+    }
+
+    void ModelManager::Init()
+    {
+        //a previous Delete() stopped the loader
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = false;
+        }
+        if (!synchronous && !loader.joinable())
+            loader = std::thread(&ModelManager::LoaderThread, this);
+    }
+
+    int ModelManager::Register(const std::string& fileName)
+    {
+        std::map<std::string, int>::iterator found = handles.find(fileName);
+        if (found != handles.end())
+            return found->second;
+
+        Entry entry;
+        entry.fileName = fileName;
+        entry.model.reset(new gps::Model3D());
+        entry.hostSize = 0;
+        entry.loadSize = fileSizeOf(fileName);
+        entry.hostLoaded = false;
+        entry.resident = false;
+        entry.loading = false;
+        entry.failed = false;
+        entry.boundsKnown = gps::Model3D::LoadBounds(fileName, entry.boundsMin, entry.boundsMax);
+        entry.lastVisible = 0;
+        entry.lastUsed = 0;
+        entries.push_back(std::move(entry));
+        handles[fileName] = (int)entries.size() - 1;
+        return (int)entries.size() - 1;
+    }
+
+    const std::string& ModelManager::getFileName(int handle)
+    {
+        return entries[handle].fileName;
+    }
+
+    bool ModelManager::getBounds(int handle, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        const Entry& entry = entries[handle];
+        boundsMin = entry.boundsMin;
+        boundsMax = entry.boundsMax;
+        return entry.boundsKnown;
+    }
+
+    void ModelManager::MarkVisible(int handle)
+    {
+        entries[handle].lastVisible = frame;
+        entries[handle].lastUsed = frame;
+    }
+
+    void ModelManager::Prefetch(int handle)
+    {
+        if (entries[handle].lastUsed != frame)
+            prefetches.push_back(handle);
+        entries[handle].lastUsed = frame;
+    }
+
+    void ModelManager::Update()
+    {
+        std::vector<Load> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(completed);
+        }
+        for (size_t i = 0; i < finished.size(); i++)
+            Finish(finished[i]);
+
+        //request the visible models that are not loaded, then the prefetched ones; the loads
+        //still in flight count against the host budget, or every frame until they finish would
+        //request more
+        for (size_t i = 0; i < entries.size(); i++)
+            if (entries[i].lastVisible == frame)
+                Request((int)i);
+        for (size_t i = 0; i < prefetches.size() && hostSize + hostPending < hostBudget; i++)
+            Request(prefetches[i]);
+        prefetches.clear();
+
+        //uploads are spread over frames, each one stalls the frame it happens in
+        int uploads = 0;
+        for (size_t i = 0; i < entries.size() && (synchronous || uploads < MAX_UPLOADS_PER_FRAME); i++) {
+            Entry& entry = entries[i];
+            if (entry.lastVisible == frame && entry.hostLoaded && !entry.resident) {
+                Upload(entry);
+                uploads++;
+            }
+        }
+
+        Evict();
+        frame++;
+    }
+
+    gps::Model3D* ModelManager::getModel(int handle)
+    {
+        Entry& entry = entries[handle];
+        return entry.resident ? entry.model.get() : NULL;
+    }
+
+    void ModelManager::setSynchronous(bool synchronous)
+    {
+        this->synchronous = synchronous;
+    }
+
+    void ModelManager::setBudgets(size_t gpuBytes, size_t hostBytes)
+    {
+        gpuBudget = gpuBytes;
+        hostBudget = hostBytes;
+    }
+
+    unsigned int ModelManager::getResidencyVersion()
+    {
+        return residencyVersion;
+    }
+
+    int ModelManager::getModelCount()
+    {
+        return (int)entries.size();
+    }
+
+    int ModelManager::getResidentCount()
+    {
+        int count = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+            if (entries[i].resident)
+                count++;
+        return count;
+    }
+
+    size_t ModelManager::getGpuSize()
+    {
+        return gpuSize;
+    }
+
+    size_t ModelManager::getHostSize()
+    {
+        return hostSize;
+    }
+
+    void ModelManager::Delete()
+    {
+        StopLoader();
+        //loads finished after the last Update() belong to the entries removed here
+        completed.clear();
+        for (size_t i = 0; i < entries.size(); i++)
+            entries[i].model->Unload();
+        entries.clear();
+        handles.clear();
+        gpuSize = 0;
+        hostSize = 0;
+        hostPending = 0;
+    }
+
+    void ModelManager::LoaderThread()
+    {
+        for (;;) {
+            Load load;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+                load = std::move(requests.front());
+                requests.pop_front();
+            }
+
+            //parsing or reading the cache, and decoding the textures; nothing here touches GL
+            load.loaded = gps::Model3D::LoadHostData(load.fileName, basePathOf(load.fileName), load.data);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(load));
+        }
+    }
+
+    void ModelManager::StopLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            requests.clear();
+        }
+        wake.notify_all();
+        if (loader.joinable())
+            loader.join();
+    }
+
+    void ModelManager::Request(int handle)
+    {
+        Entry& entry = entries[handle];
+        if (entry.hostLoaded || entry.resident || entry.loading || entry.failed)
+            return;
+
+        Load load;
+        load.handle = handle;
+        load.fileName = entry.fileName;
+        load.loaded = false;
+        if (synchronous) {
+            load.loaded = gps::Model3D::LoadHostData(load.fileName, basePathOf(load.fileName), load.data);
+            Finish(load);
+            return;
+        }
+
+        entry.loading = true;
+        hostPending += entry.loadSize;
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(std::move(load));
+        wake.notify_one();
+    }
+
+    void ModelManager::Finish(Load& load)
+    {
+        Entry& entry = entries[load.handle];
+        if (entry.loading)
+            hostPending -= entry.loadSize;
+        entry.loading = false;
+        if (!load.loaded) {
+            std::cerr << "Could not load the model " << entry.fileName << std::endl;
+            entry.failed = true;
+            return;
+        }
+
+        entry.host = std::move(load.data);
+        entry.hostSize = entry.host.getSize();
+        entry.loadSize = entry.hostSize;
+        entry.hostLoaded = true;
+        hostSize += entry.hostSize;
+        entry.boundsMin = entry.host.boundsMin;
+        entry.boundsMax = entry.host.boundsMax;
+        entry.boundsKnown = true;
+    }
+
+    void ModelManager::Upload(Entry& entry)
+    {
+        entry.model->Upload(entry.host);
+        entry.resident = true;
+        gpuSize += entry.model->getGpuSize();
+        residencyVersion++;
+    }
+
+    void ModelManager::Evict()
+    {
+        //least recently visible first
+        std::vector<int> order(entries.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return entries[a].lastVisible < entries[b].lastVisible; });
+
+        //what is visible this frame stays, even over the budget
+        for (size_t i = 0; i < order.size() && gpuSize > gpuBudget; i++) {
+            Entry& entry = entries[order[i]];
+            if (!entry.resident || entry.lastVisible == frame)
+                continue;
+            gpuSize -= entry.model->getGpuSize();
+            entry.model->Unload();
+            entry.resident = false;
+            residencyVersion++;
+        }
+
+        //the host copy of a resident model is only needed to upload it again. Copies visible or
+        //prefetched this frame stay: a prefetched copy evicted here would be requested again
+        //by the next Prefetch(), loaded and evicted, every frame
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return entries[a].lastUsed < entries[b].lastUsed; });
+        for (size_t i = 0; i < order.size() && hostSize > hostBudget; i++) {
+            Entry& entry = entries[order[i]];
+            if (!entry.hostLoaded || (entry.lastUsed == frame && !entry.resident))
+                continue;
+            hostSize -= entry.hostSize;
+            entry.host = gps::Model3D::HostData();
+            entry.hostSize = 0;
+            entry.hostLoaded = false;
+        }
+    }
+}
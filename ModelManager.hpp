@@ -0,0 +1,123 @@
+#ifndef ModelManager_hpp
+#define ModelManager_hpp
+
+#include "Model3D.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //Owns the models of the scene and keeps only the ones in use loaded. A model is registered
+    //by file name and referred to by the returned handle. The first frame it is marked visible
+    //it is loaded on a background thread, and it is uploaded on a later frame, at most
+    //MAX_UPLOADS_PER_FRAME models per frame. Models that may soon be seen can be prefetched:
+    //their host copy is loaded, after the visible ones, while the host budget has room. Two
+    //budgets bound what stays loaded: the buffers and textures in video memory, and the host
+    //copies kept to upload them again. Over a budget, the models that have not been visible
+    //for the longest time are evicted first.
+    class ModelManager
+    {
+    public:
+        static const int MAX_UPLOADS_PER_FRAME = 1;
+
+        ModelManager();
+        ~ModelManager();
+
+        //starts the loader thread
+        void Init();
+        //returns the handle of the model; the same file always gets the same handle
+        int Register(const std::string& fileName);
+        const std::string& getFileName(int handle);
+        //object space bounding box, false while it is not known: until the model is loaded
+        //once, unless the asset pack or the model cache already has it
+        bool getBounds(int handle, glm::vec3& boundsMin, glm::vec3& boundsMax);
+        //the model is needed this frame, it is loaded if it is not and cannot be evicted
+        void MarkVisible(int handle);
+        //the model may be needed soon, its host copy is loaded if the host budget allows;
+        //requests are made in the order of the calls
+        void Prefetch(int handle);
+        //takes the finished loads, starts the requested ones, uploads and evicts; once per frame
+        void Update();
+        //NULL while the model is not uploaded, valid until the next Update()
+        gps::Model3D* getModel(int handle);
+
+        //loads on the calling thread inside Update(), so every run renders the same frames
+        void setSynchronous(bool synchronous);
+        void setBudgets(size_t gpuBytes, size_t hostBytes);
+        //changes whenever a model is uploaded or evicted, what was built from the meshes is stale
+        unsigned int getResidencyVersion();
+        int getModelCount();
+        int getResidentCount();
+        size_t getGpuSize();
+        size_t getHostSize();
+
+        //stops the loader and deletes the models, while the context is still current
+        void Delete();
+
+    private:
+        struct Entry {
+            std::string fileName;
+            std::unique_ptr<gps::Model3D> model;
+            //host copy of the model, kept while the host budget allows
+            gps::Model3D::HostData host;
+            size_t hostSize;
+            //host size expected from a load: the size of the last one, or of the model file
+            size_t loadSize;
+            bool hostLoaded;
+            bool resident;
+            bool loading;
+            //could not be read, not requested again
+            bool failed;
+            bool boundsKnown;
+            glm::vec3 boundsMin, boundsMax;
+            //frame the model was last marked visible
+            unsigned long long lastVisible;
+            //frame the model was last marked visible or prefetched; its host copy is not
+            //evicted in that frame unless the model is resident
+            unsigned long long lastUsed;
+        };
+
+        //a load handed to the loader thread, and its result
+        struct Load {
+            int handle;
+            std::string fileName;
+            gps::Model3D::HostData data;
+            bool loaded;
+        };
+
+        std::vector<Entry> entries;
+        std::map<std::string, int> handles;
+        //handles prefetched this frame, in the order of the calls
+        std::vector<int> prefetches;
+        unsigned long long frame;
+        size_t gpuBudget, hostBudget;
+        size_t gpuSize, hostSize;
+        //expected host size of the loads requested and not finished
+        size_t hostPending;
+        unsigned int residencyVersion;
+        bool synchronous;
+
+        std::thread loader;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Load> requests;
+        std::vector<Load> completed;
+        bool stopping;
+
+        void LoaderThread();
+        void StopLoader();
+        void Request(int handle);
+        void Finish(Load& load);
+        void Upload(Entry& entry);
+        void Evict();
+    };
+}
+
+#endif /* ModelManager_hpp */
@@ -0,0 +1,507 @@
+#include "ObjParser.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace gps {
+
+    namespace {
+        inline const char* skipSpaces(const char* p, const char* end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            return p;
+        }
+
+        inline const char* nextLine(const char* p, const char* end)
+        {
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            return newline ? newline + 1 : end;
+        }
+
+        inline const char* lineEnd(const char* p, const char* end)
+        {
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            return newline ? newline : end;
+        }
+
+        //true if the line starts with the keyword followed by a space or a tab
+        inline bool isKeyword(const char* p, const char* end, const char* keyword, size_t length)
+        {
+            return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+        }
+
+        inline bool parseFloat(const char*& p, const char* end, float& value)
+        {
+            p = skipSpaces(p, end);
+            //from_chars does not take an explicit plus sign
+            if (p < end && *p == '+')
+                p++;
+            std::from_chars_result result = std::from_chars(p, end, value);
+            if (result.ec != std::errc())
+                return false;
+            p = result.ptr;
+            return true;
+        }
+
+        inline bool parseInt(const char*& p, const char* end, int& value)
+        {
+            if (p < end && *p == '+')
+                p++;
+            std::from_chars_result result = std::from_chars(p, end, value);
+            if (result.ec != std::errc())
+                return false;
+            p = result.ptr;
+            return true;
+        }
+
+        //the rest of the line without the surrounding spaces, for names and file names
+        inline std::string restOfLine(const char* p, const char* last)
+        {
+            p = skipSpaces(p, last);
+            while (last > p && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t'))
+                last--;
+            return std::string(p, last);
+        }
+
+        //OBJ indices start at 1, negative ones count back from the last element read. A chunk
+        //only counts its own elements, so those are kept relative to it and flagged
+        inline int chunkIndex(int index, size_t chunkCount, unsigned char flag, unsigned char& relative)
+        {
+            if (index > 0)
+                return index - 1;
+            if (index < 0) {
+                relative |= flag;
+                return (int)chunkCount + index;
+            }
+            return -1;
+        }
+
+        void addMessage(std::string& messages, const std::string& fileName, int line, const char* text)
+        {
+            messages += fileName + "(" + std::to_string(line) + "): " + text + "\n";
+        }
+
+        double secondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        //runs function(0) .. function(count - 1), one thread each
+        template <typename Function>
+        void runChunks(int count, Function function)
+        {
+            std::vector<std::thread> workers;
+            for (int i = 1; i < count; i++)
+                workers.push_back(std::thread(function, i));
+            function(0);
+            for (size_t i = 0; i < workers.size(); i++)
+                workers[i].join();
+        }
+
+        const unsigned char RELATIVE_POSITION = 1;
+        const unsigned char RELATIVE_TEXCOORD = 2;
+        const unsigned char RELATIVE_NORMAL = 4;
+        //below this a chunk costs more to start than it saves
+        const size_t MIN_CHUNK_SIZE = 1 << 20;
+    }
+
+    //what a chunk of the file reads, in file order
+    struct ObjParser::Chunk
+    {
+        struct Face {
+            size_t firstCorner;
+            size_t cornerCount;
+            int line;
+        };
+        //lines that change the state the following faces are built with
+        struct Statement {
+            enum Kind { USE_MATERIAL, GROUP, MATERIAL_LIBRARY } kind;
+            //number of faces of the chunk read before it
+            size_t face;
+            int line;
+            std::string text;
+        };
+        struct Message {
+            int line;
+            const char* text;
+        };
+
+        const char* begin;
+        const char* end;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texcoords;
+        std::vector<glm::vec3> normals;
+        std::vector<CornerKey> corners;
+        //RELATIVE_* flags of every corner
+        std::vector<unsigned char> relative;
+        std::vector<Face> faces;
+        std::vector<Statement> statements;
+        std::vector<Message> messages;
+        int lineCount;
+
+        //elements and lines of the chunks before this one
+        size_t positionBase;
+        size_t texcoordBase;
+        size_t normalBase;
+        int lineBase;
+    };
+
+    bool ObjParser::Parse(const std::string& fileName, const std::string& basePath, int threadCount)
+    {
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            messages += "Cannot open " + fileName + "\n";
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (threadCount <= 0)
+            threadCount = std::max((int)std::thread::hardware_concurrency(), 1);
+        const char* data = file.getData();
+        size_t size = file.getSize();
+        int chunkCount = (int)std::max(std::min((size_t)threadCount, size / MIN_CHUNK_SIZE), (size_t)1);
+
+        std::vector<Chunk> chunks(chunkCount);
+        const char* chunkBegin = data;
+        for (int i = 0; i < chunkCount; i++) {
+            const char* chunkEnd = data + size;
+            if (i < chunkCount - 1) {
+                //no line is split between two chunks
+                chunkEnd = std::max(chunkBegin, data + size / chunkCount * (i + 1));
+                if (chunkEnd > data && chunkEnd[-1] != '\n')
+                    chunkEnd = nextLine(chunkEnd, data + size);
+            }
+            chunks[i].begin = chunkBegin;
+            chunks[i].end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
+
+        runChunks(chunkCount, [&chunks](int i) { ScanChunk(chunks[i]); });
+        stats.chunks = chunkCount;
+        stats.scanSeconds = secondsSince(start);
+
+        //prefix sums of the chunk counts
+        start = std::chrono::steady_clock::now();
+        size_t positionCount = 0, texcoordCount = 0, normalCount = 0;
+        int lineCount = 0;
+        for (int i = 0; i < chunkCount; i++) {
+            chunks[i].positionBase = positionCount;
+            chunks[i].texcoordBase = texcoordCount;
+            chunks[i].normalBase = normalCount;
+            chunks[i].lineBase = lineCount;
+            positionCount += chunks[i].positions.size();
+            texcoordCount += chunks[i].texcoords.size();
+            normalCount += chunks[i].normals.size();
+            lineCount += chunks[i].lineCount;
+        }
+        positions.resize(positionCount);
+        texcoords.resize(texcoordCount);
+        normals.resize(normalCount);
+        runChunks(chunkCount, [this, &chunks](int i) { ResolveChunk(chunks[i]); });
+        stats.resolveSeconds = secondsSince(start);
+
+        //the vertices are shared within a shape and shapes span chunks, this part stays serial
+        start = std::chrono::steady_clock::now();
+        StartShape("");
+        int material = -1;
+        for (int i = 0; i < chunkCount; i++) {
+            MergeChunk(chunks[i], fileName, basePath, material);
+            chunks[i] = Chunk();
+        }
+
+        //groups that only held vertices or nothing at all
+        for (size_t i = shapes.size(); i-- > 0;)
+            if (shapes[i].indices.empty())
+                shapes.erase(shapes.begin() + i);
+
+        //the shared arrays are only needed while parsing
+        positions = std::vector<glm::vec3>();
+        texcoords = std::vector<glm::vec2>();
+        normals = std::vector<glm::vec3>();
+        shapeCorners = std::vector<CornerSlot>();
+        stats.mergeSeconds = secondsSince(start);
+        return true;
+    }
+
+    void ObjParser::ScanChunk(Chunk& chunk)
+    {
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+        int lineNumber = 0;
+        while (p < end) {
+            lineNumber++;
+            const char* line = skipSpaces(p, end);
+            const char* next = nextLine(line, end);
+            const char* last = lineEnd(line, end);
+
+            if (isKeyword(line, last, "v", 1)) {
+                const char* q = line + 1;
+                glm::vec3 position;
+                if (parseFloat(q, last, position.x) && parseFloat(q, last, position.y) && parseFloat(q, last, position.z))
+                    chunk.positions.push_back(position);
+                else
+                    chunk.messages.push_back({ lineNumber, "invalid vertex position" });
+            }
+            else if (isKeyword(line, last, "vt", 2)) {
+                const char* q = line + 2;
+                glm::vec2 texcoord;
+                if (parseFloat(q, last, texcoord.x)) {
+                    //1D texture coordinates leave out v
+                    if (!parseFloat(q, last, texcoord.y))
+                        texcoord.y = 0.0f;
+                    chunk.texcoords.push_back(texcoord);
+                }
+                else
+                    chunk.messages.push_back({ lineNumber, "invalid texture coordinate" });
+            }
+            else if (isKeyword(line, last, "vn", 2)) {
+                const char* q = line + 2;
+                glm::vec3 normal;
+                if (parseFloat(q, last, normal.x) && parseFloat(q, last, normal.y) && parseFloat(q, last, normal.z))
+                    chunk.normals.push_back(normal);
+                else
+                    chunk.messages.push_back({ lineNumber, "invalid normal" });
+            }
+            else if (isKeyword(line, last, "f", 1)) {
+                //v, v/vt, v//vn or v/vt/vn
+                Chunk::Face face = { chunk.corners.size(), 0, lineNumber };
+                const char* q = skipSpaces(line + 1, last);
+                bool valid = true;
+                while (q < last && *q != '\r' && valid) {
+                    CornerKey corner = { 0, 0, 0 };
+                    valid = parseInt(q, last, corner.position);
+                    if (valid && q < last && *q == '/') {
+                        q++;
+                        //0 would read as a missing element, OBJ indices are never 0
+                        if (q < last && *q != '/')
+                            valid = parseInt(q, last, corner.texcoord) && corner.texcoord != 0;
+                        if (valid && q < last && *q == '/') {
+                            q++;
+                            valid = parseInt(q, last, corner.normal) && corner.normal != 0;
+                        }
+                    }
+                    unsigned char relative = 0;
+                    corner.position = chunkIndex(corner.position, chunk.positions.size(), RELATIVE_POSITION, relative);
+                    corner.texcoord = chunkIndex(corner.texcoord, chunk.texcoords.size(), RELATIVE_TEXCOORD, relative);
+                    corner.normal = chunkIndex(corner.normal, chunk.normals.size(), RELATIVE_NORMAL, relative);
+                    chunk.corners.push_back(corner);
+                    chunk.relative.push_back(relative);
+                    q = skipSpaces(q, last);
+                }
+
+                face.cornerCount = chunk.corners.size() - face.firstCorner;
+                if (valid && face.cornerCount >= 3)
+                    chunk.faces.push_back(face);
+                else {
+                    chunk.corners.resize(face.firstCorner);
+                    chunk.relative.resize(face.firstCorner);
+                    chunk.messages.push_back({ lineNumber, "invalid face" });
+                }
+            }
+            else if (isKeyword(line, last, "usemtl", 6)) {
+                chunk.statements.push_back({ Chunk::Statement::USE_MATERIAL, chunk.faces.size(), lineNumber, restOfLine(line + 6, last) });
+            }
+            else if (isKeyword(line, last, "o", 1) || isKeyword(line, last, "g", 1)) {
+                chunk.statements.push_back({ Chunk::Statement::GROUP, chunk.faces.size(), lineNumber, restOfLine(line + 1, last) });
+            }
+            else if (isKeyword(line, last, "mtllib", 6)) {
+                chunk.statements.push_back({ Chunk::Statement::MATERIAL_LIBRARY, chunk.faces.size(), lineNumber, restOfLine(line + 6, last) });
+            }
+
+            p = next;
+        }
+        chunk.lineCount = lineNumber;
+    }
+
+    void ObjParser::ResolveChunk(Chunk& chunk)
+    {
+        //every chunk writes its own range of the shared arrays
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+        chunk.positions = std::vector<glm::vec3>();
+        chunk.texcoords = std::vector<glm::vec2>();
+        chunk.normals = std::vector<glm::vec3>();
+
+        for (size_t i = 0; i < chunk.corners.size(); i++) {
+            unsigned char relative = chunk.relative[i];
+            if (relative == 0)
+                continue;
+            CornerKey& corner = chunk.corners[i];
+            if (relative & RELATIVE_POSITION)
+                corner.position += (int)chunk.positionBase;
+            if (relative & RELATIVE_TEXCOORD)
+                corner.texcoord += (int)chunk.texcoordBase;
+            if (relative & RELATIVE_NORMAL)
+                corner.normal += (int)chunk.normalBase;
+        }
+    }
+
+    void ObjParser::MergeChunk(Chunk& chunk, const std::string& fileName, const std::string& basePath, int& material)
+    {
+        for (size_t i = 0; i < chunk.messages.size(); i++)
+            addMessage(messages, fileName, chunk.lineBase + chunk.messages[i].line, chunk.messages[i].text);
+
+        size_t statement = 0;
+        for (size_t f = 0; f <= chunk.faces.size(); f++) {
+            for (; statement < chunk.statements.size() && chunk.statements[statement].face == f; statement++) {
+                const Chunk::Statement& current = chunk.statements[statement];
+                if (current.kind == Chunk::Statement::USE_MATERIAL) {
+                    std::unordered_map<std::string, int>::iterator found = materialIds.find(current.text);
+                    material = found != materialIds.end() ? found->second : -1;
+                    if (found == materialIds.end())
+                        addMessage(messages, fileName, chunk.lineBase + current.line, "unknown material");
+                }
+                else if (current.kind == Chunk::Statement::GROUP)
+                    StartShape(current.text);
+                else
+                    ParseMaterialLibrary(basePath + current.text);
+            }
+            if (f == chunk.faces.size())
+                break;
+
+            const Chunk::Face& face = chunk.faces[f];
+            if (!AddFace(&chunk.corners[face.firstCorner], &chunk.relative[face.firstCorner], face.cornerCount, material))
+                addMessage(messages, fileName, chunk.lineBase + face.line, "face index out of range");
+        }
+    }
+
+    void ObjParser::StartShape(const std::string& name)
+    {
+        //consecutive o and g lines name the same group
+        if (!shapes.empty() && shapes.back().indices.empty()) {
+            shapes.back().name = name;
+            return;
+        }
+
+        ObjShape shape;
+        shape.name = name;
+        shape.hasNormals = true;
+        shape.hasTexcoords = true;
+        shapes.push_back(shape);
+        shapeCorners.clear();
+        shapeCornerCount = 0;
+    }
+
+    ObjParser::CornerSlot& ObjParser::FindCorner(const CornerKey& corner)
+    {
+        size_t mask = shapeCorners.size() - 1;
+        size_t hash = ((size_t)corner.position * 73856093u) ^ ((size_t)corner.texcoord * 19349663u) ^ ((size_t)corner.normal * 83492791u);
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+            if (shapeCorners[i].vertex == EMPTY_SLOT || shapeCorners[i].key == corner)
+                return shapeCorners[i];
+    }
+
+    void ObjParser::GrowCornerTable()
+    {
+        std::vector<CornerSlot> old;
+        old.swap(shapeCorners);
+        shapeCorners.assign(old.empty() ? 1024 : old.size() * 2, CornerSlot{ { 0, 0, 0 }, EMPTY_SLOT });
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].vertex != EMPTY_SLOT)
+                FindCorner(old[i].key) = old[i];
+    }
+
+    bool ObjParser::AddFace(const CornerKey* corners, const unsigned char* relative, size_t count, int material)
+    {
+        //a negative texcoord or normal is a missing one, unless it was a relative index counting
+        //back past the first element
+        for (size_t i = 0; i < count; i++)
+            if (corners[i].position < 0 || corners[i].position >= (int)positions.size()
+                || corners[i].texcoord >= (int)texcoords.size() || corners[i].normal >= (int)normals.size()
+                || ((relative[i] & RELATIVE_TEXCOORD) && corners[i].texcoord < 0)
+                || ((relative[i] & RELATIVE_NORMAL) && corners[i].normal < 0))
+                return false;
+
+        ObjShape& shape = shapes.back();
+        GLuint cornerVertices[3];
+        for (size_t i = 2; i < count; i++) {
+            //fan around the first corner
+            const CornerKey* triangle[3] = { &corners[0], &corners[i - 1], &corners[i] };
+            for (int c = 0; c < 3; c++) {
+                const CornerKey& corner = *triangle[c];
+                if (2 * (shapeCornerCount + 1) > shapeCorners.size())
+                    GrowCornerTable();
+                CornerSlot& slot = FindCorner(corner);
+                if (slot.vertex == EMPTY_SLOT) {
+                    slot.key = corner;
+                    slot.vertex = (GLuint)shape.vertices.size();
+                    shapeCornerCount++;
+                    Vertex vertex;
+                    vertex.Position = positions[corner.position];
+                    vertex.Normal = corner.normal >= 0 ? normals[corner.normal] : glm::vec3(0.0f);
+                    vertex.TexCoords = corner.texcoord >= 0 ? texcoords[corner.texcoord] : glm::vec2(0.0f);
+                    shape.vertices.push_back(vertex);
+                    if (corner.normal < 0)
+                        shape.hasNormals = false;
+                    if (corner.texcoord < 0)
+                        shape.hasTexcoords = false;
+                }
+                cornerVertices[c] = slot.vertex;
+            }
+            shape.indices.insert(shape.indices.end(), cornerVertices, cornerVertices + 3);
+            shape.triangleMaterials.push_back(material);
+        }
+        return true;
+    }
+
+    void ObjParser::ParseMaterialLibrary(const std::string& fileName)
+    {
+        materialLibraries.push_back(fileName);
+        MappedFile file;
+        if (!file.Open(fileName)) {
+            messages += "Cannot open material library " + fileName + "\n";
+            return;
+        }
+
+        const char* p = file.getData();
+        const char* end = p + file.getSize();
+        ObjMaterial* material = NULL;
+        int lineNumber = 0;
+        while (p < end) {
+            lineNumber++;
+            const char* line = skipSpaces(p, end);
+            const char* last = lineEnd(line, end);
+            p = nextLine(line, end);
+
+            if (isKeyword(line, last, "newmtl", 6)) {
+                ObjMaterial newMaterial;
+                newMaterial.name = restOfLine(line + 6, last);
+                newMaterial.ambient = glm::vec3(0.0f);
+                newMaterial.diffuse = glm::vec3(0.0f);
+                newMaterial.specular = glm::vec3(0.0f);
+                materialIds[newMaterial.name] = (int)materials.size();
+                materials.push_back(newMaterial);
+                material = &materials.back();
+                continue;
+            }
+            if (material == NULL)
+                continue;
+
+            glm::vec3* color = NULL;
+            if (isKeyword(line, last, "Ka", 2))
+                color = &material->ambient;
+            else if (isKeyword(line, last, "Kd", 2))
+                color = &material->diffuse;
+            else if (isKeyword(line, last, "Ks", 2))
+                color = &material->specular;
+            else if (isKeyword(line, last, "map_Ka", 6))
+                material->ambientTexture = restOfLine(line + 6, last);
+            else if (isKeyword(line, last, "map_Kd", 6))
+                material->diffuseTexture = restOfLine(line + 6, last);
+            else if (isKeyword(line, last, "map_Ks", 6))
+                material->specularTexture = restOfLine(line + 6, last);
+
+            if (color != NULL) {
+                const char* q = line + 2;
+                if (!parseFloat(q, last, color->x) || !parseFloat(q, last, color->y) || !parseFloat(q, last, color->z))
+                    addMessage(messages, fileName, lineNumber, "invalid color");
+            }
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "Mesh.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    struct ObjMaterial
+    {
+        std::string name;
+        glm::vec3 ambient;
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+        //relative to the base path, empty when the material has none
+        std::string ambientTexture;
+        std::string diffuseTexture;
+        std::string specularTexture;
+    };
+
+    //one o/g group of the file, ready to upload: the vertices are deduplicated by their
+    //position/texcoord/normal triplet and the polygons are triangulated as fans
+    struct ObjShape
+    {
+        std::string name;
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+        //index into ObjParser::materials of every triangle, -1 before any usemtl
+        std::vector<int> triangleMaterials;
+        //false when some face corner had no normal, its Normal is zero
+        bool hasNormals;
+        //false when some face corner had no texture coordinate, its TexCoords are zero
+        bool hasTexcoords;
+        //filled by the load pipeline for meshes with texture coordinates, see MeshProcessing
+        std::vector<glm::vec4> tangents;
+    };
+
+    //Reads OBJ files and their MTL libraries straight from a memory mapped file with a pointer
+    //scanner: no per-line strings, numbers parsed with std::from_chars, and the face corners
+    //resolved into the final mesh buffers as they are read.
+    //Large files are split into line aligned chunks scanned on their own threads. A chunk
+    //cannot resolve negative indices, it does not know how many elements came before it, so
+    //they are fixed up from the prefix sums of the chunk counts before the faces are merged.
+    class ObjParser
+    {
+    public:
+        std::vector<ObjShape> shapes;
+        std::vector<ObjMaterial> materials;
+        //every mtllib the file asked for, with the base path, also the ones that could not be read
+        std::vector<std::string> materialLibraries;
+        //warnings and errors, one per line
+        std::string messages;
+
+        //how the last Parse() spent its time
+        struct Stats {
+            int chunks;
+            //scanning the chunks, in parallel
+            double scanSeconds;
+            //fixing up the indices and gathering the elements, in parallel
+            double resolveSeconds;
+            //building the shapes in file order
+            double mergeSeconds;
+        };
+        Stats stats;
+
+        //material libraries are looked up in basePath; false if the file could not be read.
+        //threadCount 0 uses every core, files below a megabyte per thread use fewer threads
+        bool Parse(const std::string& fileName, const std::string& basePath, int threadCount = 0);
+
+    private:
+        struct Chunk;
+
+        struct CornerKey {
+            int position;
+            int texcoord;
+            int normal;
+            bool operator==(const CornerKey& other) const
+            {
+                return position == other.position && texcoord == other.texcoord && normal == other.normal;
+            }
+        };
+        struct CornerSlot {
+            CornerKey key;
+            //EMPTY_SLOT while unused
+            GLuint vertex;
+        };
+        static const GLuint EMPTY_SLOT = 0xffffffffu;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texcoords;
+        std::vector<glm::vec3> normals;
+        std::unordered_map<std::string, int> materialIds;
+        //vertex of the current shape for every corner seen in it, an open addressing table
+        //with linear probing kept at most half full: no allocation per corner like a node map
+        std::vector<CornerSlot> shapeCorners;
+        size_t shapeCornerCount = 0;
+
+        static void ScanChunk(Chunk& chunk);
+        //copies the elements of the chunk into the shared arrays and makes its indices absolute
+        void ResolveChunk(Chunk& chunk);
+        void MergeChunk(Chunk& chunk, const std::string& fileName, const std::string& basePath, int& material);
+
+        void ParseMaterialLibrary(const std::string& fileName);
+        //appends the triangles of a polygon with absolute indices to the current shape;
+        //false if a corner refers to an element that does not exist; relative holds the RELATIVE_*
+        //flags of the corners
+        bool AddFace(const CornerKey* corners, const unsigned char* relative, size_t count, int material);
+        void StartShape(const std::string& name);
+        //the slot of the corner in the table, EMPTY_SLOT if it was not seen yet
+        CornerSlot& FindCorner(const CornerKey& corner);
+        void GrowCornerTable();
+    };
+}
+
+#endif /* ObjParser_hpp */
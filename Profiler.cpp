@@ -0,0 +1,212 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    void Profiler::Init()
+    {
+        startTime = std::chrono::steady_clock::now();
+        glGenQueries(FRAMES_IN_FLIGHT * MAX_GPU_SCOPES, &queries[0][0]);
+        frame = 0;
+        lastReport = 0.0;
+    }
+
+    void Profiler::Delete()
+    {
+        glDeleteQueries(FRAMES_IN_FLIGHT * MAX_GPU_SCOPES, &queries[0][0]);
+    }
+
+    double Profiler::now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    void Profiler::BeginFrame()
+    {
+        //the set of this slot was filled FRAMES_IN_FLIGHT frames ago
+        CollectQueries(frame % FRAMES_IN_FLIGHT);
+    }
+
+    void Profiler::EndFrame()
+    {
+        frame++;
+        reportFrames++;
+    }
+
+    void Profiler::CollectQueries(int slot)
+    {
+        for (size_t i = 0; i < pending[slot].size(); i++) {
+            //asking for the result before it is available would wait for the GPU
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(pending[slot][i].query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                droppedGpuSamples++;
+                continue;
+            }
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(pending[slot][i].query, GL_QUERY_RESULT, &elapsed);
+            AddSample(pending[slot][i].name, true, pending[slot][i].cpuStart, elapsed / 1e9);
+        }
+        pending[slot].clear();
+    }
+
+    void Profiler::BeginGpuScope(const char* name)
+    {
+        int slot = frame % FRAMES_IN_FLIGHT;
+        if (gpuScopeOpen || pending[slot].size() >= MAX_GPU_SCOPES) {
+            std::cerr << "Profiler: GPU scope " << name << " ignored" << std::endl;
+            ignoredGpuScopes++;
+            return;
+        }
+
+        PendingQuery query;
+        query.name = name;
+        query.query = queries[slot][pending[slot].size()];
+        query.cpuStart = now();
+        glBeginQuery(GL_TIME_ELAPSED, query.query);
+        pending[slot].push_back(query);
+        gpuScopeOpen = true;
+    }
+
+    void Profiler::EndGpuScope()
+    {
+        if (ignoredGpuScopes > 0) {
+            ignoredGpuScopes--;
+            return;
+        }
+        if (!gpuScopeOpen)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        gpuScopeOpen = false;
+    }
+
+    void Profiler::AddCpuSample(const char* name, double start, double end)
+    {
+        AddSample(name, false, start, end - start);
+    }
+
+    Profiler::ScopeStats* Profiler::FindScope(const char* name, bool gpu)
+    {
+        for (size_t i = 0; i < scopes.size(); i++)
+            if (scopes[i].gpu == gpu && strcmp(scopes[i].name, name) == 0)
+                return &scopes[i];
+
+        ScopeStats scope;
+        scope.name = name;
+        scope.gpu = gpu;
+        scope.next = 0;
+        scopes.push_back(scope);
+        return &scopes.back();
+    }
+
+    void Profiler::AddSample(const char* name, bool gpu, double start, double duration)
+    {
+        ScopeStats* scope = FindScope(name, gpu);
+        double milliseconds = duration * 1000.0;
+        if (scope->samples.size() < HISTORY_SIZE)
+            scope->samples.push_back(milliseconds);
+        else
+            scope->samples[scope->next] = milliseconds;
+        scope->next = (scope->next + 1) % HISTORY_SIZE;
+
+        if (tracing && traceEvents.size() < MAX_TRACE_EVENTS) {
+            TraceEvent event = { name, gpu, start, duration };
+            traceEvents.push_back(event);
+        }
+    }
+
+    double Profiler::getPercentile(const char* name, bool gpu, double p)
+    {
+        ScopeStats* scope = FindScope(name, gpu);
+        if (scope->samples.empty())
+            return 0.0;
+
+        //nearest rank
+        std::vector<double> sorted = scope->samples;
+        size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+        rank = std::min(std::max(rank, (size_t)1), sorted.size()) - 1;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+    void Profiler::Report(double interval)
+    {
+        double time = now();
+        if (time - lastReport < interval || scopes.empty())
+            return;
+
+        printf("profiler: %.1f fps, ms over the last %d samples (p50 / p95 / p99)\n",
+            reportFrames / (time - lastReport), HISTORY_SIZE);
+        for (size_t i = 0; i < scopes.size(); i++) {
+            const char* name = scopes[i].name;
+            bool gpu = scopes[i].gpu;
+            printf("  %-4s %-16s %8.3f %8.3f %8.3f\n", gpu ? "gpu" : "cpu", name,
+                getPercentile(name, gpu, 50.0), getPercentile(name, gpu, 95.0), getPercentile(name, gpu, 99.0));
+        }
+        if (droppedGpuSamples > 0)
+            printf("  %d GPU samples were not ready in time and were dropped\n", droppedGpuSamples);
+
+        lastReport = time;
+        reportFrames = 0;
+        droppedGpuSamples = 0;
+    }
+
+    void Profiler::StartTrace()
+    {
+        tracing = true;
+        traceEvents.clear();
+    }
+
+    bool Profiler::WriteChromeTrace(const std::string& fileName)
+    {
+        std::ofstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "Could not write the trace file " << fileName << std::endl;
+            return false;
+        }
+
+        //complete events ("ph": "X") in microseconds, CPU scopes on thread 0 and GPU scopes on thread 1;
+        //GPU scopes start at the time their commands were issued, the duration is the measured one
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+        char line[256];
+        for (size_t i = 0; i < traceEvents.size(); i++) {
+            const TraceEvent& event = traceEvents[i];
+            snprintf(line, sizeof(line),
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, event.gpu ? "gpu" : "cpu", event.gpu ? 1 : 0, event.start * 1e6, event.duration * 1e6);
+            file << line;
+        }
+        file << "\n]}\n";
+
+        std::cout << "Wrote " << traceEvents.size() << " trace events to " << fileName << std::endl;
+        return true;
+    }
+
+    CpuScope::CpuScope(Profiler& profiler, const char* name) : profiler(profiler), name(name)
+    {
+        start = profiler.now();
+    }
+
+    CpuScope::~CpuScope()
+    {
+        profiler.AddCpuSample(name, start, profiler.now());
+    }
+
+    GpuScope::GpuScope(Profiler& profiler, const char* name) : profiler(profiler)
+    {
+        profiler.BeginGpuScope(name);
+    }
+
+    GpuScope::~GpuScope()
+    {
+        profiler.EndGpuScope();
+    }
+}
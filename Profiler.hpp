@@ -0,0 +1,118 @@
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Collects CPU and GPU timings of named scopes. The GPU side uses GL_TIME_ELAPSED queries
+    //kept in one set per frame in flight: the results of a frame are read back when its set is
+    //reused, FRAMES_IN_FLIGHT frames later. A result the driver does not have by then is dropped
+    //instead of waited for, so reading never stalls the pipeline.
+    //Every scope keeps a rolling window of samples for percentiles, and all scopes can be
+    //recorded as a Chrome trace (chrome://tracing, Perfetto) for offline analysis.
+    class Profiler
+    {
+    public:
+        static const int FRAMES_IN_FLIGHT = 3;
+        static const int MAX_GPU_SCOPES = 16;
+        //samples kept per scope for the percentiles
+        static const int HISTORY_SIZE = 256;
+        static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+        void Init();
+        void Delete();
+
+        //frames delimit the GPU query sets, BeginFrame() reads back the set it is about to reuse
+        void BeginFrame();
+        void EndFrame();
+
+        void BeginGpuScope(const char* name);
+        void EndGpuScope();
+        void AddCpuSample(const char* name, double start, double end);
+
+        //seconds since Init()
+        double now();
+
+        //p in [0, 100], over the rolling window, in milliseconds
+        double getPercentile(const char* name, bool gpu, double p);
+        //prints p50/p95/p99 of every scope, at most once per interval
+        void Report(double interval = 2.0);
+
+        void StartTrace();
+        bool WriteChromeTrace(const std::string& fileName);
+
+    private:
+        struct ScopeStats {
+            const char* name;
+            bool gpu;
+            std::vector<double> samples;
+            int next;
+        };
+
+        struct PendingQuery {
+            const char* name;
+            GLuint query;
+            double cpuStart;
+        };
+
+        struct TraceEvent {
+            const char* name;
+            bool gpu;
+            double start;
+            double duration;
+        };
+
+        std::chrono::steady_clock::time_point startTime;
+        std::vector<ScopeStats> scopes;
+
+        GLuint queries[FRAMES_IN_FLIGHT][MAX_GPU_SCOPES];
+        std::vector<PendingQuery> pending[FRAMES_IN_FLIGHT];
+        int frame = 0;
+        bool gpuScopeOpen = false;
+        //scopes that could not get a query, their EndGpuScope() must not end the open one
+        int ignoredGpuScopes = 0;
+
+        bool tracing = false;
+        std::vector<TraceEvent> traceEvents;
+
+        double lastReport = 0.0;
+        int reportFrames = 0;
+        //GPU results that were not ready in time since the last report
+        int droppedGpuSamples = 0;
+
+        ScopeStats* FindScope(const char* name, bool gpu);
+        void AddSample(const char* name, bool gpu, double start, double duration);
+        void CollectQueries(int slot);
+    };
+
+    //times the enclosing block on the CPU
+    class CpuScope
+    {
+    public:
+        CpuScope(Profiler& profiler, const char* name);
+        ~CpuScope();
+
+    private:
+        Profiler& profiler;
+        const char* name;
+        double start;
+    };
+
+    //times the GL commands issued in the enclosing block, GPU scopes cannot be nested
+    class GpuScope
+    {
+    public:
+        GpuScope(Profiler& profiler, const char* name);
+        ~GpuScope();
+
+    private:
+        Profiler& profiler;
+    };
+}
+
+#endif /* Profiler_hpp */
@@ -0,0 +1,73 @@
+#include "RenderStats.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    std::atomic<unsigned int> RenderStats::counters[RenderStats::COUNTER_COUNT];
+    RenderStats::Frame RenderStats::last = { 0, 0, 0, 0, 0, 0 };
+
+    unsigned int RenderStats::Frame::stateChanges() const
+    {
+        return programSwitches + vertexArrayBinds + textureBinds;
+    }
+
+    void RenderStats::Add(Counter counter, unsigned int count)
+    {
+        //only the totals matter, no ordering with other memory is needed
+        counters[counter].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void RenderStats::AddDraw(GLenum mode, GLsizei count)
+    {
+        Add(DRAW_CALLS, 1);
+        if (mode == GL_TRIANGLES)
+            Add(TRIANGLES, count / 3);
+        else if (mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN)
+            Add(TRIANGLES, count > 2 ? count - 2 : 0);
+    }
+
+    void RenderStats::AddProgramSwitch()
+    {
+        Add(PROGRAM_SWITCHES, 1);
+    }
+
+    void RenderStats::AddVertexArrayBinds(unsigned int count)
+    {
+        Add(VERTEX_ARRAY_BINDS, count);
+    }
+
+    void RenderStats::AddTextureBinds(unsigned int count)
+    {
+        Add(TEXTURE_BINDS, count);
+    }
+
+    void RenderStats::AddUniformUploads(unsigned int count)
+    {
+        Add(UNIFORM_UPLOADS, count);
+    }
+
+    void RenderStats::EndFrame()
+    {
+        last.drawCalls = counters[DRAW_CALLS].exchange(0, std::memory_order_relaxed);
+        last.triangles = counters[TRIANGLES].exchange(0, std::memory_order_relaxed);
+        last.programSwitches = counters[PROGRAM_SWITCHES].exchange(0, std::memory_order_relaxed);
+        last.vertexArrayBinds = counters[VERTEX_ARRAY_BINDS].exchange(0, std::memory_order_relaxed);
+        last.textureBinds = counters[TEXTURE_BINDS].exchange(0, std::memory_order_relaxed);
+        last.uniformUploads = counters[UNIFORM_UPLOADS].exchange(0, std::memory_order_relaxed);
+    }
+
+    RenderStats::Frame RenderStats::getLastFrame()
+    {
+        return last;
+    }
+
+    std::string RenderStats::FormatFrame(const Frame& frame)
+    {
+        char text[256];
+        snprintf(text, sizeof(text), "%u draws, %u tris, %u programs, %u VAOs, %u textures, %u uniforms",
+            frame.drawCalls, frame.triangles, frame.programSwitches, frame.vertexArrayBinds,
+            frame.textureBinds, frame.uniformUploads);
+        return text;
+    }
+}
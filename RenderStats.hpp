@@ -0,0 +1,53 @@
+#ifndef RenderStats_hpp
+#define RenderStats_hpp
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <string>
+
+namespace gps {
+
+    //Counts the work submitted to OpenGL during a frame. The drawing code reports into the
+    //current frame through relaxed atomic increments, so it can be called from any thread
+    //without locking; EndFrame() swaps the counters out and publishes them as the last frame.
+    class RenderStats
+    {
+    public:
+        struct Frame {
+            unsigned int drawCalls;
+            unsigned int triangles;
+            unsigned int programSwitches;
+            unsigned int vertexArrayBinds;
+            unsigned int textureBinds;
+            unsigned int uniformUploads;
+
+            //program, vertex array and texture binds
+            unsigned int stateChanges() const;
+        };
+
+        static void AddDraw(GLenum mode, GLsizei count);
+        static void AddProgramSwitch();
+        static void AddVertexArrayBinds(unsigned int count);
+        static void AddTextureBinds(unsigned int count);
+        static void AddUniformUploads(unsigned int count);
+        static void EndFrame();
+
+        static Frame getLastFrame();
+        //one line summary, used by the window title overlay and the log
+        static std::string FormatFrame(const Frame& frame);
+
+    private:
+        enum Counter {
+            DRAW_CALLS, TRIANGLES, PROGRAM_SWITCHES, VERTEX_ARRAY_BINDS, TEXTURE_BINDS, UNIFORM_UPLOADS,
+            COUNTER_COUNT
+        };
+
+        static std::atomic<unsigned int> counters[COUNTER_COUNT];
+        static Frame last;
+
+        static void Add(Counter counter, unsigned int count);
+    };
+}
+
+#endif /* RenderStats_hpp */
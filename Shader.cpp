@@ -1,8 +1,54 @@
 #include "Shader.hpp"
+#include "RenderStats.hpp"
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 namespace gps {
+
+    std::string Shader::programCacheDirectory = "shader_cache";
+    bool Shader::parallelCompile = false;
+
+    namespace {
+        const unsigned int PROGRAM_BINARY_MAGIC = 0x43535047; // "GPSC"
+
+        struct ProgramBinaryHeader {
+            unsigned int magic;
+            GLenum format;
+            GLint length;
+            double compileMilliseconds;
+            //programSourceHash() of the sources the binary was linked from
+            unsigned long long sourceHash;
+        };
+
+        //64-bit FNV-1a
+        unsigned long long hashString(const std::string& text)
+        {
+            unsigned long long hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < text.size(); i++) {
+                hash ^= (unsigned char)text[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+    }
+
     std::string Shader::readShaderFile(std::string fileName)
     {
+        //sources in the mounted asset pack take the place of the files
+        AssetPack::View view;
+        if (AssetPack::FindMounted(fileName, view))
+            return std::string(view.data, view.size);
+
         std::ifstream shaderFile;
         std::string shaderString;
 
@@ -22,69 +68,430 @@ namespace gps {
         return shaderString;
     }
 
-    void Shader::shaderCompileLog(GLuint shaderId)
+    std::string Shader::preprocessShaderFile(const std::string& fileName, const std::vector<std::string>& defines, std::vector<std::string>& files, int depth)
+    {
+        AssetPack::View view;
+        if (!AssetPack::FindMounted(fileName, view)) {
+            std::ifstream check(fileName.c_str());
+            if (!check)
+                std::cout << "Could not open shader file " << fileName << std::endl;
+        }
+
+        int fileIndex = (int)files.size();
+        files.push_back(fileName);
+
+        std::string directory;
+        size_t separator = fileName.find_last_of("/\\");
+        if (separator != std::string::npos)
+            directory = fileName.substr(0, separator + 1);
+
+        std::istringstream lines(readShaderFile(fileName));
+        std::ostringstream output;
+        if (depth > 0)
+            output << "#line 1 " << fileIndex << "\n";
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(lines, line)) {
+            lineNumber++;
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+
+            size_t start = line.find_first_not_of(" \t");
+            std::string directive = start == std::string::npos ? std::string() : line.substr(start);
+
+            if (directive.compare(0, 8, "#include") == 0) {
+                size_t open = directive.find('"');
+                size_t close = open == std::string::npos ? open : directive.find('"', open + 1);
+                if (close == std::string::npos || depth >= MAX_INCLUDE_DEPTH) {
+                    std::cout << fileName << "(" << lineNumber << "): invalid or too deeply nested #include" << std::endl;
+                    continue;
+                }
+                std::string includeName = directive.substr(open + 1, close - open - 1);
+                output << preprocessShaderFile(directory + includeName, std::vector<std::string>(), files, depth + 1);
+                output << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+                continue;
+            }
+
+            output << line << "\n";
+            if (depth == 0 && directive.compare(0, 8, "#version") == 0) {
+                for (size_t i = 0; i < defines.size(); i++)
+                    output << "#define " << defines[i] << "\n";
+                output << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+            }
+        }
+
+        return output.str();
+    }
+
+    bool Shader::shaderCompileLog(GLuint shaderId, const std::vector<std::string>& files)
     {
         GLint success;
-        GLchar infoLog[512];
 
         //check compilation info
         glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
         if(!success)
         {
-            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
-            std::cout << "Shader compilation error\n" << infoLog << std::endl;
+            GLint logLength = 0;
+            glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &logLength);
+            std::vector<GLchar> infoLog(std::max(logLength, 1));
+            glGetShaderInfoLog(shaderId, (GLsizei)infoLog.size(), NULL, infoLog.data());
+            std::cout << "Shader compilation error\n" << infoLog.data() << std::endl;
+            //the first number of every message is the index of the file
+            for (size_t i = 0; i < files.size(); i++)
+                std::cout << "  " << i << ": " << files[i] << std::endl;
         }
+        return success != 0;
     }
 
-    void Shader::shaderLinkLog(GLuint shaderProgramId)
+    bool Shader::shaderLinkLog(GLuint shaderProgramId)
     {
         GLint success;
-        GLchar infoLog[512];
 
         //check linking info
         glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-            std::cout << "Shader linking error\n" << infoLog << std::endl;
+            GLint logLength = 0;
+            glGetProgramiv(shaderProgramId, GL_INFO_LOG_LENGTH, &logLength);
+            std::vector<GLchar> infoLog(std::max(logLength, 1));
+            glGetProgramInfoLog(shaderProgramId, (GLsizei)infoLog.size(), NULL, infoLog.data());
+            std::cout << "Shader linking error\n" << infoLog.data() << std::endl;
+        }
+        return success != 0;
+    }
+
+    void Shader::issueCompile(Build& build, const std::string& vertexSource, const std::string& fragmentSource)
+    {
+        //parse and compile the vertex shader
+        const GLchar* vertexShaderString = vertexSource.c_str();
+        build.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(build.vertexShader, 1, &vertexShaderString, NULL);
+        glCompileShader(build.vertexShader);
+
+        //parse and compile the fragment shader
+        const GLchar* fragmentShaderString = fragmentSource.c_str();
+        build.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(build.fragmentShader, 1, &fragmentShaderString, NULL);
+        glCompileShader(build.fragmentShader);
+
+        //attach and link the shader programs; no status is queried here, asking for one
+        //makes the driver finish the compile before returning
+        build.program = glCreateProgram();
+        glAttachShader(build.program, build.vertexShader);
+        glAttachShader(build.program, build.fragmentShader);
+        //ask the driver to keep the binary around for the cache
+        glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(build.program);
+    }
+
+    void Shader::issueComputeCompile(Build& build, const std::string& computeSource)
+    {
+        const GLchar* computeShaderString = computeSource.c_str();
+        build.computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(build.computeShader, 1, &computeShaderString, NULL);
+        glCompileShader(build.computeShader);
+
+        build.program = glCreateProgram();
+        glAttachShader(build.program, build.computeShader);
+        glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(build.program);
+    }
+
+    std::string Shader::programCacheFile()
+    {
+        //one file per program, named by the files and defines it is built from; a rebuild after
+        //an edit replaces the binary instead of adding one
+        std::string key = source->vertexFileName;
+        key += '\0';
+        key += source->fragmentFileName;
+        key += '\0';
+        key += source->computeFileName;
+        for (size_t i = 0; i < source->defines.size(); i++) {
+            key += '\0';
+            key += source->defines[i];
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", hashString(key));
+        return programCacheDirectory + "/" + name;
+    }
+
+    unsigned long long Shader::programSourceHash(const std::string& vertexSource, const std::string& fragmentSource)
+    {
+        //a binary is only valid for the driver that produced it, so the driver strings are hashed
+        //with the preprocessed sources
+        std::string key = vertexSource;
+        key += '\0';
+        key += fragmentSource;
+        GLenum driverStrings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (int i = 0; i < 3; i++) {
+            key += '\0';
+            key += (const char*)glGetString(driverStrings[i]);
+        }
+        return hashString(key);
+    }
+
+    bool Shader::loadProgramBinary(const std::string& cacheFile, unsigned long long sourceHash, GLuint* program)
+    {
+        std::ifstream file(cacheFile.c_str(), std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        std::streamoff fileSize = file.tellg();
+        file.seekg(0);
+
+        ProgramBinaryHeader header;
+        //a binary of older sources is replaced once the program is compiled again
+        if (!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_BINARY_MAGIC
+            || header.sourceHash != sourceHash)
+            return false;
+        //a corrupt or truncated entry is compiled again, its length must fit in the file
+        if (header.length <= 0 || header.length > fileSize - (std::streamoff)sizeof(header))
+            return false;
+
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), header.length))
+            return false;
+
+        GLuint binaryProgram = glCreateProgram();
+        glProgramBinary(binaryProgram, header.format, binary.data(), header.length);
+
+        //the driver rejects binaries it can no longer use (e.g. after an update with the same version string)
+        GLint success;
+        glGetProgramiv(binaryProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(binaryProgram);
+            return false;
+        }
+
+        *program = binaryProgram;
+        this->cachedCompileMilliseconds = header.compileMilliseconds;
+        return true;
+    }
+
+    void Shader::saveProgramBinary(const std::string& cacheFile, unsigned long long sourceHash, GLuint program, double compileMilliseconds)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        ProgramBinaryHeader header;
+        header.magic = PROGRAM_BINARY_MAGIC;
+        header.length = length;
+        header.compileMilliseconds = compileMilliseconds;
+        header.sourceHash = sourceHash;
+        std::vector<char> binary(length);
+        glGetProgramBinary(program, length, NULL, &header.format, binary.data());
+
+#ifdef _WIN32
+        _mkdir(programCacheDirectory.c_str());
+#else
+        mkdir(programCacheDirectory.c_str(), 0755);
+#endif
+
+        //write to a temporary file first, so a crash never leaves a truncated binary behind
+        std::string temporaryFile = cacheFile + ".tmp";
+        std::ofstream file(temporaryFile.c_str(), std::ios::binary);
+        if (!file)
+            return;
+        file.write((const char*)&header, sizeof(header));
+        file.write(binary.data(), length);
+        file.close();
+
+        std::remove(cacheFile.c_str());
+        std::rename(temporaryFile.c_str(), cacheFile.c_str());
+    }
+
+    bool Shader::enableParallelCompile()
+    {
+        //0xFFFFFFFF leaves the number of threads to the driver
+        if (GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        else if (GLEW_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        else
+            return false;
+
+        parallelCompile = true;
+        return true;
+    }
+
+    std::shared_ptr<Shader::Build> Shader::startBuild()
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<Build> build = std::make_shared<Build>();
+
+        //read and preprocess the vertex and fragment shaders, or the compute shader; a compute
+        //source goes into the source hash in place of the vertex source
+        bool compute = !source->computeFileName.empty();
+        std::string v, f;
+        if (compute) {
+            v = preprocessShaderFile(source->computeFileName, source->defines, build->computeFiles, 0);
+            source->dependencies = build->computeFiles;
+        }
+        else {
+            v = preprocessShaderFile(source->vertexFileName, source->defines, build->vertexFiles, 0);
+            f = preprocessShaderFile(source->fragmentFileName, source->defines, build->fragmentFiles, 0);
+
+            source->dependencies = build->vertexFiles;
+            for (size_t i = 0; i < build->fragmentFiles.size(); i++)
+                if (std::find(source->dependencies.begin(), source->dependencies.end(), build->fragmentFiles[i]) == source->dependencies.end())
+                    source->dependencies.push_back(build->fragmentFiles[i]);
+        }
+
+        //drivers without any binary format cannot cache programs
+        GLint binaryFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+        if (binaryFormats > 0) {
+            build->cacheFile = programCacheFile();
+            build->sourceHash = programSourceHash(v, f);
+        }
+
+        build->fromCache = !build->cacheFile.empty() && loadProgramBinary(build->cacheFile, build->sourceHash, &build->program);
+        if (!build->fromCache) {
+            if (compute)
+                issueComputeCompile(*build, v);
+            else
+                issueCompile(*build, v, f);
+        }
+
+        build->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return build;
+    }
+
+    GLuint Shader::finishBuild(Build& build)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        GLuint program = build.program;
+        if (!build.fromCache) {
+            //check compilation status
+            bool compiled;
+            if (build.computeShader != 0) {
+                compiled = shaderCompileLog(build.computeShader, build.computeFiles);
+                glDeleteShader(build.computeShader);
+            }
+            else {
+                compiled = shaderCompileLog(build.vertexShader, build.vertexFiles);
+                compiled = shaderCompileLog(build.fragmentShader, build.fragmentFiles) && compiled;
+                glDeleteShader(build.vertexShader);
+                glDeleteShader(build.fragmentShader);
+            }
+            //check linking info
+            bool linked = compiled && shaderLinkLog(program);
+            if (!linked) {
+                glDeleteProgram(program);
+                program = 0;
+            }
+            this->cachedCompileMilliseconds = 0.0;
         }
+
+        build.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        this->loadedFromCache = build.fromCache;
+        this->loadMilliseconds = build.milliseconds;
+
+        if (!build.fromCache && program != 0 && !build.cacheFile.empty())
+            saveProgramBinary(build.cacheFile, build.sourceHash, program, build.milliseconds);
+        return program;
+    }
+
+    GLuint Shader::buildProgram()
+    {
+        std::shared_ptr<Build> build = startBuild();
+        return finishBuild(*build);
     }
 
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
-
-        //attach and link the shader programs
-        this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
-        glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+        loadShader(vertexShaderFileName, fragmentShaderFileName, std::vector<std::string>());
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines)
+    {
+        loadShaderAsync(vertexShaderFileName, fragmentShaderFileName, defines);
+        finishLoad();
+    }
+
+    void Shader::loadShaderAsync(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines)
+    {
+        source = std::make_shared<Source>();
+        source->vertexFileName = vertexShaderFileName;
+        source->fragmentFileName = fragmentShaderFileName;
+        source->defines = defines;
+
+        this->shaderProgram = 0;
+        pending = startBuild();
+    }
+
+    void Shader::loadComputeShaderAsync(std::string computeShaderFileName, const std::vector<std::string>& defines)
+    {
+        source = std::make_shared<Source>();
+        source->computeFileName = computeShaderFileName;
+        source->defines = defines;
+
+        this->shaderProgram = 0;
+        pending = startBuild();
+    }
+
+    bool Shader::isLoadPending()
+    {
+        return pending != nullptr;
+    }
+
+    bool Shader::isLoadComplete()
+    {
+        if (!pending || pending->fromCache || !parallelCompile)
+            return true;
+
+        GLint complete = GL_FALSE;
+        glGetProgramiv(pending->program, GL_COMPLETION_STATUS_KHR, &complete);
+        return complete == GL_TRUE;
+    }
+
+    bool Shader::finishLoad()
+    {
+        if (pending) {
+            this->shaderProgram = finishBuild(*pending);
+            pending.reset();
+        }
+        return this->shaderProgram != 0;
+    }
+
+    bool Shader::reload()
+    {
+        if (!source)
+            return false;
+
+        GLuint program = buildProgram();
+        if (program == 0) {
+            std::cout << "Keeping the previous program of "
+                << (source->computeFileName.empty() ? source->fragmentFileName : source->computeFileName) << std::endl;
+            return false;
+        }
+
+        //swap only once the new program is complete, draws never see a half built program
+        if (this->shaderProgram != 0)
+            glDeleteProgram(this->shaderProgram);
+        this->shaderProgram = program;
+        return true;
+    }
+
+    bool Shader::dependsOn(const std::string& fileName)
+    {
+        if (!source)
+            return false;
+        return std::find(source->dependencies.begin(), source->dependencies.end(), fileName) != source->dependencies.end();
+    }
+
+    std::vector<std::string> Shader::getDependencies()
+    {
+        return source ? source->dependencies : std::vector<std::string>();
     }
 
     void Shader::useShaderProgram()
     {
         glUseProgram(this->shaderProgram);
+        RenderStats::AddProgramSwitch();
     }
 
 }
@@ -7,7 +7,9 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace gps {
 
@@ -15,13 +17,98 @@ class Shader
 {
 public:
     GLuint shaderProgram;
+    //time spent in loadShader() and whether the program came from the binary cache
+    double loadMilliseconds = 0.0;
+    bool loadedFromCache = false;
+    //compile and link time of the cached program when it was built, 0 if it was built now
+    double cachedCompileMilliseconds = 0.0;
+
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    //each define is "NAME" or "NAME VALUE", injected right after the #version line
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines);
+    //issues the compile and link without waiting for the driver, shaderProgram stays 0 until
+    //finishLoad(); loading many programs this way lets their compiles overlap with each other
+    //and with whatever the caller does in between
+    void loadShaderAsync(std::string vertexShaderFileName, std::string fragmentShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>());
+    //a compute program (GL 4.3 or ARB_compute_shader), loaded like the others
+    void loadComputeShaderAsync(std::string computeShaderFileName,
+        const std::vector<std::string>& defines = std::vector<std::string>());
+    bool isLoadPending();
+    //true once the driver finished the pending build; without parallel compilation the driver
+    //cannot be asked, so it is always true and finishLoad() may block
+    bool isLoadComplete();
+    //waits for the pending build and checks the result, false if it did not compile or link
+    bool finishLoad();
+    //rebuilds the program from its files; the new program replaces the current one only if it
+    //compiled and linked, otherwise the current one stays in use. Uniform state starts over.
+    bool reload();
+    //true if the program was built from the file, directly or through an #include
+    bool dependsOn(const std::string& fileName);
+    std::vector<std::string> getDependencies();
     void useShaderProgram();
 
+    //linked programs are stored here, one file per program (files and defines), holding the
+    //binary of the last sources and driver it was built with
+    static std::string programCacheDirectory;
+
+    //lets the driver compile on its own threads (KHR/ARB_parallel_shader_compile),
+    //false if the driver supports neither
+    static bool enableParallelCompile();
+
 private:
+    //what the program is built from, shared by the copies of the Shader
+    struct Source {
+        std::string vertexFileName;
+        std::string fragmentFileName;
+        //set instead of the two above for a compute program
+        std::string computeFileName;
+        std::vector<std::string> defines;
+        //every file read while preprocessing, includes too
+        std::vector<std::string> dependencies;
+    };
+    std::shared_ptr<Source> source;
+
+    //a build between loadShaderAsync() and finishLoad()
+    struct Build {
+        std::vector<std::string> vertexFiles;
+        std::vector<std::string> fragmentFiles;
+        std::vector<std::string> computeFiles;
+        std::string cacheFile;
+        unsigned long long sourceHash = 0;
+        GLuint vertexShader = 0;
+        GLuint fragmentShader = 0;
+        GLuint computeShader = 0;
+        GLuint program = 0;
+        bool fromCache = false;
+        //time the calling thread spent on the build, waiting for the driver included
+        double milliseconds = 0.0;
+    };
+    std::shared_ptr<Build> pending;
+
+    static bool parallelCompile;
+
+    static const int MAX_INCLUDE_DEPTH = 16;
+
     std::string readShaderFile(std::string fileName);
-    void shaderCompileLog(GLuint shaderId);
-    void shaderLinkLog(GLuint shaderProgramId);
+    //resolves #include "file" relative to the including file and injects the defines;
+    //#line directives number the files in the order of the list, so the info log can be mapped back
+    std::string preprocessShaderFile(const std::string& fileName, const std::vector<std::string>& defines, std::vector<std::string>& files, int depth);
+    bool shaderCompileLog(GLuint shaderId, const std::vector<std::string>& files);
+    bool shaderLinkLog(GLuint shaderProgramId);
+
+    //returns 0 when the program failed to build
+    GLuint buildProgram();
+    //preprocesses the files and either loads the cached binary or issues the compile and link
+    std::shared_ptr<Build> startBuild();
+    //checks the compile and link results, which waits for the driver; returns 0 on failure
+    GLuint finishBuild(Build& build);
+    void issueCompile(Build& build, const std::string& vertexSource, const std::string& fragmentSource);
+    void issueComputeCompile(Build& build, const std::string& computeSource);
+    std::string programCacheFile();
+    unsigned long long programSourceHash(const std::string& vertexSource, const std::string& fragmentSource);
+    bool loadProgramBinary(const std::string& cacheFile, unsigned long long sourceHash, GLuint* program);
+    void saveProgramBinary(const std::string& cacheFile, unsigned long long sourceHash, GLuint program, double compileMilliseconds);
 };
 
 }
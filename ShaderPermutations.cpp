@@ -0,0 +1,82 @@
+#include "ShaderPermutations.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    void ShaderPermutations::Init(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::vector<std::string> featureNames)
+    {
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->featureNames = featureNames;
+    }
+
+    std::string ShaderPermutations::getVariantName(unsigned int features)
+    {
+        std::string name;
+        for (size_t i = 0; i < featureNames.size(); i++)
+            if (features & (1u << i))
+                name += " " + featureNames[i];
+        return name;
+    }
+
+    void ShaderPermutations::Request(unsigned int features)
+    {
+        if (variants.find(features) != variants.end())
+            return;
+
+        std::vector<std::string> defines;
+        for (size_t i = 0; i < featureNames.size(); i++)
+            if (features & (1u << i))
+                defines.push_back(featureNames[i]);
+
+        variants[features].loadShaderAsync(vertexShaderFileName, fragmentShaderFileName, defines);
+    }
+
+    gps::Shader& ShaderPermutations::Get(unsigned int features)
+    {
+        Request(features);
+
+        gps::Shader& shader = variants[features];
+        if (shader.isLoadPending()) {
+            shader.finishLoad();
+            printf("shader variant %s [%s ] %.2f ms%s\n", fragmentShaderFileName.c_str(), getVariantName(features).c_str(),
+                shader.loadMilliseconds, shader.loadedFromCache ? " from cache" : "");
+        }
+        return shader;
+    }
+
+    bool ShaderPermutations::ReloadChanged(const std::string& fileName)
+    {
+        bool reloaded = false;
+        for (std::map<unsigned int, gps::Shader>::iterator variant = variants.begin(); variant != variants.end(); ++variant)
+            if (variant->second.dependsOn(fileName) && variant->second.reload())
+                reloaded = true;
+        return reloaded;
+    }
+
+    std::vector<std::string> ShaderPermutations::getDependencies()
+    {
+        std::vector<std::string> files;
+        for (std::map<unsigned int, gps::Shader>::iterator variant = variants.begin(); variant != variants.end(); ++variant) {
+            std::vector<std::string> variantFiles = variant->second.getDependencies();
+            for (size_t i = 0; i < variantFiles.size(); i++)
+                if (std::find(files.begin(), files.end(), variantFiles[i]) == files.end())
+                    files.push_back(variantFiles[i]);
+        }
+        return files;
+    }
+
+    int ShaderPermutations::getVariantCount()
+    {
+        return (int)variants.size();
+    }
+
+    void ShaderPermutations::Delete()
+    {
+        for (std::map<unsigned int, gps::Shader>::iterator variant = variants.begin(); variant != variants.end(); ++variant)
+            glDeleteProgram(variant->second.shaderProgram);
+        variants.clear();
+    }
+}
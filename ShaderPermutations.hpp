@@ -0,0 +1,41 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include "Shader.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Builds variants of one vertex/fragment pair from a feature bitmask: bit i of the mask
+    //defines featureNames[i] in both stages. Variants are compiled the first time they are
+    //asked for and kept for the rest of the run; across runs they come from the program binary
+    //cache of gps::Shader, which is keyed by the preprocessed source.
+    class ShaderPermutations
+    {
+    public:
+        void Init(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::vector<std::string> featureNames);
+        //starts building the variant without waiting for the driver, so the variants of a
+        //scene can be requested together and compile in parallel
+        void Request(unsigned int features);
+        //the returned reference stays valid until Delete(); waits for a requested variant
+        gps::Shader& Get(unsigned int features);
+        //rebuilds the compiled variants built from the file, true if any of them was replaced
+        bool ReloadChanged(const std::string& fileName);
+        std::vector<std::string> getDependencies();
+        int getVariantCount();
+        void Delete();
+
+    private:
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        std::vector<std::string> featureNames;
+        std::map<unsigned int, gps::Shader> variants;
+
+        std::string getVariantName(unsigned int features);
+    };
+}
+
+#endif /* ShaderPermutations_hpp */
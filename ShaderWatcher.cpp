@@ -0,0 +1,112 @@
+#include "ShaderWatcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace gps {
+
+    namespace {
+        double secondsNow()
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    bool ShaderWatcher::Init(const std::string& directory)
+    {
+        this->directory = directory;
+
+#if defined(__linux__)
+        inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyDescriptor >= 0) {
+            //editors either rewrite the file in place or write a new one and rename it over
+            watchDescriptor = inotify_add_watch(inotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if (watchDescriptor >= 0)
+                return true;
+            close(inotifyDescriptor);
+            inotifyDescriptor = -1;
+        }
+        std::cout << "inotify is not available for " << directory << ", polling the shader files instead" << std::endl;
+#endif
+        return true;
+    }
+
+    void ShaderWatcher::AddFile(const std::string& fileName)
+    {
+        for (size_t i = 0; i < files.size(); i++)
+            if (files[i].fileName == fileName)
+                return;
+
+        WatchedFile file = { fileName, ModificationTime(fileName) };
+        files.push_back(file);
+    }
+
+    time_t ShaderWatcher::ModificationTime(const std::string& fileName)
+    {
+        struct stat status;
+        if (stat(fileName.c_str(), &status) != 0)
+            return 0;
+        return status.st_mtime;
+    }
+
+    std::vector<std::string> ShaderWatcher::Poll()
+    {
+        std::vector<std::string> changed;
+
+#if defined(__linux__)
+        if (inotifyDescriptor >= 0) {
+            alignas(struct inotify_event) char buffer[4096];
+            while (true) {
+                ssize_t length = read(inotifyDescriptor, buffer, sizeof(buffer));
+                if (length <= 0)
+                    break;
+
+                for (char* event = buffer; event < buffer + length; ) {
+                    const struct inotify_event* notification = (const struct inotify_event*)event;
+                    if (notification->len > 0 && !(notification->mask & IN_ISDIR)) {
+                        std::string fileName = directory + "/" + notification->name;
+                        if (std::find(changed.begin(), changed.end(), fileName) == changed.end())
+                            changed.push_back(fileName);
+                    }
+                    event += sizeof(struct inotify_event) + notification->len;
+                }
+            }
+            return changed;
+        }
+#endif
+
+        //the modification times have a resolution of one second, checking more often is pointless
+        double now = secondsNow();
+        if (now - lastPoll < 0.5)
+            return changed;
+        lastPoll = now;
+
+        for (size_t i = 0; i < files.size(); i++) {
+            time_t modificationTime = ModificationTime(files[i].fileName);
+            if (modificationTime != files[i].modificationTime) {
+                files[i].modificationTime = modificationTime;
+                changed.push_back(files[i].fileName);
+            }
+        }
+        return changed;
+    }
+
+    void ShaderWatcher::Delete()
+    {
+#if defined(__linux__)
+        if (inotifyDescriptor >= 0) {
+            inotify_rm_watch(inotifyDescriptor, watchDescriptor);
+            close(inotifyDescriptor);
+            inotifyDescriptor = -1;
+        }
+#endif
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef ShaderWatcher_hpp
+#define ShaderWatcher_hpp
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //Reports the files of a directory that were written since the last Poll(). On Linux the
+    //directory is watched with inotify and Poll() only drains the pending events; elsewhere the
+    //files registered with AddFile() are checked for a newer modification time twice a second.
+    class ShaderWatcher
+    {
+    public:
+        bool Init(const std::string& directory);
+        //only needed by the polling fallback, inotify sees every file of the directory
+        void AddFile(const std::string& fileName);
+        //paths in the "directory/file" form, each file at most once
+        std::vector<std::string> Poll();
+        void Delete();
+
+    private:
+        std::string directory;
+        int inotifyDescriptor = -1;
+        int watchDescriptor = -1;
+
+        struct WatchedFile {
+            std::string fileName;
+            time_t modificationTime;
+        };
+        std::vector<WatchedFile> files;
+        double lastPoll = 0.0;
+
+        static time_t ModificationTime(const std::string& fileName);
+    };
+}
+
+#endif /* ShaderWatcher_hpp */
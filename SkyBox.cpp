@@ -7,12 +7,63 @@
 //
 
 #include "SkyBox.hpp"
+#include "RenderStats.hpp"
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
 
 namespace gps {
     
+    namespace {
+        const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        
+        //KTX 1.1 header, after the identifier
+        struct KTXHeader {
+            GLuint endianness;
+            GLuint glType;
+            GLuint glTypeSize;
+            GLuint glFormat;
+            GLuint glInternalFormat;
+            GLuint glBaseInternalFormat;
+            GLuint pixelWidth;
+            GLuint pixelHeight;
+            GLuint pixelDepth;
+            GLuint numberOfArrayElements;
+            GLuint numberOfFaces;
+            GLuint numberOfMipmapLevels;
+            GLuint bytesOfKeyValueData;
+        };
+        
+        //compressed formats are only accepted when the driver can sample them
+        bool isCompressedFormatSupported(GLenum format)
+        {
+            switch (format) {
+            case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB:
+            case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB:
+            case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+            case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB:
+                return GLEW_ARB_texture_compression_bptc != 0;
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+                return GLEW_EXT_texture_compression_s3tc != 0;
+            default:
+                return false;
+            }
+        }
+    }
+    
     SkyBox::SkyBox()
     {
-        
+        skyboxVAO = 0;
+        cubemapTexture = 0;
+        cubemapSize = 0;
+        environmentTexture = 0;
+        samplerProgram = 0;
     }
     
     void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
@@ -21,121 +72,273 @@ namespace gps {
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    bool SkyBox::LoadKTX(const char* fileName)
+    {
+        cubemapTexture = LoadKTXCubeMap(fileName);
+        if (cubemapTexture == 0)
+            return false;
+        InitSkyBox();
+        return true;
+    }
+    
+    void SkyBox::LoadProcedural()
+    {
+        cubemapTexture = 0;
+        InitSkyBox();
+    }
+    
+    void SkyBox::Draw(gps::Shader shader)
     {
         shader.useShaderProgram();
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        //the view and projection come from the per-frame uniform buffer, only the sampler unit
+        //is set here, and only after the program changed
+        if (shader.shaderProgram != samplerProgram) {
+            glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
+            samplerProgram = shader.shaderProgram;
+            RenderStats::AddUniformUploads(1);
+        }
         
+        //drawn last, on the far plane: only pixels left at the cleared depth pass
         glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
         
         glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (cubemapTexture != 0) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            RenderStats::AddTextureBinds(1);
+        }
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        RenderStats::AddDraw(GL_TRIANGLES, 3);
+        RenderStats::AddVertexArrayBinds(2);
         glBindVertexArray(0);
         
+        glDepthMask(GL_TRUE);
         glDepthFunc(GL_LESS);
     }
     
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
+        struct Face {
+            unsigned char* image;
+            int width, height;
+        };
+        std::vector<Face> faces(skyBoxFaces.size());
         
-        int width,height, n;
-        unsigned char* image;
+        //decoding dominates the load time and the faces do not depend on each other,
+        //stbi_load keeps no shared state so every face gets its own thread; the faces come from
+        //the mounted asset pack when it has them
         int force_channels = 3;
+        std::vector<std::thread> decoders;
+        for (size_t i = 0; i < skyBoxFaces.size(); i++)
+            decoders.push_back(std::thread([&faces, &skyBoxFaces, force_channels, i]() {
+                int n;
+                faces[i].image = AssetPack::LoadImageData(skyBoxFaces[i], &faces[i].width, &faces[i].height, &n, force_channels);
+            }));
+        for (size_t i = 0; i < decoders.size(); i++)
+            decoders[i].join();
         
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
+        bool complete = true;
+        for (size_t i = 0; i < faces.size(); i++)
+            if (!faces[i].image) {
                 fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+                complete = false;
+            }
+        
+        GLuint textureID = 0;
+        if (complete) {
+            glGenTextures(1, &textureID);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (GLuint i = 0; i < faces.size(); i++)
+            {
+                //the faces are sRGB encoded like the model textures, sampling returns linear colors
+                glTexImage2D(
+                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
+                             GL_SRGB8, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].image
+                             );
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            //the prefiltering reads the smaller levels for its wide lobes
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            cubemapSize = faces[0].width;
+            SetCubeMapParameters();
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
         }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        
+        for (size_t i = 0; i < faces.size(); i++)
+            stbi_image_free(faces[i].image);
         
         return textureID;
     }
     
-    void SkyBox::InitSkyBox()
+    GLuint SkyBox::LoadKTXCubeMap(const char* fileName)
     {
-        GLfloat skyboxVertices[] = {
-            -1.0f,  1.0f, -1.0f,
-            -1.0f, -1.0f, -1.0f,
-            1.0f, -1.0f, -1.0f,
-            1.0f, -1.0f, -1.0f,
-            1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-            
-            -1.0f, -1.0f,  1.0f,
-            -1.0f, -1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f,  1.0f,
-            -1.0f, -1.0f,  1.0f,
-            
-            1.0f, -1.0f, -1.0f,
-            1.0f, -1.0f,  1.0f,
-            1.0f,  1.0f,  1.0f,
-            1.0f,  1.0f,  1.0f,
-            1.0f,  1.0f, -1.0f,
-            1.0f, -1.0f, -1.0f,
-            
-            -1.0f, -1.0f,  1.0f,
-            -1.0f,  1.0f,  1.0f,
-            1.0f,  1.0f,  1.0f,
-            1.0f,  1.0f,  1.0f,
-            1.0f, -1.0f,  1.0f,
-            -1.0f, -1.0f,  1.0f,
+        //read in place from the mounted asset pack, or from the file
+        std::vector<char> fileData;
+        AssetPack::View data;
+        if (!AssetPack::FindMounted(fileName, data)) {
+            std::ifstream file(fileName, std::ios::binary);
+            fileData.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            data.data = fileData.data();
+            data.size = fileData.size();
+        }
+        
+        KTXHeader header;
+        if (data.size < sizeof(KTX_IDENTIFIER) + sizeof(header) || memcmp(data.data, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0) {
+            fprintf(stderr, "ERROR: %s is not a KTX file\n", fileName);
+            return 0;
+        }
+        memcpy(&header, data.data + sizeof(KTX_IDENTIFIER), sizeof(header));
+        
+        //files written on a machine of the other endianness would need every field swapped
+        if (header.endianness != 0x04030201 || header.numberOfFaces != 6 || header.numberOfArrayElements != 0 || header.pixelDepth != 0) {
+            fprintf(stderr, "ERROR: %s is not a little endian cube map\n", fileName);
+            return 0;
+        }
+        bool compressed = header.glType == 0;
+        if (compressed && !isCompressedFormatSupported(header.glInternalFormat)) {
+            fprintf(stderr, "ERROR: %s uses a compressed format the driver does not support (0x%x)\n", fileName, header.glInternalFormat);
+            return 0;
+        }
+        
+        size_t offset = sizeof(KTX_IDENTIFIER) + sizeof(header) + header.bytesOfKeyValueData;
+        GLuint levels = std::max(header.numberOfMipmapLevels, 1u);
+        
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        
+        bool complete = true;
+        for (GLuint level = 0; level < levels && complete; level++) {
+            GLsizei width = std::max(header.pixelWidth >> level, 1u);
+            GLsizei height = std::max(header.pixelHeight >> level, 1u);
             
-            -1.0f,  1.0f, -1.0f,
-            1.0f,  1.0f, -1.0f,
-            1.0f,  1.0f,  1.0f,
-            1.0f,  1.0f,  1.0f,
-            -1.0f,  1.0f,  1.0f,
-            -1.0f,  1.0f, -1.0f,
+            GLuint imageSize = 0;
+            if (offset + sizeof(imageSize) <= data.size)
+                memcpy(&imageSize, data.data + offset, sizeof(imageSize));
+            offset += sizeof(imageSize);
             
-            -1.0f, -1.0f, -1.0f,
-            -1.0f, -1.0f,  1.0f,
-            1.0f, -1.0f, -1.0f,
-            1.0f, -1.0f, -1.0f,
-            -1.0f, -1.0f,  1.0f,
-            1.0f, -1.0f,  1.0f
-        };
+            //every face of a level is imageSize bytes, padded to 4 bytes
+            GLuint paddedSize = (imageSize + 3) & ~3u;
+            for (GLuint face = 0; face < 6; face++) {
+                if (imageSize == 0 || offset + imageSize > data.size) {
+                    complete = false;
+                    break;
+                }
+                if (compressed)
+                    glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, header.glInternalFormat,
+                                           width, height, 0, imageSize, data.data + offset);
+                else
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, header.glInternalFormat,
+                                 width, height, 0, header.glFormat, header.glType, data.data + offset);
+                offset += paddedSize;
+            }
+        }
         
-        glGenVertexArrays(1, &(this->skyboxVAO));
-        glGenBuffers(1, &skyboxVBO);
+        if (!complete) {
+            fprintf(stderr, "ERROR: %s is truncated\n", fileName);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            glDeleteTextures(1, &textureID);
+            return 0;
+        }
+        
+        //a single level file gets its chain here; compressed formats cannot be rendered into,
+        //so those sample the levels stored in the file only
+        if (header.numberOfMipmapLevels <= 1 && !compressed)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        else
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        cubemapSize = header.pixelWidth;
+        SetCubeMapParameters();
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        
+        return textureID;
+    }
+    
+    void SkyBox::SetCubeMapParameters()
+    {
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+    
+    void SkyBox::PrefilterEnvironment(gps::Shader shader)
+    {
+        if (cubemapTexture == 0)
+            return;
+        
+        glGenTextures(1, &environmentTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentTexture);
+        for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+            int size = ENVIRONMENT_SIZE >> level;
+            for (GLuint face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA16F, size, size, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, ENVIRONMENT_LEVELS - 1);
+        SetCubeMapParameters();
+        
+        GLint previousFramebuffer;
+        GLint previousViewport[4];
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glDisable(GL_DEPTH_TEST);
         
+        shader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "environment"), 0);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "sourceResolution"), (float)cubemapSize);
+        GLint faceLoc = glGetUniformLocation(shader.shaderProgram, "face");
+        GLint roughnessLoc = glGetUniformLocation(shader.shaderProgram, "roughness");
         glBindVertexArray(skyboxVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        //level i is the environment seen through a GGX lobe of roughness i / (levels - 1),
+        //one fullscreen triangle per face and level
+        for (int level = 0; level < ENVIRONMENT_LEVELS; level++) {
+            int size = ENVIRONMENT_SIZE >> level;
+            glViewport(0, 0, size, size);
+            glUniform1f(roughnessLoc, (float)level / (ENVIRONMENT_LEVELS - 1));
+            for (GLuint face = 0; face < 6; face++) {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, environmentTexture, level);
+                glUniform1i(faceLoc, face);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            }
+        }
         
         glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+    
+    void SkyBox::InitSkyBox()
+    {
+        //the fullscreen triangle is generated from gl_VertexID, but the core profile still
+        //needs a vertex array object bound to draw
+        glGenVertexArrays(1, &(this->skyboxVAO));
+        samplerProgram = 0;
     }
     
     GLuint SkyBox::GetTextureId()
     {
         return cubemapTexture;
     }
+    
+    GLuint SkyBox::GetEnvironmentMapId()
+    {
+        return environmentTexture;
+    }
 }
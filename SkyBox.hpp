@@ -20,15 +20,34 @@ namespace gps {
     class SkyBox
     {
     public:
+        //prefiltered environment map, level i is blurred for roughness i / (ENVIRONMENT_LEVELS - 1)
+        static const int ENVIRONMENT_SIZE = 128;
+        static const int ENVIRONMENT_LEVELS = 8;
+        
         SkyBox();
+        //six images, decoded in parallel
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        //a single KTX 1.1 cube map, compressed (BC6H, BC1) or not, with or without its mip levels
+        bool LoadKTX(const char* fileName);
+        //no cube map, for the PROCEDURAL_SKY variant of the shader
+        void LoadProcedural();
+        //a fullscreen triangle on the far plane, the view rays come from the per-frame uniforms
+        void Draw(gps::Shader shader);
         GLuint GetTextureId();
+        //renders the prefiltered levels on the GPU, once after loading
+        void PrefilterEnvironment(gps::Shader prefilterShader);
+        //0 until PrefilterEnvironment() ran
+        GLuint GetEnvironmentMapId();
     private:
         GLuint skyboxVAO;
-        GLuint skyboxVBO;
         GLuint cubemapTexture;
+        int cubemapSize;
+        GLuint environmentTexture;
+        //program the sampler uniform was last set on
+        GLuint samplerProgram;
         GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        GLuint LoadKTXCubeMap(const char* fileName);
+        void SetCubeMapParameters();
         void InitSkyBox();
     };
 }
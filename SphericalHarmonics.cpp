@@ -0,0 +1,151 @@
+#include "SphericalHarmonics.hpp"
+
+#include <cmath>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_SH_SSE
+#endif
+
+namespace gps {
+
+    namespace {
+        //four texels processed together, one per lane, as in TransformSystem
+#ifdef GPS_SH_SSE
+        typedef __m128 Lane;
+        inline Lane load(const float* p) { return _mm_loadu_ps(p); }
+        inline Lane broadcast(float s) { return _mm_set1_ps(s); }
+        inline Lane add(Lane a, Lane b) { return _mm_add_ps(a, b); }
+        inline Lane sub(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+        inline Lane mul(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+        inline Lane rsqrt(Lane a) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a)); }
+        inline float sum(Lane a) { float v[4]; _mm_storeu_ps(v, a); return v[0] + v[1] + v[2] + v[3]; }
+#else
+        struct Lane { float v[4]; };
+        inline Lane load(const float* p) { Lane r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+        inline Lane broadcast(float s) { Lane r; for (int i = 0; i < 4; i++) r.v[i] = s; return r; }
+        inline Lane add(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+        inline Lane sub(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+        inline Lane mul(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+        inline Lane rsqrt(Lane a) { for (int i = 0; i < 4; i++) a.v[i] = 1.0f / std::sqrt(a.v[i]); return a; }
+        inline float sum(Lane a) { return a.v[0] + a.v[1] + a.v[2] + a.v[3]; }
+#endif
+
+        //real SH basis normalization, in the order 00, 1-1, 10, 11, 2-2, 2-1, 20, 21, 22
+        const float BASIS[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f,
+            1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+        //clamped cosine convolution of each band divided by pi: 1, 2/3, 1/4
+        const float COSINE_LOBE[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+            0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    }
+
+    SphericalHarmonics::SphericalHarmonics()
+    {
+        for (int i = 0; i < COEFFICIENT_COUNT; i++)
+            coefficients[i] = glm::vec3(0.0f);
+    }
+
+    void SphericalHarmonics::ProjectFace(const std::vector<float>& texels, int face, int size, float* sums)
+    {
+        //GL cube map face orientation: direction = major axis + s * sAxis + t * tAxis
+        static const float MAJOR[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        static const float S_AXIS[6][3] = { { 0, 0, -1 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 0, 0 }, { 1, 0, 0 }, { -1, 0, 0 } };
+        static const float T_AXIS[6][3] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+
+        Lane accumulators[27];
+        for (int i = 0; i < 27; i++)
+            accumulators[i] = broadcast(0.0f);
+
+        float texelSize = 2.0f / size;
+        for (int y = 0; y < size; y++) {
+            float t = (y + 0.5f) * texelSize - 1.0f;
+            //the face is processed four texels at a time, the size is a power of two
+            for (int x = 0; x + 4 <= size; x += 4) {
+                float s[4], r[4], g[4], b[4];
+                for (int i = 0; i < 4; i++) {
+                    s[i] = (x + i + 0.5f) * texelSize - 1.0f;
+                    const float* texel = &texels[3 * (y * size + x + i)];
+                    r[i] = texel[0];
+                    g[i] = texel[1];
+                    b[i] = texel[2];
+                }
+
+                Lane sLane = load(s);
+                Lane tLane = broadcast(t);
+                Lane dx = add(broadcast(MAJOR[face][0]), add(mul(sLane, broadcast(S_AXIS[face][0])), mul(tLane, broadcast(T_AXIS[face][0]))));
+                Lane dy = add(broadcast(MAJOR[face][1]), add(mul(sLane, broadcast(S_AXIS[face][1])), mul(tLane, broadcast(T_AXIS[face][1]))));
+                Lane dz = add(broadcast(MAJOR[face][2]), add(mul(sLane, broadcast(S_AXIS[face][2])), mul(tLane, broadcast(T_AXIS[face][2]))));
+
+                //|d|^2 = 1 + s^2 + t^2; the solid angle of a texel is texelSize^2 / |d|^3
+                Lane lengthSquared = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+                Lane inverseLength = rsqrt(lengthSquared);
+                Lane solidAngle = mul(broadcast(texelSize * texelSize), mul(inverseLength, mul(inverseLength, inverseLength)));
+                Lane nx = mul(dx, inverseLength);
+                Lane ny = mul(dy, inverseLength);
+                Lane nz = mul(dz, inverseLength);
+
+                Lane basis[9];
+                basis[0] = broadcast(BASIS[0]);
+                basis[1] = mul(broadcast(BASIS[1]), ny);
+                basis[2] = mul(broadcast(BASIS[2]), nz);
+                basis[3] = mul(broadcast(BASIS[3]), nx);
+                basis[4] = mul(broadcast(BASIS[4]), mul(nx, ny));
+                basis[5] = mul(broadcast(BASIS[5]), mul(ny, nz));
+                basis[6] = mul(broadcast(BASIS[6]), sub(mul(broadcast(3.0f), mul(nz, nz)), broadcast(1.0f)));
+                basis[7] = mul(broadcast(BASIS[7]), mul(nx, nz));
+                basis[8] = mul(broadcast(BASIS[8]), sub(mul(nx, nx), mul(ny, ny)));
+
+                Lane rw = mul(load(r), solidAngle);
+                Lane gw = mul(load(g), solidAngle);
+                Lane bw = mul(load(b), solidAngle);
+                for (int i = 0; i < 9; i++) {
+                    accumulators[3 * i + 0] = add(accumulators[3 * i + 0], mul(basis[i], rw));
+                    accumulators[3 * i + 1] = add(accumulators[3 * i + 1], mul(basis[i], gw));
+                    accumulators[3 * i + 2] = add(accumulators[3 * i + 2], mul(basis[i], bw));
+                }
+            }
+        }
+
+        for (int i = 0; i < 27; i++)
+            sums[i] = sum(accumulators[i]);
+    }
+
+    void SphericalHarmonics::ProjectCubeMap(GLuint texture, int level)
+    {
+        GLint size = 0;
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_WIDTH, &size);
+
+        //the readback has to happen on the thread that owns the context
+        std::vector<float> faces[6];
+        for (int face = 0; face < 6; face++) {
+            faces[face].resize(3 * size * size);
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB, GL_FLOAT, faces[face].data());
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        float sums[6][27];
+        std::vector<std::thread> workers;
+        for (int face = 0; face < 6; face++)
+            workers.push_back(std::thread(ProjectFace, std::cref(faces[face]), face, (int)size, sums[face]));
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+
+        for (int i = 0; i < COEFFICIENT_COUNT; i++) {
+            coefficients[i] = glm::vec3(0.0f);
+            for (int face = 0; face < 6; face++)
+                coefficients[i] += glm::vec3(sums[face][3 * i], sums[face][3 * i + 1], sums[face][3 * i + 2]);
+        }
+    }
+
+    SphericalHarmonics SphericalHarmonics::getIrradiance()
+    {
+        //E(n) / pi = sum over i of coefficient_i * lobe_i * basis_i(n); the basis constants are
+        //folded in here so the shader only evaluates the polynomials
+        SphericalHarmonics irradiance;
+        for (int i = 0; i < COEFFICIENT_COUNT; i++)
+            irradiance.coefficients[i] = coefficients[i] * COSINE_LOBE[i] * BASIS[i];
+        return irradiance;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef SphericalHarmonics_hpp
+#define SphericalHarmonics_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //Bands 0-2 (9 coefficients) of an RGB function on the sphere. Projecting the sky into them
+    //keeps only its low frequencies, which is all the diffuse ambient light needs: evaluating
+    //the irradiance for a normal is a handful of multiply-adds instead of a cube map fetch.
+    class SphericalHarmonics
+    {
+    public:
+        static const int COEFFICIENT_COUNT = 9;
+
+        glm::vec3 coefficients[COEFFICIENT_COUNT];
+
+        SphericalHarmonics();
+
+        //projects one level of a linear cube map, read back from the GPU, one thread per face
+        void ProjectCubeMap(GLuint texture, int level);
+        //convolves with the clamped cosine lobe and folds in the basis constants and 1/pi;
+        //the result is evaluated by ambientIrradiance() in frameUniforms.glsl
+        SphericalHarmonics getIrradiance();
+
+    private:
+        //radiance * basis * solid angle summed over the texels of a face, 27 floats in
+        //coefficient-major order
+        static void ProjectFace(const std::vector<float>& texels, int face, int size, float* sums);
+    };
+}
+
+#endif /* SphericalHarmonics_hpp */
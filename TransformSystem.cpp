@@ -0,0 +1,218 @@
+#include "TransformSystem.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_TRANSFORM_SSE
+#endif
+
+namespace gps {
+
+    namespace {
+        //four instances processed together, one per lane
+#ifdef GPS_TRANSFORM_SSE
+        typedef __m128 Lane;
+        inline Lane load(const float* p) { return _mm_loadu_ps(p); }
+        inline void store(float* p, Lane v) { _mm_storeu_ps(p, v); }
+        inline Lane broadcast(float s) { return _mm_set1_ps(s); }
+        inline Lane add(Lane a, Lane b) { return _mm_add_ps(a, b); }
+        inline Lane sub(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+        inline Lane mul(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+        inline Lane div(Lane a, Lane b) { return _mm_div_ps(a, b); }
+#else
+        struct Lane { float v[4]; };
+        inline Lane load(const float* p) { Lane r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+        inline void store(float* p, Lane a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+        inline Lane broadcast(float s) { Lane r; for (int i = 0; i < 4; i++) r.v[i] = s; return r; }
+        inline Lane add(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+        inline Lane sub(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+        inline Lane mul(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+        inline Lane div(Lane a, Lane b) { for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a; }
+#endif
+    }
+
+    TransformSystem::TransformSystem()
+    {
+        instanceCount = 0;
+        viewValid = false;
+    }
+
+    int TransformSystem::AddInstance(glm::mat4 worldMatrix, bool isStatic)
+    {
+        if (!freeInstances.empty()) {
+            int instance = freeInstances.back();
+            freeInstances.pop_back();
+            staticInstance[instance] = isStatic ? 1 : 0;
+            SetWorld(instance, worldMatrix);
+            return instance;
+        }
+
+        //grow the arrays one group at a time, padding lanes hold identity matrices
+        if (instanceCount % 4 == 0) {
+            for (int e = 0; e < 16; e++) {
+                float identity = (e % 5 == 0) ? 1.0f : 0.0f;
+                world[e].resize(instanceCount + 4, identity);
+                worldView[e].resize(instanceCount + 4, identity);
+            }
+            for (int e = 0; e < 9; e++) {
+                float identity = (e % 4 == 0) ? 1.0f : 0.0f;
+                worldNormal[e].resize(instanceCount + 4, identity);
+                normal[e].resize(instanceCount + 4, identity);
+            }
+            dirtyGroup.push_back(1);
+        }
+
+        int instance = instanceCount++;
+        staticInstance.push_back(isStatic ? 1 : 0);
+        SetWorld(instance, worldMatrix);
+        return instance;
+    }
+
+    void TransformSystem::SetWorld(int instance, glm::mat4 worldMatrix)
+    {
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                world[c * 4 + r][instance] = worldMatrix[c][r];
+        dirtyGroup[instance / 4] = 1;
+    }
+
+    void TransformSystem::RemoveInstance(int instance)
+    {
+        staticInstance[instance] = 1;
+        SetWorld(instance, glm::mat4(1.0f));
+        freeInstances.push_back(instance);
+    }
+
+    void TransformSystem::ComputeWorldNormals(int group)
+    {
+        int base = group * 4;
+        Lane c0[3], c1[3], c2[3];
+        for (int r = 0; r < 3; r++) {
+            c0[r] = load(&world[r][base]);
+            c1[r] = load(&world[4 + r][base]);
+            c2[r] = load(&world[8 + r][base]);
+        }
+
+        //the inverse transpose of [c0 c1 c2] is [c1 x c2, c2 x c0, c0 x c1] / det
+        Lane n0[3], n1[3], n2[3];
+        n0[0] = sub(mul(c1[1], c2[2]), mul(c1[2], c2[1]));
+        n0[1] = sub(mul(c1[2], c2[0]), mul(c1[0], c2[2]));
+        n0[2] = sub(mul(c1[0], c2[1]), mul(c1[1], c2[0]));
+        n1[0] = sub(mul(c2[1], c0[2]), mul(c2[2], c0[1]));
+        n1[1] = sub(mul(c2[2], c0[0]), mul(c2[0], c0[2]));
+        n1[2] = sub(mul(c2[0], c0[1]), mul(c2[1], c0[0]));
+        n2[0] = sub(mul(c0[1], c1[2]), mul(c0[2], c1[1]));
+        n2[1] = sub(mul(c0[2], c1[0]), mul(c0[0], c1[2]));
+        n2[2] = sub(mul(c0[0], c1[1]), mul(c0[1], c1[0]));
+
+        Lane det = add(add(mul(c0[0], n0[0]), mul(c0[1], n0[1])), mul(c0[2], n0[2]));
+        Lane invDet = div(broadcast(1.0f), det);
+
+        for (int r = 0; r < 3; r++) {
+            store(&worldNormal[r][base], mul(n0[r], invDet));
+            store(&worldNormal[3 + r][base], mul(n1[r], invDet));
+            store(&worldNormal[6 + r][base], mul(n2[r], invDet));
+        }
+    }
+
+    void TransformSystem::ComputeViewTransforms(int group, const float* view)
+    {
+        int base = group * 4;
+
+        //worldView = view * world
+        for (int c = 0; c < 4; c++) {
+            Lane w0 = load(&world[c * 4 + 0][base]);
+            Lane w1 = load(&world[c * 4 + 1][base]);
+            Lane w2 = load(&world[c * 4 + 2][base]);
+            Lane w3 = load(&world[c * 4 + 3][base]);
+            for (int r = 0; r < 4; r++) {
+                Lane sum = mul(broadcast(view[r]), w0);
+                sum = add(sum, mul(broadcast(view[4 + r]), w1));
+                sum = add(sum, mul(broadcast(view[8 + r]), w2));
+                sum = add(sum, mul(broadcast(view[12 + r]), w3));
+                store(&worldView[c * 4 + r][base], sum);
+            }
+        }
+
+        //the view matrix is a rigid transform, its inverse transpose is its own rotation part,
+        //so the eye space normal matrix is mat3(view) * worldNormal
+        for (int c = 0; c < 3; c++) {
+            Lane n0 = load(&worldNormal[c * 3 + 0][base]);
+            Lane n1 = load(&worldNormal[c * 3 + 1][base]);
+            Lane n2 = load(&worldNormal[c * 3 + 2][base]);
+            for (int r = 0; r < 3; r++) {
+                Lane sum = mul(broadcast(view[r]), n0);
+                sum = add(sum, mul(broadcast(view[4 + r]), n1));
+                sum = add(sum, mul(broadcast(view[8 + r]), n2));
+                store(&normal[c * 3 + r][base], sum);
+            }
+        }
+    }
+
+    void TransformSystem::Update(glm::mat4 viewMatrix)
+    {
+        bool viewChanged = !viewValid || viewMatrix != lastView;
+        lastView = viewMatrix;
+        viewValid = true;
+
+        float view[16];
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                view[c * 4 + r] = viewMatrix[c][r];
+
+        int groupCount = (int)dirtyGroup.size();
+        for (int g = 0; g < groupCount; g++) {
+            //groups made only of static instances keep their cached normal matrices
+            if (dirtyGroup[g])
+                ComputeWorldNormals(g);
+            if (dirtyGroup[g] || viewChanged)
+                ComputeViewTransforms(g, view);
+            dirtyGroup[g] = 0;
+        }
+    }
+
+    glm::mat4 TransformSystem::getWorld(int instance)
+    {
+        glm::mat4 result;
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                result[c][r] = world[c * 4 + r][instance];
+        return result;
+    }
+
+    glm::mat4 TransformSystem::getWorldView(int instance)
+    {
+        glm::mat4 result;
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                result[c][r] = worldView[c * 4 + r][instance];
+        return result;
+    }
+
+    glm::mat3 TransformSystem::getNormalMatrix(int instance)
+    {
+        glm::mat3 result;
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                result[c][r] = normal[c * 3 + r][instance];
+        return result;
+    }
+
+    glm::mat3 TransformSystem::getWorldNormalMatrix(int instance)
+    {
+        glm::mat3 result;
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                result[c][r] = worldNormal[c * 3 + r][instance];
+        return result;
+    }
+
+    bool TransformSystem::isStatic(int instance)
+    {
+        return staticInstance[instance] != 0;
+    }
+
+    int TransformSystem::getInstanceCount()
+    {
+        return instanceCount;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef TransformSystem_hpp
+#define TransformSystem_hpp
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //Keeps the world, world-view and normal matrices of every instance in structure of arrays
+    //layout (one array per matrix element) so they can be computed four instances at a time.
+    //The world normal matrix (inverse transpose) is only recomputed for instances whose world
+    //matrix changed, static instances compute it once.
+    class TransformSystem
+    {
+    public:
+        TransformSystem();
+
+        //returns the instance index, the index of a removed instance is reused
+        int AddInstance(glm::mat4 world, bool isStatic);
+        //the instance keeps its slot with an identity matrix until it is reused
+        void RemoveInstance(int instance);
+        //moves a dynamic instance, its normal matrix is recomputed on the next Update()
+        void SetWorld(int instance, glm::mat4 world);
+        //recomputes what changed since the last call, for the given view matrix
+        void Update(glm::mat4 viewMatrix);
+
+        glm::mat4 getWorld(int instance);
+        glm::mat4 getWorldView(int instance);
+        //eye space normal matrix, inverse transpose of the world-view matrix
+        glm::mat3 getNormalMatrix(int instance);
+        //world space normal matrix, inverse transpose of the world matrix
+        glm::mat3 getWorldNormalMatrix(int instance);
+        bool isStatic(int instance);
+        //removed instances included, the highest index plus one
+        int getInstanceCount();
+
+    private:
+        int instanceCount;
+        //column-major element e of instance i is world[e][i]
+        std::vector<float> world[16];
+        std::vector<float> worldNormal[9];
+        std::vector<float> worldView[16];
+        std::vector<float> normal[9];
+        std::vector<unsigned char> staticInstance;
+        std::vector<int> freeInstances;
+        //one flag per group of four instances
+        std::vector<unsigned char> dirtyGroup;
+
+        glm::mat4 lastView;
+        bool viewValid;
+
+        void ComputeWorldNormals(int group);
+        void ComputeViewTransforms(int group, const float* view);
+    };
+}
+
+#endif /* TransformSystem_hpp */
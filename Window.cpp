@@ -1,5 +1,10 @@
 #include "Window.h"
 
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 namespace gps {
 
     void Window::Create(int width, int height, const char *title) {
@@ -32,17 +37,135 @@ namespace gps {
         glewExperimental = GL_TRUE;
         glewInit();
 
+        PrintVersionInfo();
+
+        //for RETINA display
+        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
+    }
+
+    void Window::CreateHeadless(int width, int height) {
+        this->headless = true;
+
+#if defined(__linux__)
+        //surfaceless platform: no X11/Wayland server needed, works with Mesa llvmpipe
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (!getPlatformDisplay) {
+            throw std::runtime_error("eglGetPlatformDisplayEXT is not available!");
+        }
+
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            throw std::runtime_error("Could not initialize the surfaceless EGL display!");
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+
+        //the surfaceless platform has no window configs, and EGL_SURFACE_TYPE defaults to EGL_WINDOW_BIT
+        EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            throw std::runtime_error("Could not find an EGL config for desktop OpenGL!");
+        }
+
+        EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 1,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT) {
+            throw std::runtime_error("Could not create the EGL OpenGL 4.1 context!");
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+
+        this->eglDisplay = display;
+        this->eglContext = context;
+
+        // only the GL entry points are needed, glewInit() would also look for a GLX display
+        glewExperimental = GL_TRUE;
+        if (glewContextInit() != GLEW_OK) {
+            throw std::runtime_error("Could not initialize GLEW on the EGL context!");
+        }
+#else
+        //no surfaceless platform here, use a window that is never shown
+        if (!glfwInit()) {
+            throw std::runtime_error("Could not start GLFW3!");
+        }
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+        this->window = glfwCreateWindow(width, height, "OpenGL Project Headless", NULL, NULL);
+        if (!this->window) {
+            throw std::runtime_error("Could not create GLFW3 window!");
+        }
+
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(0);
+
+        glewExperimental = GL_TRUE;
+        glewInit();
+#endif
+
+        PrintVersionInfo();
+
+        this->dimensions.width = width;
+        this->dimensions.height = height;
+        CreateOffscreenFramebuffer();
+    }
+
+    void Window::CreateOffscreenFramebuffer() {
+        //sRGB color to match the default framebuffer of the windowed mode
+        glGenRenderbuffers(1, &colorRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, dimensions.width, dimensions.height);
+
+        glGenRenderbuffers(1, &depthRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, dimensions.width, dimensions.height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Offscreen framebuffer is incomplete!");
+        }
+    }
+
+    void Window::PrintVersionInfo() {
         // get version info
         const GLubyte* renderer = glGetString(GL_RENDERER); // get renderer string
         const GLubyte* version = glGetString(GL_VERSION); // version as a string
         std::cout << "Renderer: " << renderer << std::endl;
         std::cout << "OpenGL version: " << version << std::endl;
-
-        //for RETINA display
-        glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
     }
 
     void Window::Delete() {
+        if (framebuffer) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorRenderbuffer);
+            glDeleteRenderbuffers(1, &depthRenderbuffer);
+        }
+
+#if defined(__linux__)
+        if (eglDisplay) {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+            return;
+        }
+#endif
+
         if (window)
             glfwDestroyWindow(window);
         //close GL context and any other GLFW resources
@@ -60,4 +183,12 @@ namespace gps {
     void Window::setWindowDimensions(WindowDimensions dimensions) {
         this->dimensions = dimensions;
     }
+
+    GLuint Window::getFramebuffer() {
+        return this->framebuffer;
+    }
+
+    bool Window::isHeadless() {
+        return this->headless;
+    }
 }
\ No newline at end of file
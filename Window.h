@@ -17,15 +17,31 @@ namespace gps {
 
     public:
         void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        //creates an OpenGL context without any display (EGL surfaceless on Linux, a hidden
+        //window elsewhere); the scene is rendered into an offscreen framebuffer object
+        void CreateHeadless(int width=800, int height=600);
         void Delete();
 
         GLFWwindow* getWindow();
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
+        //framebuffer the scene is rendered into, 0 for the window's default framebuffer
+        GLuint getFramebuffer();
+        bool isHeadless();
 
     private:
         WindowDimensions dimensions;
-        GLFWwindow *window;
+        GLFWwindow *window = NULL;
+        bool headless = false;
+        GLuint framebuffer = 0;
+        GLuint colorRenderbuffer = 0;
+        GLuint depthRenderbuffer = 0;
+        //EGL display and context of the headless mode
+        void *eglDisplay = NULL;
+        void *eglContext = NULL;
+
+        void CreateOffscreenFramebuffer();
+        void PrintVersionInfo();
     };
 }
 
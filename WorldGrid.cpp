@@ -0,0 +1,321 @@
+#include "WorldGrid.hpp"
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace gps {
+
+    namespace {
+        //seconds of camera movement the priorities look ahead
+        const float LOOK_AHEAD = 1.0f;
+    }
+
+    WorldGrid::WorldGrid()
+    {
+        cellSize = 1.0f;
+        loadRadius = 0.0f;
+        synchronous = false;
+        version = 0;
+        stopping = false;
+    }
+
+    WorldGrid::~WorldGrid()
+    {
+        StopLoader();
+    }
+
+    void WorldGrid::Init(const std::string& directory, float cellSize, float loadRadius)
+    {
+        this->directory = directory;
+        this->cellSize = cellSize;
+        this->loadRadius = loadRadius;
+        //a previous Delete() stopped the loader
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = false;
+        }
+        if (!synchronous && !loader.joinable())
+            loader = std::thread(&WorldGrid::LoaderThread, this);
+    }
+
+    void WorldGrid::Update(glm::vec3 cameraPosition, glm::vec3 cameraVelocity, glm::vec3 cameraFront,
+        gps::ModelManager& models, gps::TransformSystem& transforms)
+    {
+        std::vector<Read> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(completed);
+        }
+        for (size_t i = 0; i < finished.size(); i++) {
+            std::map<CellKey, Cell>::iterator found = cells.find(finished[i].key);
+            if (found != cells.end() && found->second.state == CELL_REQUESTED) {
+                found->second.placements.swap(finished[i].placements);
+                found->second.state = CELL_READ;
+            }
+        }
+
+        bool changed = false;
+
+        //remove what is out of range; requested cells the loader already took are removed once read
+        float unloadRadius = loadRadius + cellSize;
+        std::vector<CellKey> dropped;
+        for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end();) {
+            if (DistanceToCell(cameraPosition, cell->first) <= unloadRadius) {
+                ++cell;
+                continue;
+            }
+            if (cell->second.state == CELL_REQUESTED) {
+                dropped.push_back(cell->first);
+                ++cell;
+                continue;
+            }
+            if (cell->second.state == CELL_PLACED) {
+                Remove(cell->second, transforms);
+                changed = true;
+            }
+            cell = cells.erase(cell);
+        }
+
+        //request the cells that came in range
+        std::vector<CellKey> added;
+        int range = (int)std::ceil(loadRadius / cellSize);
+        int cameraX = (int)std::floor(cameraPosition.x / cellSize);
+        int cameraZ = (int)std::floor(cameraPosition.z / cellSize);
+        for (int x = cameraX - range; x <= cameraX + range; x++)
+            for (int z = cameraZ - range; z <= cameraZ + range; z++) {
+                CellKey key(x, z);
+                if (DistanceToCell(cameraPosition, key) > loadRadius || cells.find(key) != cells.end())
+                    continue;
+                Cell& cell = cells[key];
+                cell.state = CELL_REQUESTED;
+                added.push_back(key);
+            }
+
+        //nearest to where the camera will be first, the cells it looks at before the ones behind it
+        glm::vec2 ahead = glm::vec2(cameraPosition.x, cameraPosition.z) + glm::vec2(cameraVelocity.x, cameraVelocity.z) * LOOK_AHEAD;
+        glm::vec2 front = glm::vec2(cameraFront.x, cameraFront.z);
+        if (glm::length(front) > 0.0f)
+            front = glm::normalize(front);
+        for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end(); ++cell) {
+            glm::vec2 toCell = (glm::vec2(cell->first.first, cell->first.second) + 0.5f) * cellSize - ahead;
+            float distance = glm::length(toCell);
+            float facing = distance > 0.0f ? glm::dot(front, toCell / distance) : 1.0f;
+            cell->second.priority = distance * (1.5f - 0.5f * facing);
+        }
+
+        if (synchronous) {
+            for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end(); ++cell)
+                if (cell->second.state == CELL_REQUESTED) {
+                    cell->second.placements = ReadCell(CellFile(directory, cell->first));
+                    cell->second.state = CELL_READ;
+                }
+        } else {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < dropped.size(); i++)
+                for (size_t r = 0; r < requests.size(); r++)
+                    if (requests[r].key == dropped[i]) {
+                        requests.erase(requests.begin() + r);
+                        cells.erase(dropped[i]);
+                        break;
+                    }
+            for (size_t i = 0; i < added.size(); i++) {
+                Read read;
+                read.key = added[i];
+                requests.push_back(read);
+            }
+            for (size_t r = 0; r < requests.size(); r++)
+                requests[r].priority = cells[requests[r].key].priority;
+            std::sort(requests.begin(), requests.end(), [](const Read& a, const Read& b) { return a.priority < b.priority; });
+            if (!requests.empty())
+                wake.notify_one();
+        }
+
+        //place the cells that were read, spread over frames
+        std::vector<Cell*> ready;
+        for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end(); ++cell)
+            if (cell->second.state == CELL_READ)
+                ready.push_back(&cell->second);
+        std::sort(ready.begin(), ready.end(), [](const Cell* a, const Cell* b) { return a->priority < b->priority; });
+        for (size_t i = 0; i < ready.size() && (synchronous || (int)i < MAX_CELLS_PER_FRAME); i++) {
+            Place(*ready[i], models, transforms);
+            changed = true;
+        }
+
+        if (!changed)
+            return;
+
+        std::vector<Cell*> placed;
+        for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end(); ++cell)
+            if (cell->second.state == CELL_PLACED)
+                placed.push_back(&cell->second);
+        std::sort(placed.begin(), placed.end(), [](const Cell* a, const Cell* b) { return a->priority < b->priority; });
+        objects.clear();
+        for (size_t i = 0; i < placed.size(); i++)
+            objects.insert(objects.end(), placed[i]->objects.begin(), placed[i]->objects.end());
+        version++;
+    }
+
+    const std::vector<WorldGrid::Object>& WorldGrid::getObjects()
+    {
+        return objects;
+    }
+
+    unsigned int WorldGrid::getVersion()
+    {
+        return version;
+    }
+
+    int WorldGrid::getCellCount()
+    {
+        int count = 0;
+        for (std::map<CellKey, Cell>::iterator cell = cells.begin(); cell != cells.end(); ++cell)
+            if (cell->second.state == CELL_PLACED)
+                count++;
+        return count;
+    }
+
+    void WorldGrid::setSynchronous(bool synchronous)
+    {
+        this->synchronous = synchronous;
+    }
+
+    void WorldGrid::Delete()
+    {
+        StopLoader();
+        //cells read after the last Update() belong to the cells removed here
+        completed.clear();
+        cells.clear();
+        objects.clear();
+    }
+
+    void WorldGrid::Place(Cell& cell, gps::ModelManager& models, gps::TransformSystem& transforms)
+    {
+        cell.objects.resize(cell.placements.size());
+        for (size_t i = 0; i < cell.placements.size(); i++) {
+            cell.objects[i].model = models.Register(cell.placements[i].fileName);
+            cell.objects[i].transform = transforms.AddInstance(cell.placements[i].world, true);
+        }
+        cell.placements.clear();
+        cell.state = CELL_PLACED;
+    }
+
+    void WorldGrid::Remove(Cell& cell, gps::TransformSystem& transforms)
+    {
+        for (size_t i = 0; i < cell.objects.size(); i++)
+            transforms.RemoveInstance(cell.objects[i].transform);
+        cell.objects.clear();
+    }
+
+    float WorldGrid::DistanceToCell(glm::vec3 position, const CellKey& key)
+    {
+        //to the nearest point of the cell, 0 inside it
+        glm::vec2 cellMin = glm::vec2(key.first, key.second) * cellSize;
+        glm::vec2 point = glm::vec2(position.x, position.z);
+        return glm::length(point - glm::clamp(point, cellMin, cellMin + cellSize));
+    }
+
+    void WorldGrid::LoaderThread()
+    {
+        for (;;) {
+            Read read;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+                read = requests.front();
+                requests.erase(requests.begin());
+            }
+
+            read.placements = ReadCell(CellFile(directory, read.key));
+
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(read));
+        }
+    }
+
+    void WorldGrid::StopLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            requests.clear();
+        }
+        wake.notify_all();
+        if (loader.joinable())
+            loader.join();
+    }
+
+    std::string WorldGrid::CellFile(const std::string& directory, const CellKey& key)
+    {
+        return directory + "/cell_" + std::to_string(key.first) + "_" + std::to_string(key.second) + ".txt";
+    }
+
+    std::vector<WorldGrid::Placement> WorldGrid::ReadCell(const std::string& fileName)
+    {
+        std::string text;
+        gps::AssetPack::View view;
+        if (gps::AssetPack::FindMounted(fileName, view)) {
+            text.assign(view.data, view.size);
+        } else {
+            std::ifstream file(fileName.c_str(), std::ios::binary);
+            if (!file)
+                return std::vector<Placement>();
+            text.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        }
+
+        std::vector<Placement> placements;
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            Placement placement;
+            //quoted, file names may contain spaces; an unquoted name is read up to the first space
+            fields >> std::quoted(placement.fileName);
+            for (int c = 0; c < 4; c++)
+                for (int r = 0; r < 4; r++)
+                    fields >> placement.world[c][r];
+            if (fields)
+                placements.push_back(placement);
+        }
+        return placements;
+    }
+
+    bool WorldGrid::Export(const std::string& directory, float cellSize, const std::vector<Placement>& placements)
+    {
+        std::map<CellKey, std::vector<const Placement*> > exported;
+        for (size_t i = 0; i < placements.size(); i++) {
+            glm::vec3 origin = glm::vec3(placements[i].world[3]);
+            CellKey key((int)std::floor(origin.x / cellSize), (int)std::floor(origin.z / cellSize));
+            exported[key].push_back(&placements[i]);
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+
+        for (std::map<CellKey, std::vector<const Placement*> >::iterator cell = exported.begin(); cell != exported.end(); ++cell) {
+            std::ofstream file(CellFile(directory, cell->first).c_str());
+            if (!file)
+                return false;
+            file << "# model file (quoted), world matrix by columns\n" << std::setprecision(9);
+            for (size_t i = 0; i < cell->second.size(); i++) {
+                const Placement& placement = *cell->second[i];
+                file << std::quoted(placement.fileName);
+                for (int c = 0; c < 4; c++)
+                    for (int r = 0; r < 4; r++)
+                        file << ' ' << placement.world[c][r];
+                file << '\n';
+            }
+            if (!file)
+                return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef WorldGrid_hpp
+#define WorldGrid_hpp
+
+#include "ModelManager.hpp"
+#include "TransformSystem.hpp"
+
+#include "glm/glm.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    //The static objects of a large scene, split into square cells on the xz plane that are
+    //loaded around the camera. A cell is a text file in the world directory, cell_<x>_<z>.txt,
+    //with one object per line: the model file in double quotes and the 16 elements of its world
+    //matrix, column by column; a cell without a file is empty. An object belongs to the cell of
+    //its origin.
+    //Cells within the load radius are read on a background thread, nearest to where the camera
+    //is heading first, and placed at most MAX_CELLS_PER_FRAME per frame. Cells past the unload
+    //radius, one cell further out so a camera on a border does not make them come and go, are
+    //removed; their models are left to the ModelManager budgets.
+    class WorldGrid
+    {
+    public:
+        static const int MAX_CELLS_PER_FRAME = 1;
+
+        //an object of a placed cell
+        struct Object {
+            int model;
+            int transform;
+        };
+
+        //an object as stored in a cell file
+        struct Placement {
+            std::string fileName;
+            glm::mat4 world;
+        };
+
+        WorldGrid();
+        ~WorldGrid();
+
+        //starts the loader thread
+        void Init(const std::string& directory, float cellSize, float loadRadius);
+        //requests, places and removes cells for the camera; once per frame, before the
+        //transforms are updated. The velocity is in units per second.
+        void Update(glm::vec3 cameraPosition, glm::vec3 cameraVelocity, glm::vec3 cameraFront,
+            gps::ModelManager& models, gps::TransformSystem& transforms);
+        //objects of the placed cells, the cells that were nearest to where the camera was heading first
+        const std::vector<Object>& getObjects();
+        //changes whenever cells are placed or removed
+        unsigned int getVersion();
+        int getCellCount();
+        //reads the cells on the calling thread inside Update(), so every run renders the same frames
+        void setSynchronous(bool synchronous);
+        //stops the loader; the transforms of the placed cells are left to their owner
+        void Delete();
+
+        //writes the placements as cell files, to turn a scene into a streamed world
+        static bool Export(const std::string& directory, float cellSize, const std::vector<Placement>& placements);
+
+    private:
+        enum CellState { CELL_REQUESTED, CELL_READ, CELL_PLACED };
+
+        struct Cell {
+            CellState state;
+            //lower is sooner
+            float priority;
+            std::vector<Placement> placements;
+            std::vector<Object> objects;
+        };
+
+        typedef std::pair<int, int> CellKey;
+
+        //a cell handed to the loader thread, and its placements
+        struct Read {
+            CellKey key;
+            float priority;
+            std::vector<Placement> placements;
+        };
+
+        std::string directory;
+        float cellSize;
+        float loadRadius;
+        bool synchronous;
+        std::map<CellKey, Cell> cells;
+        std::vector<Object> objects;
+        unsigned int version;
+
+        std::thread loader;
+        std::mutex mutex;
+        std::condition_variable wake;
+        //sorted by priority, the loader takes the first
+        std::vector<Read> requests;
+        std::vector<Read> completed;
+        bool stopping;
+
+        void LoaderThread();
+        void StopLoader();
+        void Place(Cell& cell, gps::ModelManager& models, gps::TransformSystem& transforms);
+        void Remove(Cell& cell, gps::TransformSystem& transforms);
+        float DistanceToCell(glm::vec3 position, const CellKey& key);
+
+        static std::string CellFile(const std::string& directory, const CellKey& key);
+        static std::vector<Placement> ReadCell(const std::string& fileName);
+    };
+}
+
+#endif /* WorldGrid_hpp */
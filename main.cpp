@@ -13,7 +13,35 @@
 #include "Model3D.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include "SkyBox.hpp"
+#include "LightClusters.hpp"
+#include "TransformSystem.hpp"
+#include "Profiler.hpp"
+#include "RenderStats.hpp"
+#include "InputRecorder.hpp"
+#include "ShaderWatcher.hpp"
+#include "ShaderPermutations.hpp"
+#include "FrameUniforms.hpp"
+#include "SphericalHarmonics.hpp"
+#include "ObjParser.hpp"
+#include "ModelCache.hpp"
+#include "AssetPack.hpp"
+#include "ModelManager.hpp"
+#include "Frustum.hpp"
+#include "WorldGrid.hpp"
+#include "GpuCulling.hpp"
+#include "tiny_obj_loader.h"
 
 // proiect
 int glWindowWidth = 800;
@@ -29,21 +57,25 @@ gps::Window myWindow;
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
-glm::mat3 normalMatrix;
 
 
 // light parameters
 glm::vec3 lightDir;
 glm::vec3 lightColor;
+GLfloat lightAngle;
+glm::mat4 lightSpaceTrMatrix;
+
+// local point and spot lights, binned into view frustum clusters every frame
+gps::LightClusters lightClusters;
+std::vector<gps::PointLight> pointLights;
+bool showTestLights = false;
 
 // shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
+//the basic shader variants keep theirs in colorPassUniforms
 GLint modelLoc2;
+GLint depthMapModelLoc;
+GLint lightSpaceTrMatrixLoc;
+GLint depthPrepassModelLoc;
 
 // camera
 gps::Camera myCamera(
@@ -51,36 +83,58 @@ gps::Camera myCamera(
     glm::vec3(0.0f, 0.0f, -10.0f),
     glm::vec3(0.0f, 1.0f, 0.0f));
 
+// distance moved per simulation step
 GLfloat cameraSpeed = 0.1f;
 
 GLboolean pressedKeys[1024];
 
-// models
-gps::Model3D teapot;
-gps::Model3D dog;
-gps::Model3D trashbin;
-gps::Model3D ground;
-gps::Model3D goal;
-gps::Model3D plane;
-gps::Model3D lamp;
-gps::Model3D ball;
-gps::Model3D sidewalk;
-gps::Model3D fence;
-gps::Model3D bush;
-gps::Model3D tree;
-gps::Model3D bench;
-gps::Model3D doghut;
+// models, loaded when they come into view and evicted over the budgets
+gps::ModelManager modelManager;
+size_t modelGpuBudget = (size_t)512 << 20;
+size_t modelHostBudget = (size_t)1024 << 20;
+// handles of the models in modelManager
+int teapot;
+int dog;
+int trashbin;
+int ground;
+int goal;
+int plane;
+int lamp;
+int ball;
+int sidewalk;
+int fence;
+int bush;
+int tree;
+int bench;
+int doghut;
 GLfloat angleDog;
 GLfloat angleTeapot;
 
 // shaders
-gps::Shader myBasicShader;
 gps::Shader lightShader;
 gps::Shader depthMapShader;
+gps::Shader depthPrepassShader;
+
+//rebuilds the programs whose files changed on disk, in interactive sessions
+gps::ShaderWatcher shaderWatcher;
+
+//view, projection and light of the current frame, shared by all programs
+gps::FrameUniforms frameUniforms;
 
 //skybox
 gps::SkyBox mySkyBox;
 gps::Shader skyboxShader;
+//gradient and sun computed in the shader instead of the cube map faces
+bool proceduralSky = false;
+//single file cube map used instead of the six faces
+std::string skyboxFileName;
+//renders the blurred levels of the environment map once at startup
+gps::Shader cubemapPrefilterShader;
+
+//diffuse ambient light projected from the sky, in the form the shaders evaluate
+gps::SphericalHarmonics ambientLight;
+//mean of the ambient light, the flat ambient term the scene was tuned with
+const float ambientStrength = 0.2f;
 
 //rotate camera
 bool firstMouse = true;
@@ -96,6 +150,101 @@ GLuint depthMapTexture;
 const unsigned int SHADOW_WIDTH = 2048;
 const unsigned int SHADOW_HEIGHT = 2048;
 
+//cached shadow map holding only the static casters
+GLuint staticShadowMapFBO;
+GLuint staticDepthMapTexture;
+bool staticShadowsDirty = true;
+glm::vec3 staticShadowsLightDir;
+
+//scene objects, their matrices live in the transform system
+struct SceneObject {
+    int model;
+    int transform;
+    bool receivesShadows;
+};
+gps::TransformSystem transforms;
+std::vector<SceneObject> staticObjects;
+std::vector<SceneObject> dynamicObjects;
+int dogTransform;
+int planeTransform;
+int ballTransform;
+//static objects streamed from cell files around the camera instead of initStaticObjects()
+gps::WorldGrid worldGrid;
+std::string worldDirectory;
+//writes the park as cell files and exits
+std::string exportWorldDirectory;
+const float WORLD_CELL_SIZE = 8.0f;
+float worldLoadRadius = 24.0f;
+//version of worldGrid staticObjects was built from
+unsigned int staticObjectsVersion = ~0u;
+//frustum test of the frame, per transform instance
+gps::Frustum viewFrustum;
+gps::Frustum shadowFrustum;
+std::vector<unsigned char> visibleInstances;
+//--gpu-culling: with OpenGL 4.3 the camera passes are culled on the GPU and drawn with one
+//indirect draw per mesh; the shadow pass is drawn as without it
+bool gpuCullingRequested = false;
+bool gpuCullingEnabled = false;
+gps::GpuCulling gpuCulling;
+//with GPU culling the residency of the static models is decided per model and cell instead
+//of per object: the world boxes of the instances of a model in one WORLD_CELL_SIZE square
+//are merged, so the CPU cost per frame follows the loaded area, not the instance count
+struct ResidencyGroup {
+    int model;
+    bool boundsKnown;
+    glm::vec3 boundsMin, boundsMax;
+};
+std::vector<ResidencyGroup> residencyGroups;
+//residency version of modelManager and static objects the groups were built for
+unsigned int residencyGroupsVersion = ~0u;
+unsigned int residencyGroupsStaticVersion = ~0u;
+
+enum RenderPass { SHADOW_PASS, DEPTH_PREPASS };
+
+//features of basic.frag, every mesh is drawn with the cheapest variant it needs
+enum BasicShaderFeature {
+    FEATURE_DIFFUSE_TEXTURE = 1 << 0,
+    FEATURE_SPECULAR_TEXTURE = 1 << 1,
+    FEATURE_SHADOWS = 1 << 2,
+    FEATURE_LOCAL_LIGHTS = 1 << 3,
+    //matrices from the GPU culling instance buffer instead of uniforms
+    FEATURE_GPU_INSTANCES = 1 << 4,
+    //highest bit, so the alpha tested meshes sort after the opaque ones
+    FEATURE_ALPHA_TEST = 1 << 5
+};
+const unsigned int BASIC_SHADER_ALL_FEATURES = FEATURE_DIFFUSE_TEXTURE | FEATURE_SPECULAR_TEXTURE | FEATURE_SHADOWS | FEATURE_LOCAL_LIGHTS;
+gps::ShaderPermutations basicShaderVariants;
+bool parallelShaderCompile = false;
+
+//color pass queue, one item per mesh sorted by variant so each program is bound once per frame
+struct ColorPassItem {
+    unsigned int features;
+    gps::Model3D* object;
+    size_t mesh;
+    int transform;
+    //GPU culling batch, drawn for all its visible instances at once; -1 for one instance
+    int batch;
+};
+std::vector<ColorPassItem> colorPassQueue;
+//residency version of modelManager and static objects the queue was built for
+unsigned int colorPassQueueVersion = ~0u;
+unsigned int colorPassQueueStaticVersion = ~0u;
+
+//uniform locations of every variant in use, cleared when the variants are rebuilt
+struct ColorPassUniforms {
+    GLint model, normalMatrix, lightSpaceTrMatrix, shadowMap;
+    gps::MaterialUniforms material;
+    gps::LightClusters::Uniforms lightClusters;
+};
+std::map<unsigned int, ColorPassUniforms> colorPassUniforms;
+
+//depth pre-pass, toggled at runtime with P
+bool depthPrepassEnabled = false;
+
+//CPU scopes and GPU pass timings, --trace <file> also records a Chrome trace
+gps::Profiler profiler;
+std::string traceFileName;
+
 //plane animation
 float anglePlane = 0.0f;
 
@@ -104,6 +253,51 @@ float xBall = 0.0f;
 float yBall = 0.0f;
 float zBall = 5.0f;
 
+//fixed timestep simulation, the rendering interpolates between the last two steps
+const double SIMULATION_STEP = 1.0 / 60.0;
+//longest frame fed to the simulation, so a stall does not trigger hundreds of catch-up steps
+const double MAX_FRAME_TIME = 0.25;
+struct SimulationState {
+    glm::vec3 cameraPosition;
+    glm::vec3 ballPosition;
+    float anglePlane;
+    float angleDog;
+};
+SimulationState previousState;
+SimulationState currentState;
+SimulationState renderState;
+double simulationAccumulator = 0.0;
+bool vsyncEnabled = true;
+
+//headless benchmark mode, renders a scripted camera path into an offscreen framebuffer
+bool headlessMode = false;
+int headlessFrames = 1000;
+int headlessWarmupFrames = 30;
+
+//input tracks, recorded in interactive sessions and replayed by the headless benchmark
+gps::InputRecorder inputRecorder;
+std::string recordFileName;
+std::string replayFileName;
+std::string resultsFileName;
+//times the OBJ parsers on the scene assets and exits
+bool objBenchmark = false;
+//large OBJ file the parser scaling is also measured on
+std::string objBenchmarkFileName;
+//asset pack mounted at startup, and the one --build-pack writes before exiting
+std::string packFileName;
+std::string buildPackFileName;
+//the pack opened, the assets are read from it rather than from the files
+bool packMounted = false;
+//fixed simulation steps run so far, input events are stamped with it
+int simulationTicks = 0;
+
+//render statistics shown in the window title and logged periodically
+const double STATS_OVERLAY_INTERVAL = 0.25;
+const double STATS_LOG_INTERVAL = 2.0;
+double lastStatsOverlay = 0.0;
+double lastStatsLog = 0.0;
+int statsOverlayFrames = 0;
+
 GLenum glCheckError_(const char *file, int line)
 {
 	GLenum errorCode;
@@ -143,21 +337,76 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
 	//TODO	
 
     glfwGetFramebufferSize(window, &retina_width, &retina_height);
+    myWindow.setWindowDimensions({ retina_width, retina_height });
 
-    myBasicShader.useShaderProgram();
-
+    //shared with the programs through the per-frame uniform buffer
     projection = glm::perspective(glm::radians(45.0f), (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
     glViewport(0, 0, retina_width, retina_height);
 }
 
+void initPointLights() {
+    pointLights.clear();
+
+    //street lamp
+    gps::PointLight lampLight;
+    lampLight.position = glm::vec3(-0.75f, 3.0f, 8.0f);
+    lampLight.radius = 8.0f;
+    lampLight.color = glm::vec3(4.0f, 3.4f, 2.6f);
+    lampLight.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    lampLight.spotOuterCos = -1.0f;
+    lampLight.spotInnerCos = -1.0f;
+    pointLights.push_back(lampLight);
+
+    if (!showTestLights)
+        return;
+
+    //a grid of small colored lights over the whole park, to stress the clustered shading
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < 16; j++) {
+            gps::PointLight light;
+            light.position = glm::vec3(-9.0f + 18.0f * i / 15.0f, 0.6f, -9.0f + 18.0f * j / 15.0f);
+            light.radius = 2.0f;
+            float hue = (float)(i * 16 + j) / 256.0f * 6.2831853f;
+            light.color = 1.5f * glm::vec3(0.5f + 0.5f * cos(hue), 0.5f + 0.5f * cos(hue + 2.094f), 0.5f + 0.5f * cos(hue + 4.189f));
+            light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+            //every other light is a spot light pointing down
+            if ((i + j) % 2 == 0) {
+                light.spotOuterCos = cos(glm::radians(40.0f));
+                light.spotInnerCos = cos(glm::radians(25.0f));
+            }
+            else {
+                light.spotOuterCos = -1.0f;
+                light.spotInnerCos = -1.0f;
+            }
+            pointLights.push_back(light);
+        }
+    }
+}
+
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
-	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+    inputRecorder.RecordKey(simulationTicks, key, action);
+
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS && !myWindow.isHeadless()) {
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+    if (key == GLFW_KEY_V && action == GLFW_PRESS && !myWindow.isHeadless()) {
+        vsyncEnabled = !vsyncEnabled;
+        glfwSwapInterval(vsyncEnabled ? 1 : 0);
+        std::cout << "VSync " << (vsyncEnabled ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        depthPrepassEnabled = !depthPrepassEnabled;
+        std::cout << "Depth pre-pass " << (depthPrepassEnabled ? "enabled" : "disabled") << std::endl;
+    }
+
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        showTestLights = !showTestLights;
+        initPointLights();
+    }
+
 	if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             pressedKeys[key] = true;
@@ -168,7 +417,8 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 }
 
 void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
-    //TODO
+    inputRecorder.RecordMouse(simulationTicks, xpos, ypos);
+
     if (firstMouse)
     {
         lastX = xpos;
@@ -193,50 +443,29 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
         pitch = -89.0f;
     myCamera.rotate(pitch, yaw);
     view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+}
+
+void updateLightDir() {
+    //rotate the initial light direction around the y axis
+    //the eye space direction sent to the shader is refreshed every frame in renderScene()
+    lightDir = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(0.0f, 1.0f, 1.0f, 0.0f));
 }
 
 void processMovement() {
 	if (pressedKeys[GLFW_KEY_W]) {
 		myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
-		//update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
 	}
 
 	if (pressedKeys[GLFW_KEY_S]) {
 		myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
 	}
 
 	if (pressedKeys[GLFW_KEY_A]) {
 		myCamera.move(gps::MOVE_LEFT, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
 	}
 
 	if (pressedKeys[GLFW_KEY_D]) {
 		myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
 	}
 
     if (pressedKeys[GLFW_KEY_Q]) {
@@ -250,10 +479,22 @@ void processMovement() {
         // update normal matrix for teapot
         //normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
     }
+    if (pressedKeys[GLFW_KEY_J]) {
+        lightAngle -= 1.0f;
+        updateLightDir();
+    }
+
+    if (pressedKeys[GLFW_KEY_L]) {
+        lightAngle += 1.0f;
+        updateLightDir();
+    }
+
     if (pressedKeys[GLFW_KEY_R]) {
         xBall = 0.0f;
         yBall = 0.0f;
         zBall = 5.0f;
+        //teleport, do not interpolate from the old position
+        previousState.ballPosition = glm::vec3(xBall, yBall, zBall);
     }
     if (zBall >= -6.2f) {
         if (pressedKeys[GLFW_KEY_B]) {
@@ -264,7 +505,8 @@ void processMovement() {
     }
 }
 
-void initSkybox() {
+// the six faces of the default sky, in cube map order
+std::vector<const GLchar*> skyboxFaces() {
     std::vector<const GLchar*> faces;
  
     faces.push_back("skybox/cloudtop_rt.tga");
@@ -273,18 +515,33 @@ void initSkybox() {
     faces.push_back("skybox/cloudtop_dn.tga");
     faces.push_back("skybox/cloudtop_bk.tga");
     faces.push_back("skybox/cloudtop_ft.tga");
-    
-    mySkyBox.Load(faces);
+    return faces;
 }
 
-void initFBO() {
+void initSkybox() {
+    if (proceduralSky) {
+        mySkyBox.LoadProcedural();
+        return;
+    }
+
+    if (!skyboxFileName.empty()) {
+        if (mySkyBox.LoadKTX(skyboxFileName.c_str()))
+            return;
+        std::cerr << "Falling back to the default skybox faces" << std::endl;
+    }
+
+    mySkyBox.Load(skyboxFaces());
+}
+
+void initDepthMapFBO(GLuint* fbo, GLuint* texture) {
     //generate FBO ID
-    glGenFramebuffers(1, &shadowMapFBO);
+    glGenFramebuffers(1, fbo);
 
     //create depth texture for FBO
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    //both shadow maps use the same sized format so the static one can be blitted into the other
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
@@ -293,18 +550,26 @@ void initFBO() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, *texture, 0);
 
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+}
+
+void initFBO() {
+    initDepthMapFBO(&shadowMapFBO, &depthMapTexture);
+    initDepthMapFBO(&staticShadowMapFBO, &staticDepthMapTexture);
+    staticShadowsDirty = true;
 }
 
 void initOpenGLWindow() {
-    myWindow.Create(800, 600, "OpenGL Project Core");
-    
+    if (headlessMode)
+        myWindow.CreateHeadless(glWindowWidth, glWindowHeight);
+    else
+        myWindow.Create(glWindowWidth, glWindowHeight, "OpenGL Project Core");
 }
 
 void setWindowCallbacks() {
@@ -315,110 +580,489 @@ void setWindowCallbacks() {
 
     glfwMakeContextCurrent(myWindow.getWindow());
 
-    glfwSwapInterval(1);
+    glfwSwapInterval(vsyncEnabled ? 1 : 0);
 }
 
 void initOpenGLState() {
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
 	glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
 	glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
 	glEnable(GL_DEPTH_TEST); // enable depth-testing
 	glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // filter across cube map faces, the blurred environment levels need it
 	glEnable(GL_CULL_FACE); // cull face
 	glCullFace(GL_BACK); // cull back face
 	glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 }
 
+// seconds since an arbitrary point, also available without GLFW in headless mode
+double getTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// projects the sky into spherical harmonics once, the shaders evaluate them per pixel
+void initAmbientLight() {
+    ambientLight = gps::SphericalHarmonics();
+    if (mySkyBox.GetEnvironmentMapId() == 0) {
+        //the procedural sky has no cube map to project, keep the flat ambient
+        ambientLight.coefficients[0] = glm::vec3(ambientStrength);
+        return;
+    }
+
+    double start = getTime();
+    gps::SphericalHarmonics sky;
+    //level 0 of the environment map is the unblurred sky, already linear
+    sky.ProjectCubeMap(mySkyBox.GetEnvironmentMapId(), 0);
+    ambientLight = sky.getIrradiance();
+
+    //the sky texture is not calibrated against the sun: keep its colors and directions but
+    //scale it to the mean brightness the materials were tuned with
+    float mean = glm::dot(ambientLight.coefficients[0], glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    if (mean > 0.0f)
+        for (int i = 0; i < gps::SphericalHarmonics::COEFFICIENT_COUNT; i++)
+            ambientLight.coefficients[i] *= ambientStrength / mean;
+
+    printf("ambient light projected from the sky in %.2f ms\n", (getTime() - start) * 1000.0);
+}
+
+struct ModelFile {
+    int* model;
+    const char* fileName;
+};
+
+// every model of the scene and the file it is loaded from
+std::vector<ModelFile> modelFiles() {
+    return {
+        { &teapot, "models/teapot/teapot20segUT.obj" },
+        { &dog, "models/12228_Dog_v1_L2.obj" },
+        { &trashbin, "models/bin/bin.obj" },
+        { &ground, "models/ground/ground.obj" },
+        { &goal, "models/FootballGoal/football_goal.obj" },
+        { &plane, "models/airplane/11805_airplane_v2_L2.obj" },
+        { &lamp, "models/street_lamp_obj/street_lamp.obj" },
+        { &ball, "models/soccerb/football-obj.obj" },
+        { &sidewalk, "models/sidewalk/untitled.obj" },
+        { &fence, "models/fence/fence_wood.obj" },
+        { &bush, "models/plant1/plant_combined.obj" },
+        { &tree, "models/TreeOBJ/TreeOBJ.obj" },
+        { &doghut, "models/doghut/doghouse0908.obj" },
+        { &bench, "models/bench/bench.obj" }
+    };
+}
+
+// only registers the models, each one is loaded the first frame it can be seen
 void initModels() {
- 
-    teapot.LoadModel("models/teapot/teapot20segUT.obj");
-    dog.LoadModel("models/12228_Dog_v1_L2.obj");
-    trashbin.LoadModel("models/bin/bin.obj");
-    ground.LoadModel("models/ground/ground.obj");
-    goal.LoadModel("models/FootballGoal/football_goal.obj");
-    plane.LoadModel("models/airplane/11805_airplane_v2_L2.obj");
-    lamp.LoadModel("models/street_lamp_obj/street_lamp.obj");
-    ball.LoadModel("models/soccerb/football-obj.obj");
-    sidewalk.LoadModel("models/sidewalk/untitled.obj");
-    fence.LoadModel("models/fence/fence_wood.obj");
-    bush.LoadModel("models/plant1/plant_combined.obj");
-    tree.LoadModel("models/TreeOBJ/TreeOBJ.obj");
-    doghut.LoadModel("models/doghut/doghouse0908.obj");
-    bench.LoadModel("models/bench/bench.obj");
+    //benchmark frames have to be the same on every run, they wait for their models
+    modelManager.setSynchronous(headlessMode);
+    modelManager.setBudgets(modelGpuBudget, modelHostBudget);
+    modelManager.Init();
+
+    std::vector<ModelFile> files = modelFiles();
+    for (size_t i = 0; i < files.size(); i++)
+        *files[i].model = modelManager.Register(files[i].fileName);
+}
+
+std::string basePathOf(const std::string& fileName) {
+    size_t slash = fileName.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : fileName.substr(0, slash + 1);
+}
+
+// parses one file with tinyobj and with gps::ObjParser, best of a few runs each
+void benchmarkObjFile(const std::string& fileName, double& tinyobjTotal, double& parserTotal, double& bytesTotal) {
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        printf("  %-44s missing\n", fileName.c_str());
+        return;
+    }
+    double bytes = (double)file.tellg();
+    std::string basePath = basePathOf(fileName);
+
+    const int RUNS = 3;
+    double tinyobjTime = 1e30, parserTime = 1e30;
+    size_t triangles = 0;
+    for (int run = 0; run < RUNS; run++) {
+        double start = getTime();
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+        tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true);
+        tinyobjTime = std::min(tinyobjTime, getTime() - start);
+
+        start = getTime();
+        gps::ObjParser parser;
+        parser.Parse(fileName, basePath);
+        parserTime = std::min(parserTime, getTime() - start);
+
+        triangles = 0;
+        for (size_t s = 0; s < parser.shapes.size(); s++)
+            triangles += parser.shapes[s].indices.size() / 3;
+    }
+
+    printf("  %-44s %8.2f MB %9zu tris  tinyobj %8.2f ms %7.1f MB/s  parser %8.2f ms %7.1f MB/s  %5.2fx\n",
+        fileName.c_str(), bytes / 1e6, triangles,
+        tinyobjTime * 1000.0, bytes / 1e6 / tinyobjTime, parserTime * 1000.0, bytes / 1e6 / parserTime, tinyobjTime / parserTime);
+    tinyobjTotal += tinyobjTime;
+    parserTotal += parserTime;
+    bytesTotal += bytes;
+}
+
+// parse time of one file from a single thread up to every core, best of 3 runs each
+void benchmarkObjScaling(const std::string& fileName) {
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        printf("%s missing\n", fileName.c_str());
+        return;
+    }
+    double bytes = (double)file.tellg();
+    std::string basePath = basePathOf(fileName);
+
+    int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < cores; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(cores);
+
+    printf("scaling on %s, %.2f MB (scan and resolve run on every thread, the merge is serial)\n", fileName.c_str(), bytes / 1e6);
+    double singleThreadTime = 0.0;
+    for (size_t i = 0; i < threadCounts.size(); i++) {
+        double best = 1e30;
+        gps::ObjParser::Stats stats = {};
+        for (int run = 0; run < 3; run++) {
+            double start = getTime();
+            gps::ObjParser parser;
+            parser.Parse(fileName, basePath, threadCounts[i]);
+            double time = getTime() - start;
+            if (time < best) {
+                best = time;
+                stats = parser.stats;
+            }
+        }
+        if (i == 0)
+            singleThreadTime = best;
+        printf("  %3d threads %3d chunks %9.2f ms %8.1f MB/s %5.2fx  scan %8.2f resolve %8.2f merge %8.2f ms\n",
+            threadCounts[i], stats.chunks, best * 1000.0, bytes / 1e6 / best, singleThreadTime / best,
+            stats.scanSeconds * 1000.0, stats.resolveSeconds * 1000.0, stats.mergeSeconds * 1000.0);
+    }
+}
+
+// --obj-benchmark: load times of the scene assets and of a large generated grid, no window is opened
+void runObjBenchmark() {
+    std::vector<std::string> fileNames;
+    std::vector<ModelFile> files = modelFiles();
+    for (size_t i = 0; i < files.size(); i++)
+        fileNames.push_back(files[i].fileName);
+
+    //a 700x700 quad grid with positions, texture coordinates and normals, about 82 MB
+    const char* gridFileName = "obj_benchmark_grid.obj";
+    FILE* grid = fopen(gridFileName, "w");
+    if (grid != NULL) {
+        const int N = 700;
+        for (int z = 0; z <= N; z++)
+            for (int x = 0; x <= N; x++)
+                fprintf(grid, "v %f %f %f\nvt %f %f\nvn %f %f %f\n", (float)x, sinf(x * 0.1f) * cosf(z * 0.1f), (float)z,
+                    (float)x / N, (float)z / N, 0.0f, 1.0f, 0.0f);
+        for (int z = 0; z < N; z++)
+            for (int x = 0; x < N; x++) {
+                int a = z * (N + 1) + x + 1, b = a + 1, c = a + N + 2, d = a + N + 1;
+                fprintf(grid, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, d, d, d, c, c, c, b, b, b);
+            }
+        fclose(grid);
+        fileNames.push_back(gridFileName);
+    }
+
+    printf("OBJ load times, best of 3 runs\n");
+    double tinyobjTotal = 0.0, parserTotal = 0.0, bytesTotal = 0.0;
+    for (size_t i = 0; i < fileNames.size(); i++)
+        benchmarkObjFile(fileNames[i], tinyobjTotal, parserTotal, bytesTotal);
+    if (parserTotal > 0.0)
+        printf("total %.2f MB: tinyobj %.2f ms, parser %.2f ms, %.2fx faster\n",
+            bytesTotal / 1e6, tinyobjTotal * 1000.0, parserTotal * 1000.0, tinyobjTotal / parserTotal);
+
+    if (grid != NULL)
+        benchmarkObjScaling(gridFileName);
+    if (!objBenchmarkFileName.empty())
+        benchmarkObjScaling(objBenchmarkFileName);
+
+    remove(gridFileName);
+}
+
+// reads a whole file into a new entry of the asset pack, named by its path
+bool addPackFile(std::vector<gps::AssetPack::Entry>& entries, const std::string& fileName) {
+    for (size_t i = 0; i < entries.size(); i++)
+        if (entries[i].name == fileName)
+            return true;
+
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "  " << fileName << " missing" << std::endl;
+        return false;
+    }
+    gps::AssetPack::Entry entry;
+    entry.name = fileName;
+    entry.data.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    entries.push_back(entry);
+    return true;
+}
+
+// --build-pack: the models after the load pipeline, their textures, the skybox and every shader
+// source, in one file; textures keep their compressed file formats and are decoded from memory
+bool buildAssetPack(const std::string& fileName) {
+    double start = getTime();
+    std::vector<gps::AssetPack::Entry> entries;
+
+    std::vector<ModelFile> files = modelFiles();
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string basePath = basePathOf(files[i].fileName);
+        std::vector<gps::ObjShape> shapes;
+        std::vector<gps::ObjMaterial> materials;
+        if (!gps::Model3D::LoadShapes(files[i].fileName, basePath, shapes, materials)) {
+            std::cerr << "  " << files[i].fileName << " missing" << std::endl;
+            continue;
+        }
+
+        std::ostringstream data;
+        //the pack is rebuilt with the files, its entries are not checked against them
+        gps::ModelCache::SourceFile source = { files[i].fileName, 0, 0 };
+        gps::ModelCache::Write(data, shapes, materials, source, std::vector<gps::ModelCache::SourceFile>());
+        gps::AssetPack::Entry entry;
+        entry.name = files[i].fileName;
+        entry.data = data.str();
+        entries.push_back(entry);
+
+        for (size_t m = 0; m < materials.size(); m++) {
+            const std::string* textures[3] = { &materials[m].ambientTexture, &materials[m].diffuseTexture, &materials[m].specularTexture };
+            for (int t = 0; t < 3; t++)
+                if (!textures[t]->empty())
+                    addPackFile(entries, basePath + *textures[t]);
+        }
+    }
+
+    std::vector<const GLchar*> faces = skyboxFaces();
+    for (size_t i = 0; i < faces.size(); i++)
+        addPackFile(entries, faces[i]);
+    if (!skyboxFileName.empty())
+        addPackFile(entries, skyboxFileName);
+
+    //the whole directory, so the #include files come along
+    std::error_code error;
+    for (std::filesystem::directory_iterator shader("shaders", error), end; !error && shader != end; shader.increment(error))
+        if (shader->is_regular_file())
+            addPackFile(entries, "shaders/" + shader->path().filename().string());
+
+    //the cells of --world, they are read through the pack too
+    if (!worldDirectory.empty())
+        for (std::filesystem::directory_iterator cell(worldDirectory, error), end; !error && cell != end; cell.increment(error))
+            if (cell->is_regular_file())
+                addPackFile(entries, worldDirectory + "/" + cell->path().filename().string());
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+        bytes += entries[i].data.size();
+    if (!gps::AssetPack::Build(fileName, entries)) {
+        std::cerr << "Could not write the asset pack " << fileName << std::endl;
+        return false;
+    }
+    printf("asset pack %s: %zu entries, %.2f MB, built in %.2f s\n", fileName.c_str(), entries.size(), bytes / 1e6, getTime() - start);
+    return true;
+}
+
+// reports how long a program took to load, and what the binary cache saved
+void printShaderLoadTime(const char* name, const gps::Shader& shader) {
+    if (shader.loadedFromCache)
+        printf("shader %-14s %8.2f ms from cache (compiling took %.2f ms, saved %.2f ms)\n", name,
+            shader.loadMilliseconds, shader.cachedCompileMilliseconds,
+            shader.cachedCompileMilliseconds - shader.loadMilliseconds);
+    else
+        printf("shader %-14s %8.2f ms compiled\n", name, shader.loadMilliseconds);
 }
 
+// every program that is rebuilt when one of its files changes
+std::vector<gps::Shader*> reloadableShaders() {
+    return { &skyboxShader, &lightShader, &depthMapShader, &depthPrepassShader };
+}
+
+// the variant most of the scene is drawn with
+unsigned int prewarmedBasicFeatures() {
+    return BASIC_SHADER_ALL_FEATURES | (gpuCullingEnabled ? FEATURE_GPU_INSTANCES : 0);
+}
+
+// only issues the compiles, finishShaders() collects the programs once the models are loaded
 void initShaders() {
-    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
-    skyboxShader.useShaderProgram();
+    //with parallel compilation the driver builds the programs on its own threads meanwhile,
+    //without it the compiles still run back to back instead of waiting on each other
+    parallelShaderCompile = gps::Shader::enableParallelCompile();
+
+    std::vector<std::string> skyDefines;
+    if (proceduralSky)
+        skyDefines.push_back("PROCEDURAL_SKY");
+    skyboxShader.loadShaderAsync("shaders/skyboxShader.vert", "shaders/skyboxShader.frag", skyDefines);
+    cubemapPrefilterShader.loadShaderAsync("shaders/cubemapPrefilter.vert", "shaders/cubemapPrefilter.frag");
+    lightShader.loadShaderAsync("shaders/light.vert", "shaders/light.frag");
+    depthMapShader.loadShaderAsync("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
+    std::vector<std::string> prepassDefines;
+    if (gpuCullingEnabled) {
+        prepassDefines.push_back("GPU_INSTANCES");
+        gpuCulling.Init();
+    }
+    depthPrepassShader.loadShaderAsync("shaders/depthPrepass.vert", "shaders/depthPrepass.frag", prepassDefines);
 
-    lightShader.loadShader("shaders/light.vert", "shaders/light.frag");
-    lightShader.useShaderProgram();
+    //variants are compiled on demand, buildColorPassQueue() builds the ones the scene uses;
+    //textured shadow receivers are most of the scene, so that one starts with the others
+    basicShaderVariants.Init("shaders/basic.vert", "shaders/basic.frag",
+        { "DIFFUSE_TEXTURE", "SPECULAR_TEXTURE", "SHADOWS", "LOCAL_LIGHTS", "GPU_INSTANCES", "ALPHA_TEST" });
+    basicShaderVariants.Request(prewarmedBasicFeatures());
+}
 
-    depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMaoShader.frag");
-    depthMapShader.useShaderProgram();
-    
-    myBasicShader.loadShader("shaders/basic.vert", "shaders/basic.frag");
-    myBasicShader.useShaderProgram();
-    
+// back to the CPU culling path, before anything was drawn with the GPU one
+void disableGpuCulling() {
+    gpuCullingEnabled = false;
+    gpuCulling.Delete();
+    //the pre-pass program reads the instance buffer, the CPU path sets the model uniform
+    glDeleteProgram(depthPrepassShader.shaderProgram);
+    depthPrepassShader.loadShader("shaders/depthPrepass.vert", "shaders/depthPrepass.frag");
+    //the queue is rebuilt with one item per object
+    colorPassQueueVersion = ~0u;
+    basicShaderVariants.Get(prewarmedBasicFeatures());
+}
+
+void finishShaders() {
+    std::vector<gps::Shader*> shaders = reloadableShaders();
+    if (parallelShaderCompile) {
+        int completed = 0;
+        for (size_t i = 0; i < shaders.size(); i++)
+            if (shaders[i]->isLoadComplete())
+                completed++;
+        printf("shaders: %d of %d programs were ready after loading the models\n", completed, (int)shaders.size());
+    }
+
+    for (size_t i = 0; i < shaders.size(); i++)
+        shaders[i]->finishLoad();
+    cubemapPrefilterShader.finishLoad();
+    basicShaderVariants.Get(prewarmedBasicFeatures());
+    if (gpuCullingEnabled && !gpuCulling.FinishLoad()) {
+        std::cerr << "The GPU culling programs did not build, culling on the CPU" << std::endl;
+        disableGpuCulling();
+    }
+
+    printShaderLoadTime("skyboxShader", skyboxShader);
+    printShaderLoadTime("light", lightShader);
+    printShaderLoadTime("depthMapShader", depthMapShader);
+    printShaderLoadTime("depthPrepass", depthPrepassShader);
+}
+
+// uniform locations of every program, queried again whenever a program is rebuilt
+void initUniformLocations() {
+    //shadow mapping
+    lightSpaceTrMatrixLoc = glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix");
+    depthMapModelLoc = glGetUniformLocation(depthMapShader.shaderProgram, "model");
+
+    //depth pre-pass
+    depthPrepassModelLoc = glGetUniformLocation(depthPrepassShader.shaderProgram, "model");
+
+    std::vector<gps::Shader*> shaders = reloadableShaders();
+    for (size_t i = 0; i < shaders.size(); i++) {
+        frameUniforms.Attach(shaders[i]->shaderProgram);
+        if (gpuCullingEnabled)
+            gpuCulling.Attach(shaders[i]->shaderProgram);
+    }
 }
 
 void initUniforms() {
     
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    initUniformLocations();
 
-    projection = glm::perspective(glm::radians(45.0f), (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    
     // create model matrix for teapot
     model = glm::mat4(1.0f);
     //model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
     //model = glm::translate(model, glm::vec3(2, 0, 0));
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
 	// get view matrix for current camera
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-	// send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    // compute normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
 	// create projection matrix
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         // 0.1f, 20.0f);
         0.1f, 50.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-	// send projection matrix to shader
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
 
 	//set the light direction (direction towards the light)
+	lightAngle = 0.0f;
 	lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-	// send light dir to shader
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
 	//set light color
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-	// send light color to shader
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-    
-    /// ///////////////////////////////////////////////////////////////
-    
-    
+	//view, projection and light reach the shaders through updateFrameUniforms()
 }
 
+// registers the files of every program, the polling fallback of the watcher needs them
+void watchShaderFiles() {
+    std::vector<gps::Shader*> shaders = reloadableShaders();
+    for (size_t i = 0; i < shaders.size(); i++) {
+        std::vector<std::string> files = shaders[i]->getDependencies();
+        for (size_t j = 0; j < files.size(); j++)
+            shaderWatcher.AddFile(files[j]);
+    }
+
+    std::vector<std::string> files = basicShaderVariants.getDependencies();
+    for (size_t j = 0; j < files.size(); j++)
+        shaderWatcher.AddFile(files[j]);
+
+    if (gpuCullingEnabled) {
+        files = gpuCulling.getDependencies();
+        for (size_t j = 0; j < files.size(); j++)
+            shaderWatcher.AddFile(files[j]);
+    }
+}
+
+// a failed rebuild keeps the previous program, so a typo never takes the scene down
+void reloadChangedShaders() {
+    std::vector<std::string> changed = shaderWatcher.Poll();
+    if (changed.empty())
+        return;
+
+    bool reloaded = false;
+    std::vector<gps::Shader*> shaders = reloadableShaders();
+    for (size_t i = 0; i < shaders.size(); i++)
+        for (size_t j = 0; j < changed.size(); j++)
+            if (shaders[i]->dependsOn(changed[j])) {
+                if (shaders[i]->reload()) {
+                    printf("reloaded %s in %.2f ms\n", changed[j].c_str(), shaders[i]->loadMilliseconds);
+                    reloaded = true;
+                }
+                break;
+            }
+
+    for (size_t j = 0; j < changed.size(); j++)
+        if (basicShaderVariants.ReloadChanged(changed[j])) {
+            printf("reloaded %s in %d basic shader variants\n", changed[j].c_str(), basicShaderVariants.getVariantCount());
+            colorPassUniforms.clear();
+        }
+
+    if (gpuCullingEnabled)
+        for (size_t j = 0; j < changed.size(); j++)
+            if (gpuCulling.ReloadChanged(changed[j]))
+                printf("reloaded %s in the GPU culling programs\n", changed[j].c_str());
+
+    //the new programs start with default uniform values and new locations
+    if (reloaded)
+        initUniformLocations();
+
+    //new files pulled in through #include
+    watchShaderFiles();
+}
+
+
+
 glm::mat4 computeLightSpaceTrMatrix() {
     //TODO - Return the light-space transformation matrix
    // glm::mat4 lightView = glm::lookAt(glm::mat3(lightRotation) * lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 lightView = glm::lookAt( lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    //the park spans roughly [-10, 10] on x and z, the light volume has to enclose all of it
+    glm::mat4 lightView = glm::lookAt(20.0f * glm::normalize(lightDir), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-    const GLfloat near_plane = 0.1f, far_plane = 5.0f;
-    glm::mat4 lightProjection = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, near_plane, far_plane);
+    const GLfloat near_plane = 0.1f, far_plane = 45.0f;
+    glm::mat4 lightProjection = glm::ortho(-16.0f, 16.0f, -16.0f, 16.0f, near_plane, far_plane);
 
     glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
     return lightSpaceTrMatrix;
@@ -430,340 +1074,1095 @@ void ballAnimation(float* x, float* y, float* z) {
     *z -= 0.03f;
 }
 
-void renderScene() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    myBasicShader.useShaderProgram();
-
-    //dog
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.0f, 7.0f));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    model = glm::rotate(model, glm::radians(5.0f), glm::vec3(1, 0, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    dog.Draw(myBasicShader);
+void addStaticObject(int model, glm::mat4 objectModel) {
+    SceneObject sceneObject;
+    sceneObject.model = model;
+    sceneObject.transform = transforms.AddInstance(objectModel, true);
+    sceneObject.receivesShadows = true;
+    staticObjects.push_back(sceneObject);
+}
 
+int addDynamicObject(int model) {
+    SceneObject sceneObject;
+    sceneObject.model = model;
+    sceneObject.transform = transforms.AddInstance(glm::mat4(1.0f), false);
+    sceneObject.receivesShadows = true;
+    dynamicObjects.push_back(sceneObject);
+    return sceneObject.transform;
+}
 
+void initStaticObjects() {
     //goal
     model = glm::translate(glm::mat4(1.0f), glm::vec3(2.5f, -0.05f, -7.0f));
     model = glm::scale(model, glm::vec3(0.01, 0.01, 0.01));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    goal.Draw(myBasicShader);
+    addStaticObject(goal, model);
 
 
     //ground
     model = glm::mat4(1.0f);
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    ground.Draw(myBasicShader);
-
-    //plane
-    model = glm::mat4(1.0f);   
-    model = glm::rotate(model, glm::radians(anglePlane), glm::vec3(0, 1, 0));
-    model = glm::translate(model, glm::vec3(0, 10, 10));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 0, 1));
-    model = glm::rotate(model, glm::radians(-20.0f), glm::vec3(0, 1, 0));
-    model = glm::scale(model, glm::vec3(0.003f, 0.003f, 0.003f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    plane.Draw(myBasicShader);
-    anglePlane += 0.1f;
+    addStaticObject(ground, model);
 
     //lamp
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-0.75f, 0.0f,8.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
     model = glm::scale(model, glm::vec3(1.0f, 1.5f, 1.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    lamp.Draw(myBasicShader);
-
-    //ball
-    //pozitie initiala 0.0 0.0 5.0
-    //pozitie2 1.5 1.6 -6.2
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(xBall, yBall, zBall));
-    model = glm::scale(model, glm::vec3(0.0035f, 0.0035f, 0.0035f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    ball.Draw(myBasicShader);
-    if(zBall < -6.2f)
-        if(zBall >= -7.7f)
-            ballAnimation(&xBall, &yBall, &zBall);
+    addStaticObject(lamp, model);
 
     //sidewalk
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(6.5f, 0.0f, -1.5f));
     model = glm::scale(model, glm::vec3(2.0f, 1.0f, 1.7f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    sidewalk.Draw(myBasicShader);
+    addStaticObject(sidewalk, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-6.5f, 0.0f, 1.5f));
     model = glm::scale(model, glm::vec3(2.0f, 1.0f, 1.7f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    sidewalk.Draw(myBasicShader);
+    addStaticObject(sidewalk, model);
 
     //fence
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(3.5f, 0.0f, -7.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-3.8f, 0.0f, -7.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, -6.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, -6.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, -4.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, -4.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, -3.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, -1.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 0.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 4.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 5.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 7.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 8.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, -3.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, -1.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, 0.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, 4.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, 5.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, 7.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(4.85f, 0.0f, 8.5f));
     model = glm::scale(model, glm::vec3(1.3f, 1.0f, 1.0f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    fence.Draw(myBasicShader);
+    addStaticObject(fence, model);
     
     //bush
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(9.0f, 0.0f, -6.0f));
     model = glm::scale(model, glm::vec3(0.08f, 0.08f, 0.08f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    bush.Draw(myBasicShader);
+    addStaticObject(bush, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-9.0f, 0.0f, -6.0f));
     model = glm::scale(model, glm::vec3(0.08f, 0.08f, 0.08f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    bush.Draw(myBasicShader);
+    addStaticObject(bush, model);
 
     //trees
     model = glm::mat4(1.0f);
     model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, -0.05f, -9.0f));
     model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    tree.Draw(myBasicShader);
+    addStaticObject(tree, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(glm::mat4(1.0f), glm::vec3(9.0f, 0.0f, 4.5f));
     model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    tree.Draw(myBasicShader);
+    addStaticObject(tree, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-9.0f, 0.0f, 4.5f));
     model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    tree.Draw(myBasicShader);
+    addStaticObject(tree, model);
 
     //doghut
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(3.5f, 0.0f, 8.0f));
     model = glm::scale(model, glm::vec3(1.3f, 1.3f, 1.3f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    doghut.Draw(myBasicShader);
+    addStaticObject(doghut, model);
 
     //bench
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(1.0f, 0.0f, 8.0f));
     model = glm::scale(model, glm::vec3(1.5f, 1.5f, 1.5f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    bench.Draw(myBasicShader);
+    addStaticObject(bench, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-2.5f, 0.0f, 8.0f));
     model = glm::scale(model, glm::vec3(1.5f, 1.5f, 1.5f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    bench.Draw(myBasicShader);
+    addStaticObject(bench, model);
 
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-4.0f, 0.0f, 5.0f));
     model = glm::scale(model, glm::vec3(1.5f, 1.5f, 1.5f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    bench.Draw(myBasicShader);
+    addStaticObject(bench, model);
 
     //trash
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(-4.5f, 0.0f, 0.0f));
     model = glm::scale(model, glm::vec3(1.5f, 1.5f, 1.5f));
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0, 1, 0));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    trashbin.Draw(myBasicShader);
+    addStaticObject(trashbin, model);
+}
 
-    mySkyBox.Draw(skyboxShader, view, projection);
-    
+void initDynamicObjects() {
+    //moving objects, placed every frame by updateDynamicTransforms()
+    dogTransform = addDynamicObject(dog);
+    planeTransform = addDynamicObject(plane);
+    //nothing flies above the plane, it can skip the shadow lookup
+    dynamicObjects.back().receivesShadows = false;
+    ballTransform = addDynamicObject(ball);
+}
+
+void addMeshesToColorPassQueue(gps::Model3D* object, bool receivesShadows, int transform, int batch) {
+    for (size_t m = 0; m < object->getMeshCount(); m++) {
+        gps::Mesh& mesh = object->getMesh(m);
+
+        ColorPassItem item;
+        item.features = FEATURE_LOCAL_LIGHTS;
+        if (mesh.hasTexture("diffuseTexture"))
+            item.features |= FEATURE_DIFFUSE_TEXTURE;
+        if (mesh.hasTexture("specularTexture"))
+            item.features |= FEATURE_SPECULAR_TEXTURE;
+        if (mesh.isAlphaTested())
+            item.features |= FEATURE_ALPHA_TEST;
+        if (receivesShadows)
+            item.features |= FEATURE_SHADOWS;
+        if (batch >= 0)
+            item.features |= FEATURE_GPU_INSTANCES;
+        item.object = object;
+        item.mesh = m;
+        item.transform = transform;
+        item.batch = batch;
+        colorPassQueue.push_back(item);
+    }
+}
+
+void addToColorPassQueue(const SceneObject& sceneObject) {
+    gps::Model3D* object = modelManager.getModel(sceneObject.model);
+    if (object == NULL)
+        return;
+    addMeshesToColorPassQueue(object, sceneObject.receivesShadows, sceneObject.transform, -1);
+}
+
+// one GPU culling batch per uploaded model and shadow setting, queued once per mesh however
+// many objects use the model
+void addBatchesToColorPassQueue() {
+    std::map<std::pair<int, bool>, int> batches;
+    gpuCulling.BeginBatches();
+    for (int list = 0; list < 2; list++) {
+        const std::vector<SceneObject>& objects = list == 0 ? staticObjects : dynamicObjects;
+        for (size_t i = 0; i < objects.size(); i++) {
+            gps::Model3D* object = modelManager.getModel(objects[i].model);
+            glm::vec3 boundsMin, boundsMax;
+            if (object == NULL || !modelManager.getBounds(objects[i].model, boundsMin, boundsMax))
+                continue;
+
+            std::pair<int, bool> key(objects[i].model, objects[i].receivesShadows);
+            std::map<std::pair<int, bool>, int>::iterator found = batches.find(key);
+            if (found == batches.end()) {
+                found = batches.insert(std::make_pair(key, gpuCulling.AddBatch(object, boundsMin, boundsMax))).first;
+                addMeshesToColorPassQueue(object, objects[i].receivesShadows, -1, found->second);
+            }
+            gpuCulling.AddInstance(found->second, objects[i].transform);
+        }
+    }
+    gpuCulling.EndBatches(transforms);
+}
+
+// the materials never change, so the queue is only rebuilt when models are uploaded or evicted
+void buildColorPassQueue() {
+    colorPassQueue.clear();
+    colorPassQueueVersion = modelManager.getResidencyVersion();
+    colorPassQueueStaticVersion = staticObjectsVersion;
+    if (gpuCullingEnabled) {
+        addBatchesToColorPassQueue();
+    } else {
+        for (size_t i = 0; i < staticObjects.size(); i++)
+            addToColorPassQueue(staticObjects[i]);
+        for (size_t i = 0; i < dynamicObjects.size(); i++)
+            addToColorPassQueue(dynamicObjects[i]);
+    }
+
+    std::stable_sort(colorPassQueue.begin(), colorPassQueue.end(),
+        [](const ColorPassItem& a, const ColorPassItem& b) { return a.features < b.features; });
+
+    //compile the variants of new materials before drawing with them, all of them are issued
+    //before waiting for any
+    for (size_t i = 0; i < colorPassQueue.size(); i++)
+        basicShaderVariants.Request(colorPassQueue[i].features);
+    for (size_t i = 0; i < colorPassQueue.size(); i++)
+        basicShaderVariants.Get(colorPassQueue[i].features);
+}
+
+void drawObject(const SceneObject& sceneObject, gps::Shader shader, RenderPass pass) {
+    //not loaded yet, or evicted
+    gps::Model3D* object = modelManager.getModel(sceneObject.model);
+    if (object == NULL)
+        return;
+    glm::mat4 objectModel = transforms.getWorld(sceneObject.transform);
+
+    switch (pass) {
+    case SHADOW_PASS:
+        glUniformMatrix4fv(depthMapModelLoc, 1, GL_FALSE, glm::value_ptr(objectModel));
+        gps::RenderStats::AddUniformUploads(1);
+        object->DrawDepth(shader);
+        break;
+
+    case DEPTH_PREPASS:
+        if (!visibleInstances[sceneObject.transform])
+            break;
+        glUniformMatrix4fv(depthPrepassModelLoc, 1, GL_FALSE, glm::value_ptr(objectModel));
+        gps::RenderStats::AddUniformUploads(1);
+        //alpha tested meshes would write depth for their transparent texels, the color pass
+        //tests and writes their depth itself
+        for (size_t m = 0; m < object->getMeshCount(); m++)
+            if (!object->getMesh(m).isAlphaTested())
+                object->getMesh(m).DrawDepth(shader);
+        break;
+    }
+}
+
+// static objects never move, their model matrices are computed once when they are added
+void drawStaticObjects(gps::Shader shader, RenderPass pass) {
+    for (size_t i = 0; i < staticObjects.size(); i++)
+        drawObject(staticObjects[i], shader, pass);
+}
+
+// the dog, the plane and the ball are re-placed every frame
+void drawDynamicObjects(gps::Shader shader, RenderPass pass) {
+    for (size_t i = 0; i < dynamicObjects.size(); i++)
+        drawObject(dynamicObjects[i], shader, pass);
+}
+
+// frustum test of the objects; the models of the ones in view or casting shadows into it are
+// kept loaded, only the ones in view are drawn in the camera passes
+void cullObjects(const std::vector<SceneObject>& objects) {
+    for (size_t i = 0; i < objects.size(); i++) {
+        const SceneObject& sceneObject = objects[i];
+        glm::mat4 objectModel = transforms.getWorld(sceneObject.transform);
+        glm::vec3 boundsMin, boundsMax;
+        //a model never loaded has no bounds yet, it has to be loaded to find out
+        bool boundsKnown = modelManager.getBounds(sceneObject.model, boundsMin, boundsMax);
+        bool inView = !boundsKnown || viewFrustum.IntersectsBox(boundsMin, boundsMax, objectModel);
+        bool castsShadow = !boundsKnown || shadowFrustum.IntersectsBox(boundsMin, boundsMax, objectModel);
+
+        if (inView || castsShadow)
+            modelManager.MarkVisible(sceneObject.model);
+        else
+            //placed in the loaded part of the scene, it may come into view soon
+            modelManager.Prefetch(sceneObject.model);
+        visibleInstances[sceneObject.transform] = inView;
+    }
+}
+
+// world space bounding box of an object space box placed by the world matrix
+void transformBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& world, glm::vec3& worldMin, glm::vec3& worldMax) {
+    glm::vec3 center = glm::vec3(world * glm::vec4((boxMin + boxMax) * 0.5f, 1.0f));
+    glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+    glm::vec3 worldExtent = glm::abs(glm::vec3(world[0])) * extent.x + glm::abs(glm::vec3(world[1])) * extent.y
+        + glm::abs(glm::vec3(world[2])) * extent.z;
+    worldMin = center - worldExtent;
+    worldMax = center + worldExtent;
+}
+
+// only when the static objects change or a model is loaded, which is when its bounds become known
+void buildResidencyGroups() {
+    residencyGroups.clear();
+    residencyGroupsVersion = modelManager.getResidencyVersion();
+    residencyGroupsStaticVersion = staticObjectsVersion;
+
+    std::map<std::pair<int, std::pair<int, int> >, size_t> groups;
+    for (size_t i = 0; i < staticObjects.size(); i++) {
+        glm::mat4 world = transforms.getWorld(staticObjects[i].transform);
+        std::pair<int, int> cell((int)std::floor(world[3].x / WORLD_CELL_SIZE), (int)std::floor(world[3].z / WORLD_CELL_SIZE));
+        std::pair<int, std::pair<int, int> > key(staticObjects[i].model, cell);
+
+        glm::vec3 boundsMin, boundsMax, worldMin, worldMax;
+        bool boundsKnown = modelManager.getBounds(staticObjects[i].model, boundsMin, boundsMax);
+        if (boundsKnown)
+            transformBox(boundsMin, boundsMax, world, worldMin, worldMax);
+
+        std::map<std::pair<int, std::pair<int, int> >, size_t>::iterator found = groups.find(key);
+        if (found == groups.end()) {
+            groups[key] = residencyGroups.size();
+            ResidencyGroup group = { staticObjects[i].model, boundsKnown, worldMin, worldMax };
+            residencyGroups.push_back(group);
+        } else if (boundsKnown) {
+            ResidencyGroup& group = residencyGroups[found->second];
+            group.boundsMin = glm::min(group.boundsMin, worldMin);
+            group.boundsMax = glm::max(group.boundsMax, worldMax);
+        }
+    }
+}
+
+// cullObjects() for the residency groups; what is drawn is decided by the GPU
+void cullResidencyGroups() {
+    for (size_t i = 0; i < residencyGroups.size(); i++) {
+        const ResidencyGroup& group = residencyGroups[i];
+        bool inView = !group.boundsKnown || viewFrustum.IntersectsBox(group.boundsMin, group.boundsMax);
+        bool castsShadow = !group.boundsKnown || shadowFrustum.IntersectsBox(group.boundsMin, group.boundsMax);
+        if (inView || castsShadow)
+            modelManager.MarkVisible(group.model);
+        else
+            modelManager.Prefetch(group.model);
+    }
+}
+
+void updateVisibility() {
+    viewFrustum.Update(projection * view);
+    shadowFrustum.Update(lightSpaceTrMatrix);
+    //only the entries of culled objects are read, each of them is written below
+    visibleInstances.resize(transforms.getInstanceCount());
+    if (gpuCullingEnabled) {
+        if (modelManager.getResidencyVersion() != residencyGroupsVersion || staticObjectsVersion != residencyGroupsStaticVersion)
+            buildResidencyGroups();
+        cullResidencyGroups();
+    } else {
+        cullObjects(staticObjects);
+    }
+    //a few objects, each moves on its own
+    cullObjects(dynamicObjects);
+
+    modelManager.Update();
+    if (modelManager.getResidencyVersion() != colorPassQueueVersion || staticObjectsVersion != colorPassQueueStaticVersion) {
+        buildColorPassQueue();
+        //the cached static shadow casters changed too
+        staticShadowsDirty = true;
+    }
+}
+
+// places and removes the cells around the camera, their objects are the static objects of a
+// streamed world; before the transforms are updated, so the new instances get their matrices
+void updateWorldStreaming() {
+    if (worldDirectory.empty())
+        return;
+
+    glm::vec3 cameraVelocity = (currentState.cameraPosition - previousState.cameraPosition) / (float)SIMULATION_STEP;
+    worldGrid.Update(renderState.cameraPosition, cameraVelocity, myCamera.getFrontDirection(), modelManager, transforms);
+    if (worldGrid.getVersion() == staticObjectsVersion)
+        return;
+
+    staticObjects.clear();
+    const std::vector<gps::WorldGrid::Object>& objects = worldGrid.getObjects();
+    for (size_t i = 0; i < objects.size(); i++) {
+        SceneObject sceneObject;
+        sceneObject.model = objects[i].model;
+        sceneObject.transform = objects[i].transform;
+        sceneObject.receivesShadows = true;
+        staticObjects.push_back(sceneObject);
+    }
+    staticObjectsVersion = worldGrid.getVersion();
+}
+
+// --export-world: the static objects of the park as cell files, for --world
+bool exportWorld(const std::string& directory) {
+    initModels();
+    initStaticObjects();
+
+    std::vector<gps::WorldGrid::Placement> placements;
+    for (size_t i = 0; i < staticObjects.size(); i++) {
+        gps::WorldGrid::Placement placement;
+        placement.fileName = modelManager.getFileName(staticObjects[i].model);
+        placement.world = transforms.getWorld(staticObjects[i].transform);
+        placements.push_back(placement);
+    }
+
+    if (!gps::WorldGrid::Export(directory, WORLD_CELL_SIZE, placements)) {
+        std::cerr << "Could not write the world cells to " << directory << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << placements.size() << " objects as cells of " << WORLD_CELL_SIZE << " units to " << directory << std::endl;
+    return true;
+}
+
+void updateDynamicTransforms() {
+    //dog
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.0f, 7.0f));
+    model = glm::rotate(model, glm::radians(-90.0f + renderState.angleDog), glm::vec3(0, 1, 0));
+    model = glm::rotate(model, glm::radians(5.0f), glm::vec3(1, 0, 0));
+    transforms.SetWorld(dogTransform, model);
+
+    //plane
+    model = glm::mat4(1.0f);   
+    model = glm::rotate(model, glm::radians(renderState.anglePlane), glm::vec3(0, 1, 0));
+    model = glm::translate(model, glm::vec3(0, 10, 10));
+    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1, 0, 0));
+    model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0, 0, 1));
+    model = glm::rotate(model, glm::radians(-20.0f), glm::vec3(0, 1, 0));
+    model = glm::scale(model, glm::vec3(0.003f, 0.003f, 0.003f));
+    transforms.SetWorld(planeTransform, model);
+
+    //ball
+    //pozitie initiala 0.0 0.0 5.0
+    //pozitie2 1.5 1.6 -6.2
+    model = glm::mat4(1.0f);
+    model = glm::translate(model, renderState.ballPosition);
+    model = glm::scale(model, glm::vec3(0.0035f, 0.0035f, 0.0035f));
+    transforms.SetWorld(ballTransform, model);
+}
+
+SimulationState captureSimulationState() {
+    SimulationState state;
+    state.cameraPosition = myCamera.getCameraPosition();
+    state.ballPosition = glm::vec3(xBall, yBall, zBall);
+    state.anglePlane = anglePlane;
+    state.angleDog = angleDog;
+    return state;
+}
+
+SimulationState interpolateSimulationState(const SimulationState& from, const SimulationState& to, float alpha) {
+    SimulationState state;
+    state.cameraPosition = glm::mix(from.cameraPosition, to.cameraPosition, alpha);
+    state.ballPosition = glm::mix(from.ballPosition, to.ballPosition, alpha);
+    state.anglePlane = glm::mix(from.anglePlane, to.anglePlane, alpha);
+    state.angleDog = glm::mix(from.angleDog, to.angleDog, alpha);
+    return state;
+}
+
+void updateAnimations() {
+    anglePlane += 0.1f;
+
+    if (zBall < -6.2f)
+        if (zBall >= -7.7f)
+            ballAnimation(&xBall, &yBall, &zBall);
+}
+
+// feeds the recorded events that arrived before the coming step
+void replayInput() {
+    const gps::InputEvent* event;
+    while ((event = inputRecorder.NextEvent(simulationTicks)) != NULL) {
+        if (event->type == gps::InputEvent::KEY)
+            keyboardCallback(myWindow.getWindow(), event->key, 0, event->action, 0);
+        else
+            mouseCallback(myWindow.getWindow(), event->x, event->y);
+    }
+}
+
+// advances the simulation by one fixed step
+void simulationStep() {
+    if (!replayFileName.empty())
+        replayInput();
+
+    previousState = currentState;
+    {
+        gps::CpuScope scope(profiler, "processMovement");
+        processMovement();
+    }
+    updateAnimations();
+    currentState = captureSimulationState();
+    simulationTicks++;
+}
+
+void renderShadowMap() {
+    gps::GpuScope gpuScope(profiler, "shadow pass");
+    depthMapShader.useShaderProgram();
+    glUniformMatrix4fv(lightSpaceTrMatrixLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
+    gps::RenderStats::AddUniformUploads(1);
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+
+    // static casters are rendered only when the light moved since the last cache update
+    if (staticShadowsDirty || lightDir != staticShadowsLightDir) {
+        glBindFramebuffer(GL_FRAMEBUFFER, staticShadowMapFBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        drawStaticObjects(depthMapShader, SHADOW_PASS);
+        staticShadowsLightDir = lightDir;
+        staticShadowsDirty = false;
+    }
+
+    // start from the cached static depth and add the dynamic casters on top
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowMapFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBO);
+    glBlitFramebuffer(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, 0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    drawDynamicObjects(depthMapShader, SHADOW_PASS);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, myWindow.getFramebuffer());
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+}
+
+void renderDepthPrepass() {
+    depthPrepassShader.useShaderProgram();
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    if (gpuCullingEnabled) {
+        //one draw per mesh of each batch, with the instances the GPU found visible
+        for (int b = 0; b < gpuCulling.getBatchCount(); b++) {
+            gps::Model3D* object = gpuCulling.getModel(b);
+            for (size_t m = 0; m < object->getMeshCount(); m++)
+                if (!object->getMesh(m).isAlphaTested())
+                    gpuCulling.DrawDepth(b, m, depthPrepassShader);
+        }
+    } else {
+        drawStaticObjects(depthPrepassShader, DEPTH_PREPASS);
+        drawDynamicObjects(depthPrepassShader, DEPTH_PREPASS);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+ColorPassUniforms& getColorPassUniforms(unsigned int features, gps::Shader& shader) {
+    std::map<unsigned int, ColorPassUniforms>::iterator found = colorPassUniforms.find(features);
+    if (found != colorPassUniforms.end())
+        return found->second;
+
+    //first use of this program, its per-frame block has to be bound too
+    frameUniforms.Attach(shader.shaderProgram);
+    if (features & FEATURE_GPU_INSTANCES)
+        gpuCulling.Attach(shader.shaderProgram);
+
+    ColorPassUniforms& uniforms = colorPassUniforms[features];
+    uniforms.model = glGetUniformLocation(shader.shaderProgram, "model");
+    uniforms.normalMatrix = glGetUniformLocation(shader.shaderProgram, "normalMatrix");
+    uniforms.lightSpaceTrMatrix = glGetUniformLocation(shader.shaderProgram, "lightSpaceTrMatrix");
+    uniforms.shadowMap = glGetUniformLocation(shader.shaderProgram, "shadowMap");
+    uniforms.material = gps::Mesh::GetMaterialUniforms(shader.shaderProgram);
+    if (features & FEATURE_LOCAL_LIGHTS)
+        uniforms.lightClusters = gps::LightClusters::GetUniforms(shader.shaderProgram);
+    return uniforms;
+}
+
+// draws the queue, switching the program only where the variant changes
+void renderColorPass() {
+    //without any visible local light every mesh can use the variant without the cluster loop
+    unsigned int featureMask = lightClusters.getVisibleLightCount() > 0 ? ~0u : ~(unsigned int)FEATURE_LOCAL_LIGHTS;
+
+    unsigned int boundFeatures = ~0u;
+    gps::Shader* shader = NULL;
+    ColorPassUniforms* uniforms = NULL;
+
+    for (size_t i = 0; i < colorPassQueue.size(); i++) {
+        const ColorPassItem& item = colorPassQueue[i];
+        if (item.batch < 0 && !visibleInstances[item.transform])
+            continue;
+        unsigned int features = item.features & featureMask;
+
+        if (features != boundFeatures) {
+            shader = &basicShaderVariants.Get(features);
+            uniforms = &getColorPassUniforms(features, *shader);
+            //view, projection and light come from the per-frame uniform buffer
+            shader->useShaderProgram();
+
+            if (features & FEATURE_SHADOWS) {
+                glUniformMatrix4fv(uniforms->lightSpaceTrMatrix, 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
+                glActiveTexture(GL_TEXTURE3);
+                glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+                glUniform1i(uniforms->shadowMap, 3);
+                gps::RenderStats::AddUniformUploads(2);
+                gps::RenderStats::AddTextureBinds(1);
+            }
+
+            if (features & FEATURE_LOCAL_LIGHTS)
+                lightClusters.Bind(*shader, uniforms->lightClusters);
+
+            if (depthPrepassEnabled) {
+                if (features & FEATURE_ALPHA_TEST) {
+                    //not in the pre-pass depth, test and write depth as usual
+                    glDepthFunc(GL_LESS);
+                    glDepthMask(GL_TRUE);
+                } else {
+                    //every fragment that survives the pre-pass is shaded exactly once
+                    glDepthFunc(GL_EQUAL);
+                    glDepthMask(GL_FALSE);
+                }
+            }
+
+            boundFeatures = features;
+        }
+
+        if (item.batch >= 0) {
+            gpuCulling.Draw(item.batch, item.mesh, *shader, uniforms->material);
+            continue;
+        }
+
+        glm::mat3 objectNormalMatrix = transforms.getNormalMatrix(item.transform);
+        glUniformMatrix4fv(uniforms->model, 1, GL_FALSE, glm::value_ptr(transforms.getWorld(item.transform)));
+        glUniformMatrix3fv(uniforms->normalMatrix, 1, GL_FALSE, glm::value_ptr(objectNormalMatrix));
+        gps::RenderStats::AddUniformUploads(2);
+        item.object->getMesh(item.mesh).Draw(*shader, uniforms->material);
+    }
+}
+
+// fills the uniform buffer shared by every program, once per frame
+void updateFrameUniforms() {
+    gps::FrameUniforms::Data data;
+    data.view = view;
+    data.projection = projection;
+    data.inverseViewProjection = glm::inverse(projection * view);
+    data.cameraPosition = glm::vec4(renderState.cameraPosition, 1.0f);
+    //the light direction only changes once per frame, transform it here instead of per fragment
+    data.lightDirEye = glm::vec4(glm::normalize(glm::mat3(view) * lightDir), 0.0f);
+    data.lightDirWorld = glm::vec4(glm::normalize(lightDir), 0.0f);
+    data.lightColor = glm::vec4(lightColor, 1.0f);
+    for (int i = 0; i < gps::SphericalHarmonics::COEFFICIENT_COUNT; i++)
+        data.ambientSH[i] = glm::vec4(ambientLight.coefficients[i], 0.0f);
+    frameUniforms.Update(data);
+}
+
+void renderScene() {
+    gps::CpuScope sceneScope(profiler, "renderScene");
+
+    //the camera is drawn at its interpolated position, the orientation follows the mouse directly
+    view = myCamera.getViewMatrix(renderState.cameraPosition);
+    updateFrameUniforms();
+
+    {
+        gps::CpuScope scope(profiler, "culling");
+        //world, world-view and normal matrices of all objects in one batch
+        updateDynamicTransforms();
+        updateWorldStreaming();
+        transforms.Update(view);
+        lightSpaceTrMatrix = computeLightSpaceTrMatrix();
+        updateVisibility();
+        lightClusters.Update(pointLights, view, projection, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    }
+
+    if (gpuCullingEnabled) {
+        gps::GpuScope gpuScope(profiler, "gpu culling");
+        gpuCulling.UpdateTransforms(transforms);
+        gpuCulling.Cull(viewFrustum);
+    }
+
+    renderShadowMap();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (depthPrepassEnabled) {
+        gps::GpuScope gpuScope(profiler, "depth pre-pass");
+        renderDepthPrepass();
+    }
+
+    {
+        gps::GpuScope gpuScope(profiler, "color pass");
+        renderColorPass();
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+
+    {
+        gps::CpuScope scope(profiler, "skybox");
+        gps::GpuScope gpuScope(profiler, "skybox");
+        mySkyBox.Draw(skyboxShader);
+    }
 }
 
 void cleanup() {
-    myWindow.Delete();
     //cleanup code for your own data
     glDeleteTextures(1, &depthMapTexture);
+    glDeleteTextures(1, &staticDepthMapTexture);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &shadowMapFBO);
+    glDeleteFramebuffers(1, &staticShadowMapFBO);
+    lightClusters.Delete();
+    frameUniforms.Delete();
+    worldGrid.Delete();
+    modelManager.Delete();
+    if (!traceFileName.empty())
+        profiler.WriteChromeTrace(traceFileName);
+    profiler.Delete();
+    basicShaderVariants.Delete();
+    if (gpuCullingEnabled)
+        gpuCulling.Delete();
+    shaderWatcher.Delete();
+    if (inputRecorder.isRecording()) {
+        inputRecorder.StopRecording();
+        inputRecorder.Save(recordFileName);
+    }
+    //the context goes away with the window, so it is destroyed last
+    myWindow.Delete();
+}
+
+// shows the render statistics of the last frame in the window title a few times per second,
+// and logs them together with the profiler report
+void updateStatsOverlay() {
+    statsOverlayFrames++;
+    double now = getTime();
+    if (now - lastStatsOverlay < STATS_OVERLAY_INTERVAL)
+        return;
+
+    double frameTime = (now - lastStatsOverlay) * 1000.0 / statsOverlayFrames;
+    std::string stats = gps::RenderStats::FormatFrame(gps::RenderStats::getLastFrame());
+
+    char title[320];
+    snprintf(title, sizeof(title), "OpenGL Project Core | %.2f ms | %s", frameTime, stats.c_str());
+    glfwSetWindowTitle(myWindow.getWindow(), title);
+
+    if (now - lastStatsLog >= STATS_LOG_INTERVAL) {
+        printf("render stats: %.2f ms, %s\n", frameTime, stats.c_str());
+        printf("models: %d of %d loaded, %.1f MB video memory, %.1f MB host copies\n",
+            modelManager.getResidentCount(), modelManager.getModelCount(),
+            modelManager.getGpuSize() / 1048576.0, modelManager.getHostSize() / 1048576.0);
+        if (!worldDirectory.empty())
+            printf("world: %d cells placed, %d objects\n", worldGrid.getCellCount(), (int)staticObjects.size());
+        if (gpuCullingEnabled)
+            printf("gpu culling: %d instances in %d batches\n", gpuCulling.getInstanceCount(), gpuCulling.getBatchCount());
+        lastStatsLog = now;
+    }
+
+    lastStatsOverlay = now;
+    statsOverlayFrames = 0;
+}
+
+// camera path of the headless mode: one orbit around the park, t goes from 0 to 1
+glm::vec3 headlessCameraPosition(float t) {
+    float angle = glm::radians(360.0f * t);
+    return glm::vec3(12.0f * cos(angle), 3.0f + sin(2.0f * angle), 12.0f * sin(angle) + 2.0f);
+}
+
+struct FrameTimeStatistics {
+    int frames;
+    double mean, min, p50, p95, p99, max;
+};
+
+FrameTimeStatistics computeFrameTimeStatistics(std::vector<double> frameTimes) {
+    FrameTimeStatistics statistics = { 0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (frameTimes.empty())
+        return statistics;
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+    double total = 0.0;
+    for (size_t i = 0; i < frameTimes.size(); i++)
+        total += frameTimes[i];
+
+    //nearest rank percentiles
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * frameTimes.size());
+        return frameTimes[std::max(rank, (size_t)1) - 1];
+    };
+
+    statistics.frames = (int)frameTimes.size();
+    statistics.mean = total / frameTimes.size();
+    statistics.min = frameTimes.front();
+    statistics.p50 = percentile(50.0);
+    statistics.p95 = percentile(95.0);
+    statistics.p99 = percentile(99.0);
+    statistics.max = frameTimes.back();
+    return statistics;
+}
+
+void printFrameTimeStatistics(const FrameTimeStatistics& statistics) {
+    if (statistics.frames == 0)
+        return;
+
+    printf("headless: %d frames at %dx%d, depth pre-pass %s\n", statistics.frames,
+        myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height,
+        depthPrepassEnabled ? "on" : "off");
+    printf("frame time (ms): mean %.3f, min %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+        statistics.mean, statistics.min, statistics.p50, statistics.p95, statistics.p99, statistics.max);
+    printf("average fps: %.1f\n", 1000.0 / statistics.mean);
+}
+
+// render statistics summed over the measured frames
+struct RenderStatsTotals {
+    double drawCalls, triangles, programSwitches, vertexArrayBinds, textureBinds, uniformUploads;
+};
+
+// the text as a quoted JSON string
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += (char)c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += (char)c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// machine readable results of a headless run, to compare builds
+bool writeBenchmarkResults(const FrameTimeStatistics& statistics, const RenderStatsTotals& totals) {
+    std::ofstream file(resultsFileName.c_str());
+    if (!file) {
+        std::cerr << "Could not write the benchmark results " << resultsFileName << std::endl;
+        return false;
+    }
+
+    double frames = statistics.frames;
+    file << std::fixed << std::setprecision(4)
+        << "{\n"
+        << "  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER)) << ",\n"
+        << "  \"width\": " << myWindow.getWindowDimensions().width << ",\n"
+        << "  \"height\": " << myWindow.getWindowDimensions().height << ",\n"
+        << "  \"track\": " << jsonString(replayFileName) << ",\n"
+        << "  \"depthPrepass\": " << (depthPrepassEnabled ? "true" : "false") << ",\n"
+        << "  \"warmupFrames\": " << headlessWarmupFrames << ",\n"
+        << "  \"frames\": " << statistics.frames << ",\n"
+        << "  \"frameTimeMs\": { \"mean\": " << statistics.mean << ", \"min\": " << statistics.min
+        << ", \"p50\": " << statistics.p50 << ", \"p95\": " << statistics.p95
+        << ", \"p99\": " << statistics.p99 << ", \"max\": " << statistics.max << " },\n"
+        << std::setprecision(1)
+        << "  \"perFrame\": { \"drawCalls\": " << totals.drawCalls / frames
+        << ", \"triangles\": " << totals.triangles / frames
+        << ", \"stateChanges\": " << (totals.programSwitches + totals.vertexArrayBinds + totals.textureBinds) / frames
+        << ", \"programSwitches\": " << totals.programSwitches / frames << ",\n"
+        << "                \"vertexArrayBinds\": " << totals.vertexArrayBinds / frames
+        << ", \"textureBinds\": " << totals.textureBinds / frames
+        << ", \"uniformUploads\": " << totals.uniformUploads / frames << " }\n"
+        << "}\n";
+    if (!file) {
+        std::cerr << "Could not write the benchmark results " << resultsFileName << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote the benchmark results to " << resultsFileName << std::endl;
+    return true;
+}
+
+// renders a fixed number of frames as fast as possible, there is no swap chain to wait on;
+// false if the track could not be read or the results could not be written
+bool runHeadless() {
+    bool replaying = !replayFileName.empty();
+    if (replaying) {
+        if (!inputRecorder.Load(replayFileName))
+            return false;
+        std::cout << "Replaying " << inputRecorder.getEventCount() << " input events from " << replayFileName << std::endl;
+    }
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(headlessFrames);
+    RenderStatsTotals totals = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+    for (int frame = -headlessWarmupFrames; frame < headlessFrames; frame++) {
+        double frameStart = getTime();
+        profiler.BeginFrame();
+
+        //one simulation step per frame, so every run renders the same sequence of images
+        simulationStep();
+        renderState = currentState;
+
+        //without a recorded track the camera follows the scripted orbit
+        if (!replaying) {
+            float t = (float)std::max(frame, 0) / headlessFrames;
+            glm::vec3 position = headlessCameraPosition(t);
+            glm::vec3 front = glm::normalize(glm::vec3(0.0f, 1.0f, 2.0f) - position);
+            myCamera.rotate(glm::degrees(asin(front.y)), glm::degrees(atan2(front.z, front.x)));
+            renderState.cameraPosition = position;
+        }
+
+        renderScene();
+        //wait for the GPU so the measured time covers the whole frame
+        glFinish();
+        profiler.EndFrame();
+        gps::RenderStats::EndFrame();
+
+        if (frame >= 0) {
+            frameTimes.push_back((getTime() - frameStart) * 1000.0);
+            gps::RenderStats::Frame stats = gps::RenderStats::getLastFrame();
+            totals.drawCalls += stats.drawCalls;
+            totals.triangles += stats.triangles;
+            totals.programSwitches += stats.programSwitches;
+            totals.vertexArrayBinds += stats.vertexArrayBinds;
+            totals.textureBinds += stats.textureBinds;
+            totals.uniformUploads += stats.uniformUploads;
+        }
+
+        glCheckError();
+    }
+
+    FrameTimeStatistics statistics = computeFrameTimeStatistics(frameTimes);
+    printFrameTimeStatistics(statistics);
+    profiler.Report(0.0);
+
+    std::cout << "render stats (last frame): " << gps::RenderStats::FormatFrame(gps::RenderStats::getLastFrame()) << std::endl;
+
+    if (!resultsFileName.empty())
+        return writeBenchmarkResults(statistics, totals);
+    return true;
+}
+
+// --headless [--frames N] [--warmup N] [--width W] [--height H] [--prepass] [--trace file.json]
+// --replay track.txt [--results results.json] runs the headless benchmark on a recorded track
+// --record track.txt records the input of an interactive session
+// --obj-benchmark [--obj-benchmark-file big.obj] compares the OBJ parsers and measures how they scale with threads
+// --build-pack assets.pack bundles every asset into one file, --pack assets.pack loads from it
+// --gpu-budget MB and --host-budget MB bound the memory the loaded models keep
+// --export-world dir writes the park as cell files, --world dir [--world-radius R] streams them around the camera
+// --gpu-culling culls and submits the camera passes on the GPU when OpenGL 4.3 is available
+void parseArguments(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0)
+            headlessMode = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            headlessFrames = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            headlessWarmupFrames = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            glWindowWidth = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+            glWindowHeight = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--prepass") == 0)
+            depthPrepassEnabled = true;
+        else if (strcmp(argv[i], "--procedural-sky") == 0)
+            proceduralSky = true;
+        else if (strcmp(argv[i], "--skybox") == 0 && i + 1 < argc)
+            skyboxFileName = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            traceFileName = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordFileName = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayFileName = argv[++i];
+        else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc)
+            resultsFileName = argv[++i];
+        else if (strcmp(argv[i], "--obj-benchmark") == 0)
+            objBenchmark = true;
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+            packFileName = argv[++i];
+        else if (strcmp(argv[i], "--build-pack") == 0 && i + 1 < argc)
+            buildPackFileName = argv[++i];
+        else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc)
+            worldDirectory = argv[++i];
+        else if (strcmp(argv[i], "--world-radius") == 0 && i + 1 < argc)
+            worldLoadRadius = std::max((float)atof(argv[++i]), 0.0f);
+        else if (strcmp(argv[i], "--export-world") == 0 && i + 1 < argc)
+            exportWorldDirectory = argv[++i];
+        else if (strcmp(argv[i], "--gpu-culling") == 0)
+            gpuCullingRequested = true;
+        else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+            modelGpuBudget = (size_t)std::max(atoi(argv[++i]), 0) << 20;
+        else if (strcmp(argv[i], "--host-budget") == 0 && i + 1 < argc)
+            modelHostBudget = (size_t)std::max(atoi(argv[++i]), 0) << 20;
+        else if (strcmp(argv[i], "--obj-benchmark-file") == 0 && i + 1 < argc) {
+            objBenchmark = true;
+            objBenchmarkFileName = argv[++i];
+        }
+    }
+
+    //benchmarks always run offscreen, so they also work without a display or a GPU
+    if (!replayFileName.empty())
+        headlessMode = true;
+    if (headlessMode)
+        recordFileName.clear();
 }
 
 int main(int argc, const char * argv[]) {
 
+    parseArguments(argc, argv);
+
+    if (!packFileName.empty()) {
+        packMounted = gps::AssetPack::Mount(packFileName);
+        if (packMounted)
+            std::cout << "Loading the assets from " << packFileName << std::endl;
+        else
+            std::cerr << "Could not open the asset pack " << packFileName << ", loading the files" << std::endl;
+    }
+
+    if (!buildPackFileName.empty())
+        return buildAssetPack(buildPackFileName) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (!exportWorldDirectory.empty())
+        return exportWorld(exportWorldDirectory) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (objBenchmark) {
+        runObjBenchmark();
+        return EXIT_SUCCESS;
+    }
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -772,27 +2171,104 @@ int main(int argc, const char * argv[]) {
     }
 
     initOpenGLState();
+
+    if (gpuCullingRequested) {
+        gpuCullingEnabled = gps::GpuCulling::IsSupported();
+        if (!gpuCullingEnabled)
+            std::cerr << "GPU culling needs OpenGL 4.3, culling on the CPU" << std::endl;
+    }
    
-    initModels();
-    
+    //the shaders compile while the skybox loads, the models load once they are in view
     initShaders();
+
+    initModels();
     
     initSkybox();
+
+    finishShaders();
+
+    //one pass at startup, the program is not needed afterwards
+    mySkyBox.PrefilterEnvironment(cubemapPrefilterShader);
+    glDeleteProgram(cubemapPrefilterShader.shaderProgram);
+    initAmbientLight();
     
 	initUniforms();
     
-    setWindowCallbacks();
+    if (!headlessMode) {
+        setWindowCallbacks();
+        //packed shaders do not change, there is nothing to watch unless the pack could not be opened
+        if (!packMounted) {
+            shaderWatcher.Init("shaders");
+            watchShaderFiles();
+        }
+    }
 
     initFBO();
+
+    if (worldDirectory.empty()) {
+        initStaticObjects();
+    } else {
+        worldGrid.setSynchronous(headlessMode);
+        worldGrid.Init(worldDirectory, WORLD_CELL_SIZE, worldLoadRadius);
+    }
+    initDynamicObjects();
+
+    lightClusters.Init();
+    frameUniforms.Init();
+    initPointLights();
+
+    profiler.Init();
+    if (!traceFileName.empty())
+        profiler.StartTrace();
+
+    currentState = captureSimulationState();
+    previousState = currentState;
+
+    if (!recordFileName.empty())
+        inputRecorder.StartRecording();
+
+    if (headlessMode) {
+        bool completed = runHeadless();
+        cleanup();
+        return completed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    double previousTime = getTime();
+    lastStatsOverlay = previousTime;
+    lastStatsLog = previousTime;
     
 	
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
-        processMovement();
+        double currentTime = getTime();
+        double frameTime = currentTime - previousTime;
+        if (frameTime > MAX_FRAME_TIME)
+            frameTime = MAX_FRAME_TIME;
+        previousTime = currentTime;
+        profiler.BeginFrame();
+
+        reloadChangedShaders();
+
+        //run as many fixed steps as the elapsed time requires, independently of the frame rate
+        simulationAccumulator += frameTime;
+        while (simulationAccumulator >= SIMULATION_STEP) {
+            simulationStep();
+            simulationAccumulator -= SIMULATION_STEP;
+        }
+
+        renderState = interpolateSimulationState(previousState, currentState, (float)(simulationAccumulator / SIMULATION_STEP));
 	    renderScene();
 
 		glfwPollEvents();
-		glfwSwapBuffers(myWindow.getWindow());
+        {
+            gps::CpuScope scope(profiler, "swap");
+		    glfwSwapBuffers(myWindow.getWindow());
+        }
+
+        profiler.EndFrame();
+        profiler.Report();
+        gps::RenderStats::EndFrame();
+        updateStatsOverlay();
 
 		glCheckError();
 	}
@@ -1,59 +1,168 @@
 #version 410 core
 
-in vec3 fPosition;
-in vec3 fNormal;
+//features, defined per variant by the C++ side:
+//DIFFUSE_TEXTURE, SPECULAR_TEXTURE - sample the textures, otherwise use the material colors
+//SHADOWS - directional light shadow map
+//LOCAL_LIGHTS - clustered point and spot lights
+//ALPHA_TEST - discard the transparent texels of the diffuse texture
+
+in vec3 fPosEye;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
+#ifdef SHADOWS
+in vec4 fragPosLightSpace;
+#endif
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
+//lighting: lightDirEye is the direction towards the light in eye space, normalized on the CPU once per frame
+#include "frameUniforms.glsl"
 // textures
+#ifdef DIFFUSE_TEXTURE
 uniform sampler2D diffuseTexture;
+#else
+uniform vec3 materialDiffuse;
+#endif
+#ifdef SPECULAR_TEXTURE
 uniform sampler2D specularTexture;
+#else
+uniform vec3 materialSpecular;
+#endif
+#ifdef SHADOWS
+uniform sampler2D shadowMap;
+#endif
+#ifdef LOCAL_LIGHTS
+//clustered local lights
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterData;
+uniform usamplerBuffer lightIndices;
+uniform uvec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform vec2 clusterDepthParams;
+#endif
 
 //components
 vec3 ambient;
-float ambientStrength = 0.2f;
 vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
+vec3 localDiffuse;
+vec3 localSpecular;
+vec3 normalEye;
+vec3 viewDir;
 
 void computeDirLight()
 {
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
-
-    //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
-
-    //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(- fPosEye.xyz);
+    vec3 lightDirN = lightDirEye.xyz;
 
-    //compute ambient light
-    ambient = ambientStrength * lightColor;
+    //compute ambient light, the sky is projected in world space and the view matrix is rigid
+    ambient = max(ambientIrradiance(transpose(mat3(view)) * normalEye), 0.0f);
 
     //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
 
     //compute specular light
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
+    specular = specularStrength * specCoeff * lightColor.rgb;
+}
+
+void computeLocalLights()
+{
+    localDiffuse = vec3(0.0f);
+    localSpecular = vec3(0.0f);
+
+#ifdef LOCAL_LIGHTS
+    //find the cluster of this fragment: screen tile and exponential depth slice
+    uint slice = uint(max(log(-fPosEye.z) * clusterDepthParams.x + clusterDepthParams.y, 0.0f));
+    slice = min(slice, clusterCount.z - 1u);
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1u);
+    int cluster = int(tile.x + clusterCount.x * (tile.y + clusterCount.y * slice));
+
+    //x - offset in the index list, y - number of lights
+    uvec2 range = texelFetch(clusterData, cluster).xy;
+
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(lightIndices, int(range.x + i)).x);
+        vec4 positionRadius = texelFetch(lightData, 3 * light);
+        vec4 colorOuterCos = texelFetch(lightData, 3 * light + 1);
+        vec4 directionInnerCos = texelFetch(lightData, 3 * light + 2);
+
+        vec3 toLight = positionRadius.xyz - fPosEye;
+        float dist = length(toLight);
+        if (dist >= positionRadius.w)
+            continue;
+        vec3 lightDirN = toLight / dist;
+
+        //inverse square falloff windowed to reach zero at the light radius
+        float window = clamp(1.0f - pow(dist / positionRadius.w, 4.0f), 0.0f, 1.0f);
+        float attenuation = window * window / (1.0f + dist * dist);
+
+        //spot lights fade between the outer and the inner cone
+        if (colorOuterCos.w > -1.0f)
+            attenuation *= smoothstep(colorOuterCos.w, directionInnerCos.w, dot(-lightDirN, directionInnerCos.xyz));
+
+        vec3 radiance = attenuation * colorOuterCos.rgb;
+        localDiffuse += max(dot(normalEye, lightDirN), 0.0f) * radiance;
+
+        vec3 reflectDir = reflect(-lightDirN, normalEye);
+        float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
+        localSpecular += specularStrength * specCoeff * radiance;
+    }
+#endif
+}
+
+float computeShadow()
+{
+#ifndef SHADOWS
+    return 0.0f;
+#else
+    //perform perspective divide and move to [0, 1] range
+    vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    normalizedCoords = normalizedCoords * 0.5f + 0.5f;
+
+    //fragments outside the light frustum are never in shadow
+    if (normalizedCoords.z > 1.0f)
+        return 0.0f;
+
+    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+    float currentDepth = normalizedCoords.z;
+    float bias = 0.005f;
+
+    return currentDepth - bias > closestDepth ? 1.0f : 0.0f;
+#endif
 }
 
 void main() 
 {
+#ifdef DIFFUSE_TEXTURE
+    vec4 diffuseSample = texture(diffuseTexture, fTexCoords);
+#ifdef ALPHA_TEST
+    if (diffuseSample.a < 0.5f)
+        discard;
+#endif
+    vec3 diffuseColor = diffuseSample.rgb;
+#else
+    vec3 diffuseColor = materialDiffuse;
+#endif
+#ifdef SPECULAR_TEXTURE
+    vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#else
+    vec3 specularColor = materialSpecular;
+#endif
+
+    //eye space position and normal come interpolated from basic.vert
+    normalEye = normalize(fNormalEye);
+    //in eye coordinates the viewer is situated at the origin
+    viewDir = normalize(- fPosEye);
+
     computeDirLight();
+    computeLocalLights();
+
+    float shadow = computeShadow();
 
     //compute final vertex color
-    vec3 color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
+    vec3 color = min((ambient + (1.0f - shadow) * diffuse + localDiffuse) * diffuseColor + ((1.0f - shadow) * specular + localSpecular) * specularColor, 1.0f);
 
     fColor = vec4(color, 1.0f);
 }
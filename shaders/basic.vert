@@ -1,21 +1,46 @@
 #version 410 core
+#ifdef GPU_INSTANCES
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
 
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
-out vec3 fPosition;
-out vec3 fNormal;
+out vec3 fPosEye;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
+#ifdef SHADOWS
+out vec4 fragPosLightSpace;
+#endif
 
+#include "frameUniforms.glsl"
+
+#ifdef GPU_INSTANCES
+#include "instances.glsl"
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix;
+#endif
+#ifdef SHADOWS
+uniform mat4 lightSpaceTrMatrix;
+#endif
+
+//the depth pre-pass relies on both shaders writing the same depth
+invariant gl_Position;
 
 void main() 
 {
+#ifdef GPU_INSTANCES
+	mat4 model = instances[vInstance].world;
+	//the view matrix is a rotation and a translation, it transforms normals as it is
+	mat3 normalMatrix = mat3(view) * mat3(instances[vInstance].normal);
+#endif
 	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	fPosEye = vec3(view * model * vec4(vPosition, 1.0f));
+	fNormalEye = normalMatrix * vNormal;
 	fTexCoords = vTexCoords;
+#ifdef SHADOWS
+	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+#endif
 }
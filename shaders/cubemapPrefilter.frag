@@ -0,0 +1,87 @@
+#version 410 core
+
+//Prefilters one level of the environment map: every texel is the environment seen through the
+//GGX lobe of the level's roughness, with the usual n = v = r approximation. The samples read
+//lower mip levels of the source where they are sparse (filtered importance sampling), so a
+//few dozen of them are enough even for the widest lobes.
+
+in vec2 faceCoordinates;
+out vec4 color;
+
+uniform samplerCube environment;
+uniform int face;
+uniform float roughness;
+//size of level 0 of the source
+uniform float sourceResolution;
+
+const uint SAMPLE_COUNT = 64u;
+const float PI = 3.14159265359;
+
+//direction through a texel of a face, in the GL cube map face orientation
+vec3 faceDirection(int face, vec2 st)
+{
+    if (face == 0) return vec3(1.0, -st.y, -st.x);
+    if (face == 1) return vec3(-1.0, -st.y, st.x);
+    if (face == 2) return vec3(st.x, 1.0, st.y);
+    if (face == 3) return vec3(st.x, -1.0, -st.y);
+    if (face == 4) return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+vec2 hammersley(uint i)
+{
+    return vec2(float(i) / float(SAMPLE_COUNT), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+float distributionGGX(float NdotH, float alpha)
+{
+    float alpha2 = alpha * alpha;
+    float denominator = NdotH * NdotH * (alpha2 - 1.0) + 1.0;
+    return alpha2 / (PI * denominator * denominator);
+}
+
+vec3 importanceSampleGGX(vec2 xi, vec3 N, float alpha)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 H = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+    vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, N));
+    vec3 bitangent = cross(N, tangent);
+    return normalize(tangent * H.x + bitangent * H.y + N * H.z);
+}
+
+void main()
+{
+    vec3 N = normalize(faceDirection(face, faceCoordinates));
+
+    if (roughness == 0.0) {
+        color = vec4(textureLod(environment, N, 0.0).rgb, 1.0);
+        return;
+    }
+
+    float alpha = roughness * roughness;
+    //solid angle of one source texel
+    float texelSolidAngle = 4.0 * PI / (6.0 * sourceResolution * sourceResolution);
+
+    vec3 sum = vec3(0.0);
+    float weight = 0.0;
+    for (uint i = 0u; i < SAMPLE_COUNT; i++) {
+        vec3 H = importanceSampleGGX(hammersley(i), N, alpha);
+        vec3 L = 2.0 * dot(N, H) * H - N;
+        float NdotL = dot(N, L);
+        if (NdotL <= 0.0)
+            continue;
+
+        //with n = v the pdf of L is D / 4
+        float pdf = distributionGGX(max(dot(N, H), 0.0), alpha) * 0.25;
+        float sampleSolidAngle = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
+        float level = max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+
+        sum += textureLod(environment, L, level).rgb * NdotL;
+        weight += NdotL;
+    }
+    color = vec4(sum / max(weight, 0.0001), 1.0);
+}
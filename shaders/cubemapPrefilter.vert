@@ -0,0 +1,11 @@
+#version 410 core
+
+out vec2 faceCoordinates;
+
+//one triangle covering the face being rendered, see skyboxShader.vert
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+    faceCoordinates = position;
+}
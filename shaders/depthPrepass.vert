@@ -0,0 +1,25 @@
+#version 410 core
+#ifdef GPU_INSTANCES
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+layout(location=0) in vec3 vPosition;
+
+#include "frameUniforms.glsl"
+
+#ifdef GPU_INSTANCES
+#include "instances.glsl"
+#else
+uniform mat4 model;
+#endif
+
+//must produce bit-identical depth to basic.vert for the GL_EQUAL color pass
+invariant gl_Position;
+
+void main()
+{
+#ifdef GPU_INSTANCES
+	mat4 model = instances[vInstance].world;
+#endif
+	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+}
@@ -0,0 +1,22 @@
+//per-frame uniforms shared by every program, the layout must match gps::FrameUniforms::Data
+layout(std140) uniform FrameUniforms
+{
+	mat4 view;
+	mat4 projection;
+	mat4 inverseViewProjection;
+	vec4 cameraPosition;
+	vec4 lightDirEye;
+	vec4 lightDirWorld;
+	vec4 lightColor;
+	vec4 ambientSH[9];
+};
+
+//ambient light reaching a surface with the world space normal n, already divided by pi
+vec3 ambientIrradiance(vec3 n)
+{
+	return ambientSH[0].rgb
+		+ ambientSH[1].rgb * n.y + ambientSH[2].rgb * n.z + ambientSH[3].rgb * n.x
+		+ ambientSH[4].rgb * (n.x * n.y) + ambientSH[5].rgb * (n.y * n.z)
+		+ ambientSH[6].rgb * (3.0 * n.z * n.z - 1.0)
+		+ ambientSH[7].rgb * (n.x * n.z) + ambientSH[8].rgb * (n.x * n.x - n.y * n.y);
+}
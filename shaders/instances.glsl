@@ -0,0 +1,16 @@
+//matrices of the instances culled on the GPU, the layout must match gps::GpuCulling; the
+//including shader enables GL_ARB_shader_storage_buffer_object
+struct Instance
+{
+	mat4 world;
+	//world space normal matrix in the first three columns
+	mat4 normal;
+};
+
+layout(std430) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+//index of the visible instance drawn, gps::GpuCulling::INSTANCE_ATTRIBUTE
+layout(location=4) in uint vInstance;
@@ -1,11 +1,38 @@
 #version 410 core
 
-in vec3 textureCoordinates;
+//PROCEDURAL_SKY - gradient and sun from the light direction instead of the cube map
+
+#include "frameUniforms.glsl"
+
+in vec3 viewRay;
 out vec4 color;
 
+#ifdef PROCEDURAL_SKY
+const vec3 zenithColor = vec3(0.18, 0.36, 0.72);
+const vec3 horizonColor = vec3(0.70, 0.80, 0.92);
+const vec3 groundColor = vec3(0.35, 0.33, 0.30);
+#else
 uniform samplerCube skybox;
+#endif
 
 void main()
 {
-    color = texture(skybox, textureCoordinates);
+    //the ray is interpolated linearly across the triangle, so it is normalized per fragment
+    vec3 direction = normalize(viewRay);
+
+#ifdef PROCEDURAL_SKY
+    float height = direction.y;
+    vec3 sky = height > 0.0
+        ? mix(horizonColor, zenithColor, pow(height, 0.5))
+        : mix(horizonColor, groundColor, pow(-height, 0.3));
+
+    //lightDirWorld points towards the light
+    vec3 sunDirection = normalize(lightDirWorld.xyz);
+    float sunAmount = max(dot(direction, sunDirection), 0.0);
+    sky += lightColor.rgb * (pow(sunAmount, 512.0) * 4.0 + pow(sunAmount, 16.0) * 0.25);
+    color = vec4(sky, 1.0);
+#else
+    //the cube map has mip levels for the prefiltering, the sky itself shows the full resolution
+    color = textureLod(skybox, direction, 0.0);
+#endif
 }
@@ -1,15 +1,17 @@
 #version 410 core
 
-layout (location = 0) in vec3 vertexPosition;
-out vec3 textureCoordinates;
+#include "frameUniforms.glsl"
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+out vec3 viewRay;
 
+//one triangle covering the screen, no vertex buffer: ids 0, 1, 2 map to (-1,-1), (3,-1), (-1,3)
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
-    gl_Position = tempPos.xyww;
-    textureCoordinates = vertexPosition;
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    //z = w puts the sky on the far plane, it only covers pixels nothing else was drawn on
+    gl_Position = vec4(position, 1.0, 1.0);
+
+    //world space direction through this corner of the far plane
+    vec4 farPoint = inverseViewProjection * vec4(position, 1.0, 1.0);
+    viewRay = farPoint.xyz / farPoint.w - cameraPosition.xyz;
 }
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds the project and runs the headless benchmark on tools/benchmark_track.txt, for CI.
+# Needs no display: on Linux the context comes from EGL surfaceless, Mesa llvmpipe on machines
+# without a GPU. Exits with an error if the build or the run fails; the results are written to
+# <build directory>/benchmark_results.json.
+#
+# usage: tools/ci_benchmark.sh [build directory] [frames]
+set -e
+
+cd "$(dirname "$0")/.."
+build=${1:-build}
+frames=${2:-600}
+
+if [ ! -d models ]; then
+    echo "warning: no models directory, the benchmark renders only the sky" >&2
+fi
+
+cmake -S . -B "$build" -DCMAKE_BUILD_TYPE=Release -DBENCHMARK_FRAMES="$frames"
+cmake --build "$build" --parallel
+cmake --build "$build" --target benchmark
+cat "$build/benchmark_results.json"
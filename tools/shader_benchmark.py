@@ -0,0 +1,425 @@
+#!/usr/bin/env python3
+"""Compares two revisions of the basic shader (shaders/basic.vert and shaders/basic.frag).
+
+For each revision the shaders are preprocessed like Shader.cpp does (#include "file" is
+expanded, the defines are added after #version) and built by the OpenGL driver, then it reports:
+  - the program binary size of the fragment stage alone (a separable program), a rough
+    measure of the code the driver generated for it;
+  - the program binary size of the linked program;
+  - the time of drawing full screen triangles with the program, which is bound by the
+    fragment stage (on a software rasterizer like llvmpipe, by its arithmetic).
+The matrices are set to the identity and the other float and unsigned uniforms to 1, in the
+uniform blocks too, and no texture is bound, so the clustered local lights loop over no light.
+
+The binary sizes depend on the driver, and the timings on the machine; only compare numbers
+from the same run. Needs an EGL driver with a surfaceless context (Mesa, or any driver with
+EGL_KHR_surfaceless_context) and OpenGL 4.1.
+
+usage: tools/shader_benchmark.py BEFORE [AFTER] [-D NAME]... [--size N] [--draws N]
+BEFORE and AFTER are git revisions, AFTER defaults to the working tree.
+"""
+
+import argparse
+import ctypes
+import os
+import re
+import struct
+import subprocess
+import sys
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+GL_FRAGMENT_SHADER = 0x8B30
+GL_VERTEX_SHADER = 0x8B31
+GL_COMPILE_STATUS = 0x8B81
+GL_LINK_STATUS = 0x8B82
+GL_ACTIVE_UNIFORMS = 0x8B86
+GL_PROGRAM_BINARY_LENGTH = 0x8741
+GL_PROGRAM_SEPARABLE = 0x8258
+GL_FLOAT = 0x1406
+GL_FLOAT_VEC2 = 0x8B50
+GL_FLOAT_VEC3 = 0x8B51
+GL_FLOAT_VEC4 = 0x8B52
+GL_UNSIGNED_INT_VEC3 = 0x8DC8
+GL_FLOAT_MAT3 = 0x8B5B
+GL_FLOAT_MAT4 = 0x8B5C
+SAMPLER_TYPES = (0x8B5E, 0x8B60, 0x8DC2, 0x8DD8)  #sampler2D, samplerCube, samplerBuffer, usamplerBuffer
+GL_SAMPLES_PASSED = 0x8914
+GL_UNIFORM_BUFFER = 0x8A11
+GL_UNIFORM_BLOCK_INDEX = 0x8A3A
+GL_UNIFORM_OFFSET = 0x8A3B
+GL_UNIFORM_ARRAY_STRIDE = 0x8A3C
+GL_UNIFORM_MATRIX_STRIDE = 0x8A3D
+GL_UNIFORM_BLOCK_DATA_SIZE = 0x8A40
+GL_QUERY_RESULT = 0x8866
+GL_ARRAY_BUFFER = 0x8892
+GL_STATIC_DRAW = 0x88E4
+GL_TEXTURE_2D = 0x0DE1
+GL_RGBA8 = 0x8058
+GL_FRAMEBUFFER = 0x8D40
+GL_COLOR_ATTACHMENT0 = 0x8CE0
+GL_FRAMEBUFFER_COMPLETE = 0x8CD5
+GL_TRIANGLES = 0x0004
+
+EGL_PLATFORM_SURFACELESS_MESA = 0x31DD
+EGL_OPENGL_API = 0x30A2
+EGL_CONTEXT_MAJOR_VERSION = 0x3098
+EGL_CONTEXT_MINOR_VERSION = 0x30FB
+EGL_CONTEXT_OPENGL_PROFILE_MASK = 0x30FD
+EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT = 0x0001
+EGL_NONE = 0x3038
+
+#full screen triangle: position, normal, texture coordinates
+VERTICES = [
+    -1.0, -1.0, -0.5, 0.0, 0.0, 1.0, 0.0, 0.0,
+     3.0, -1.0, -0.5, 0.0, 0.0, 1.0, 2.0, 0.0,
+    -1.0,  3.0, -0.5, 0.0, 0.0, 1.0, 0.0, 2.0,
+]
+
+P = ctypes.c_void_p
+
+
+class GL:
+    """The GL entry points, loaded through eglGetProcAddress."""
+
+    SIGNATURES = {
+        "glGetString": (ctypes.c_char_p, [ctypes.c_uint]),
+        "glCreateShader": (ctypes.c_uint, [ctypes.c_uint]),
+        "glShaderSource": (None, [ctypes.c_uint, ctypes.c_int, P, P]),
+        "glCompileShader": (None, [ctypes.c_uint]),
+        "glGetShaderiv": (None, [ctypes.c_uint, ctypes.c_uint, P]),
+        "glGetShaderInfoLog": (None, [ctypes.c_uint, ctypes.c_int, P, ctypes.c_char_p]),
+        "glDeleteShader": (None, [ctypes.c_uint]),
+        "glCreateProgram": (ctypes.c_uint, []),
+        "glProgramParameteri": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_int]),
+        "glAttachShader": (None, [ctypes.c_uint, ctypes.c_uint]),
+        "glLinkProgram": (None, [ctypes.c_uint]),
+        "glGetProgramiv": (None, [ctypes.c_uint, ctypes.c_uint, P]),
+        "glGetProgramInfoLog": (None, [ctypes.c_uint, ctypes.c_int, P, ctypes.c_char_p]),
+        "glDeleteProgram": (None, [ctypes.c_uint]),
+        "glUseProgram": (None, [ctypes.c_uint]),
+        "glGetActiveUniform": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_int, P, P, P, ctypes.c_char_p]),
+        "glGetUniformLocation": (ctypes.c_int, [ctypes.c_uint, ctypes.c_char_p]),
+        "glUniform1i": (None, [ctypes.c_int, ctypes.c_int]),
+        "glUniform1f": (None, [ctypes.c_int, ctypes.c_float]),
+        "glUniform2f": (None, [ctypes.c_int, ctypes.c_float, ctypes.c_float]),
+        "glUniform3f": (None, [ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float]),
+        "glUniform4f": (None, [ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_float]),
+        "glUniform3ui": (None, [ctypes.c_int, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint]),
+        "glUniformMatrix3fv": (None, [ctypes.c_int, ctypes.c_int, ctypes.c_ubyte, P]),
+        "glUniformMatrix4fv": (None, [ctypes.c_int, ctypes.c_int, ctypes.c_ubyte, P]),
+        "glGenVertexArrays": (None, [ctypes.c_int, P]),
+        "glBindVertexArray": (None, [ctypes.c_uint]),
+        "glGenBuffers": (None, [ctypes.c_int, P]),
+        "glBindBuffer": (None, [ctypes.c_uint, ctypes.c_uint]),
+        "glBufferData": (None, [ctypes.c_uint, ctypes.c_ssize_t, P, ctypes.c_uint]),
+        "glEnableVertexAttribArray": (None, [ctypes.c_uint]),
+        "glVertexAttribPointer": (None, [ctypes.c_uint, ctypes.c_int, ctypes.c_uint, ctypes.c_ubyte, ctypes.c_int, P]),
+        "glGenTextures": (None, [ctypes.c_int, P]),
+        "glBindTexture": (None, [ctypes.c_uint, ctypes.c_uint]),
+        "glTexStorage2D": (None, [ctypes.c_uint, ctypes.c_int, ctypes.c_uint, ctypes.c_int, ctypes.c_int]),
+        "glGenFramebuffers": (None, [ctypes.c_int, P]),
+        "glBindFramebuffer": (None, [ctypes.c_uint, ctypes.c_uint]),
+        "glFramebufferTexture2D": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint, ctypes.c_int]),
+        "glCheckFramebufferStatus": (ctypes.c_uint, [ctypes.c_uint]),
+        "glViewport": (None, [ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int]),
+        "glDrawArrays": (None, [ctypes.c_uint, ctypes.c_int, ctypes.c_int]),
+        "glFinish": (None, []),
+        "glGetError": (ctypes.c_uint, []),
+        "glGetActiveUniformsiv": (None, [ctypes.c_uint, ctypes.c_int, P, ctypes.c_uint, P]),
+        "glGetActiveUniformBlockiv": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_uint, P]),
+        "glUniformBlockBinding": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_uint]),
+        "glBindBufferBase": (None, [ctypes.c_uint, ctypes.c_uint, ctypes.c_uint]),
+        "glGenQueries": (None, [ctypes.c_int, P]),
+        "glBeginQuery": (None, [ctypes.c_uint, ctypes.c_uint]),
+        "glEndQuery": (None, [ctypes.c_uint]),
+        "glGetQueryObjectuiv": (None, [ctypes.c_uint, ctypes.c_uint, P]),
+    }
+
+    def __init__(self, egl):
+        egl.eglGetProcAddress.restype = P
+        egl.eglGetProcAddress.argtypes = [ctypes.c_char_p]
+        for name, (restype, argtypes) in self.SIGNATURES.items():
+            address = egl.eglGetProcAddress(name.encode())
+            if not address:
+                sys.exit("the driver has no " + name)
+            setattr(self, name, ctypes.CFUNCTYPE(restype, *argtypes)(address))
+
+
+def create_context():
+    try:
+        egl = ctypes.CDLL("libEGL.so.1")
+    except OSError:
+        sys.exit("libEGL.so.1 not found")
+    egl.eglGetProcAddress.restype = P
+    egl.eglGetProcAddress.argtypes = [ctypes.c_char_p]
+    egl.eglGetDisplay.restype = P
+    egl.eglGetDisplay.argtypes = [P]
+    egl.eglInitialize.argtypes = [P, P, P]
+    egl.eglBindAPI.argtypes = [ctypes.c_uint]
+    egl.eglCreateContext.restype = P
+    egl.eglCreateContext.argtypes = [P, P, P, P]
+    egl.eglMakeCurrent.argtypes = [P, P, P, P]
+
+    display = None
+    getPlatformDisplay = egl.eglGetProcAddress(b"eglGetPlatformDisplayEXT")
+    if getPlatformDisplay:
+        display = ctypes.CFUNCTYPE(P, ctypes.c_uint, P, P)(getPlatformDisplay)(
+            EGL_PLATFORM_SURFACELESS_MESA, None, None)
+    if not display or not egl.eglInitialize(display, None, None):
+        display = egl.eglGetDisplay(None)
+        if not display or not egl.eglInitialize(display, None, None):
+            sys.exit("could not initialize an EGL display")
+
+    egl.eglBindAPI(EGL_OPENGL_API)
+    attributes = (ctypes.c_int * 7)(EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 1,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                    EGL_NONE)
+    context = egl.eglCreateContext(display, None, None, attributes)
+    if not context or not egl.eglMakeCurrent(display, None, None, context):
+        sys.exit("could not create a surfaceless OpenGL 4.1 core context")
+    return GL(egl)
+
+
+def read_file(revision, path):
+    if revision is None:
+        with open(os.path.join(REPO, path), encoding="utf-8") as file:
+            return file.read()
+    return subprocess.run(["git", "-C", REPO, "show", revision + ":" + path], check=True,
+                          stdout=subprocess.PIPE).stdout.decode("utf-8")
+
+
+def preprocess(revision, path, defines, depth=0):
+    """Same rules as preprocessShaderFile() in Shader.cpp."""
+    if depth > 8:
+        sys.exit(path + ": too deeply nested #include")
+    output = []
+    for line in read_file(revision, path).replace("\r\n", "\n").split("\n"):
+        include = re.match(r'\s*#include\s*"([^"]+)"', line)
+        if include:
+            output.append(preprocess(revision, os.path.dirname(path) + "/" + include.group(1), [], depth + 1))
+            continue
+        output.append(line)
+        if depth == 0 and line.strip().startswith("#version"):
+            output.extend("#define " + define for define in defines)
+    return "\n".join(output)
+
+
+def compile_shader(gl, kind, source, name):
+    shader = gl.glCreateShader(kind)
+    text = ctypes.c_char_p(source.encode())
+    gl.glShaderSource(shader, 1, ctypes.byref(text), None)
+    gl.glCompileShader(shader)
+    status = ctypes.c_int()
+    gl.glGetShaderiv(shader, GL_COMPILE_STATUS, ctypes.byref(status))
+    if not status.value:
+        log = ctypes.create_string_buffer(16384)
+        gl.glGetShaderInfoLog(shader, len(log), None, log)
+        sys.exit(name + " did not compile:\n" + log.value.decode())
+    return shader
+
+
+def link_program(gl, shaders, separable, name):
+    program = gl.glCreateProgram()
+    if separable:
+        gl.glProgramParameteri(program, GL_PROGRAM_SEPARABLE, 1)
+    for shader in shaders:
+        gl.glAttachShader(program, shader)
+    gl.glLinkProgram(program)
+    status = ctypes.c_int()
+    gl.glGetProgramiv(program, GL_LINK_STATUS, ctypes.byref(status))
+    if not status.value:
+        log = ctypes.create_string_buffer(16384)
+        gl.glGetProgramInfoLog(program, len(log), None, log)
+        sys.exit(name + " did not link:\n" + log.value.decode())
+    return program
+
+
+def binary_length(gl, program):
+    length = ctypes.c_int()
+    gl.glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, ctypes.byref(length))
+    return length.value
+
+
+def uniform_info(gl, program, index, parameter):
+    indices = ctypes.c_uint(index)
+    value = ctypes.c_int()
+    gl.glGetActiveUniformsiv(program, 1, ctypes.byref(indices), parameter, ctypes.byref(value))
+    return value.value
+
+
+def fill_block_member(data, kind, count, offset, arrayStride, matrixStride):
+    """Writes the same values set_uniforms() gives to the uniforms outside blocks."""
+    for element in range(count):
+        start = offset + element * arrayStride
+        if kind in (GL_FLOAT_MAT3, GL_FLOAT_MAT4):
+            columns = 3 if kind == GL_FLOAT_MAT3 else 4
+            for column in range(columns):
+                values = [1.0 if row == column else 0.0 for row in range(columns)]
+                struct.pack_into("<%df" % columns, data, start + column * matrixStride, *values)
+        elif kind in (GL_FLOAT, GL_FLOAT_VEC2, GL_FLOAT_VEC3, GL_FLOAT_VEC4):
+            components = {GL_FLOAT: 1, GL_FLOAT_VEC2: 2, GL_FLOAT_VEC3: 3, GL_FLOAT_VEC4: 4}[kind]
+            struct.pack_into("<%df" % components, data, start, *([1.0] * components))
+        elif kind == GL_UNSIGNED_INT_VEC3:
+            struct.pack_into("<3I", data, start, 1, 1, 1)
+
+
+def set_uniforms(gl, program):
+    identity3 = (ctypes.c_float * 9)(1, 0, 0, 0, 1, 0, 0, 0, 1)
+    identity4 = (ctypes.c_float * 16)(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1)
+    #samplers of different types cannot share a texture unit, even with no texture bound
+    unit = 0
+    blocks = {}
+    count = ctypes.c_int()
+    gl.glGetProgramiv(program, GL_ACTIVE_UNIFORMS, ctypes.byref(count))
+    for i in range(count.value):
+        name = ctypes.create_string_buffer(256)
+        size = ctypes.c_int()
+        kind = ctypes.c_uint()
+        gl.glGetActiveUniform(program, i, len(name), None, ctypes.byref(size), ctypes.byref(kind), name)
+        block = uniform_info(gl, program, i, GL_UNIFORM_BLOCK_INDEX)
+        if block >= 0:
+            if block not in blocks:
+                dataSize = ctypes.c_int()
+                gl.glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_DATA_SIZE, ctypes.byref(dataSize))
+                blocks[block] = bytearray(dataSize.value)
+            fill_block_member(blocks[block], kind.value, size.value, uniform_info(gl, program, i, GL_UNIFORM_OFFSET),
+                              uniform_info(gl, program, i, GL_UNIFORM_ARRAY_STRIDE),
+                              uniform_info(gl, program, i, GL_UNIFORM_MATRIX_STRIDE))
+            continue
+        location = gl.glGetUniformLocation(program, name.value)
+        if location < 0:
+            continue
+        if kind.value == GL_FLOAT_MAT4:
+            gl.glUniformMatrix4fv(location, 1, 0, identity4)
+        elif kind.value == GL_FLOAT_MAT3:
+            gl.glUniformMatrix3fv(location, 1, 0, identity3)
+        elif kind.value in SAMPLER_TYPES:
+            gl.glUniform1i(location, unit)
+            unit += 1
+        elif kind.value == GL_FLOAT:
+            gl.glUniform1f(location, 1.0)
+        elif kind.value == GL_FLOAT_VEC2:
+            gl.glUniform2f(location, 1.0, 1.0)
+        elif kind.value == GL_FLOAT_VEC3:
+            gl.glUniform3f(location, 1.0, 1.0, 1.0)
+        elif kind.value == GL_FLOAT_VEC4:
+            gl.glUniform4f(location, 1.0, 1.0, 1.0, 1.0)
+        elif kind.value == GL_UNSIGNED_INT_VEC3:
+            gl.glUniform3ui(location, 1, 1, 1)
+
+    for block, data in blocks.items():
+        buffer = ctypes.c_uint()
+        gl.glGenBuffers(1, ctypes.byref(buffer))
+        gl.glBindBuffer(GL_UNIFORM_BUFFER, buffer)
+        contents = (ctypes.c_char * len(data)).from_buffer(data)
+        gl.glBufferData(GL_UNIFORM_BUFFER, len(data), contents, GL_STATIC_DRAW)
+        gl.glUniformBlockBinding(program, block, block)
+        gl.glBindBufferBase(GL_UNIFORM_BUFFER, block, buffer)
+
+
+def create_target(gl, size):
+    vertexArray = ctypes.c_uint()
+    gl.glGenVertexArrays(1, ctypes.byref(vertexArray))
+    gl.glBindVertexArray(vertexArray)
+    buffer = ctypes.c_uint()
+    gl.glGenBuffers(1, ctypes.byref(buffer))
+    gl.glBindBuffer(GL_ARRAY_BUFFER, buffer)
+    data = (ctypes.c_float * len(VERTICES))(*VERTICES)
+    gl.glBufferData(GL_ARRAY_BUFFER, ctypes.sizeof(data), data, GL_STATIC_DRAW)
+    stride = 8 * 4
+    for attribute, (components, offset) in enumerate([(3, 0), (3, 12), (2, 24)]):
+        gl.glEnableVertexAttribArray(attribute)
+        gl.glVertexAttribPointer(attribute, components, GL_FLOAT, 0, stride, P(offset))
+
+    texture = ctypes.c_uint()
+    gl.glGenTextures(1, ctypes.byref(texture))
+    gl.glBindTexture(GL_TEXTURE_2D, texture)
+    gl.glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size, size)
+    gl.glBindTexture(GL_TEXTURE_2D, 0)
+    framebuffer = ctypes.c_uint()
+    gl.glGenFramebuffers(1, ctypes.byref(framebuffer))
+    gl.glBindFramebuffer(GL_FRAMEBUFFER, framebuffer)
+    gl.glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0)
+    if gl.glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE:
+        sys.exit("the render target is incomplete")
+    gl.glViewport(0, 0, size, size)
+
+
+def time_draws(gl, program, draws, size, repeats=5):
+    gl.glUseProgram(program)
+    set_uniforms(gl, program)
+    #the triangle must cover the target, or the pass measures nothing (e.g. matrices in a
+    #uniform block, which is not filled)
+    query = ctypes.c_uint()
+    gl.glGenQueries(1, ctypes.byref(query))
+    gl.glBeginQuery(GL_SAMPLES_PASSED, query)
+    gl.glDrawArrays(GL_TRIANGLES, 0, 3)
+    gl.glEndQuery(GL_SAMPLES_PASSED)
+    samples = ctypes.c_uint()
+    gl.glGetQueryObjectuiv(query, GL_QUERY_RESULT, ctypes.byref(samples))
+    if gl.glGetError() != 0:
+        sys.exit("the draw failed")
+    if samples.value < size * size:
+        print("warning: the pass covers %d of %d pixels, its time is not comparable" % (samples.value, size * size))
+    best = None
+    for _ in range(repeats):
+        start = time.perf_counter()
+        for _ in range(draws):
+            gl.glDrawArrays(GL_TRIANGLES, 0, 3)
+        gl.glFinish()
+        elapsed = (time.perf_counter() - start) / draws
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def measure(gl, revision, defines, args):
+    label = revision if revision is not None else "working tree"
+    vertex = compile_shader(gl, GL_VERTEX_SHADER, preprocess(revision, "shaders/basic.vert", defines),
+                            label + " basic.vert")
+    fragment = compile_shader(gl, GL_FRAGMENT_SHADER, preprocess(revision, "shaders/basic.frag", defines),
+                              label + " basic.frag")
+    fragmentOnly = link_program(gl, [fragment], True, label + " basic.frag")
+    program = link_program(gl, [vertex, fragment], False, label + " basic")
+    result = {
+        "label": label,
+        "fragment": binary_length(gl, fragmentOnly),
+        "program": binary_length(gl, program),
+        "time": time_draws(gl, program, args.draws, args.size),
+    }
+    for name in (fragmentOnly, program):
+        gl.glDeleteProgram(name)
+    gl.glDeleteShader(vertex)
+    gl.glDeleteShader(fragment)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares two revisions of the basic shader.")
+    parser.add_argument("before", help="git revision")
+    parser.add_argument("after", nargs="?", help="git revision, the working tree if omitted")
+    parser.add_argument("-D", dest="defines", action="append", default=[], help="define added to both")
+    parser.add_argument("--size", type=int, default=1024, help="side of the render target in pixels")
+    parser.add_argument("--draws", type=int, default=20, help="full screen triangles per measurement")
+    args = parser.parse_args()
+
+    gl = create_context()
+    print("renderer: %s, %s" % (gl.glGetString(0x1F01).decode(), gl.glGetString(0x1F02).decode()))
+    create_target(gl, args.size)
+
+    results = [measure(gl, args.before, args.defines, args), measure(gl, args.after, args.defines, args)]
+    pixels = args.size * args.size
+    print("%-24s %16s %16s %12s %12s" % ("", "fragment bytes", "program bytes", "ms / pass", "ns / pixel"))
+    for result in results:
+        print("%-24s %16d %16d %12.3f %12.2f" % (result["label"][:24], result["fragment"], result["program"],
+                                                 result["time"] * 1e3, result["time"] * 1e9 / pixels))
+    before, after = results
+    print("%-24s %15.1f%% %15.1f%% %11.1f%%" % ("change",
+                                                100.0 * (after["fragment"] - before["fragment"]) / before["fragment"],
+                                                100.0 * (after["program"] - before["program"]) / before["program"],
+                                                100.0 * (after["time"] - before["time"]) / before["time"]))
+
+
+if __name__ == "__main__":
+    main()